@@ -0,0 +1,133 @@
+#pragma once
+
+#include "mutils/time.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <format>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mutils::bench {
+// Keeps the compiler from optimizing away a value computed by the
+// benchmark body.
+template <typename T> inline void do_not_optimize(const T &value) {
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "r,m"(value) : "memory");
+#else
+  static volatile const void *sink;
+  sink = &value;
+#endif
+}
+
+struct Options {
+  std::string filter;    // only run benchmarks whose name contains this
+  std::string json_path; // write every result here when set
+  bool large = false;    // include the 1 GB inputs
+};
+
+inline Options &options() {
+  static Options opts;
+  return opts;
+}
+
+struct Result {
+  std::string name;
+  size_t iterations = 0;
+  double ns_per_op = 0;
+  double mb_per_sec = 0; // 0 when the benchmark has no byte count
+  // latency percentiles in ns, only filled in by latency benchmarks
+  double p50 = 0;
+  double p99 = 0;
+  double p999 = 0;
+  double max = 0;
+};
+
+inline std::vector<Result> &results() {
+  static std::vector<Result> all;
+  return all;
+}
+
+inline bool selected(std::string_view name) {
+  return name.find(options().filter) != std::string_view::npos;
+}
+
+inline void record(const Result &r) {
+  std::string line =
+      std::format("{:<48} {:>12.1f} ns/op", r.name, r.ns_per_op);
+  if (r.mb_per_sec > 0)
+    line += std::format(" {:>10.1f} MB/s", r.mb_per_sec);
+  if (r.max > 0)
+    line += std::format("  p50 {:.0f} p99 {:.0f} p999 {:.0f} max {:.0f} ns",
+                        r.p50, r.p99, r.p999, r.max);
+  std::puts(line.c_str());
+  results().push_back(r);
+}
+
+// Fills the percentile fields from raw per-operation samples (in ns).
+inline void add_percentiles(Result &r, std::vector<uint64_t> &samples) {
+  if (samples.empty())
+    return;
+  std::ranges::sort(samples);
+  auto at = [&](double q) {
+    return static_cast<double>(
+        samples[std::min(samples.size() - 1,
+                         static_cast<size_t>(q * samples.size()))]);
+  };
+  r.p50 = at(0.50);
+  r.p99 = at(0.99);
+  r.p999 = at(0.999);
+  r.max = static_cast<double>(samples.back());
+}
+
+// Runs fn() in growing batches until a batch takes at least `min_sec`, then
+// reports the time per call. `bytes` is the amount of input one call
+// processes, used for the throughput column.
+template <typename Fn>
+void run(std::string name, size_t bytes, Fn &&fn, double min_sec = 0.2) {
+  if (!selected(name))
+    return;
+  fn(); // warm up caches and lazily initialized state
+  for (size_t batch = 1;; batch *= 2) {
+    Timer timer;
+    for (size_t i = 0; i < batch; ++i)
+      fn();
+    double sec = timer.elapsedSec();
+    if (sec >= min_sec || batch >= (size_t{1} << 40)) {
+      Result r{std::move(name), batch, sec * 1e9 / batch};
+      if (bytes > 0)
+        r.mb_per_sec = bytes * batch / sec / 1e6;
+      record(r);
+      return;
+    }
+  }
+}
+
+inline void section(std::string_view title) {
+  std::printf("\n== %.*s ==\n", static_cast<int>(title.size()), title.data());
+}
+
+// One JSON object per result, so runs of different releases can be diffed
+// or loaded into a spreadsheet.
+inline bool write_json(const std::string &path) {
+  std::ofstream out(path, std::ios::trunc);
+  if (!out)
+    return false;
+  out << "[\n";
+  for (size_t i = 0; i < results().size(); ++i) {
+    const auto &r = results()[i];
+    out << std::format("  {{\"name\": \"{}\", \"iterations\": {}, "
+                       "\"ns_per_op\": {:.3f}, \"mb_per_sec\": {:.3f}, "
+                       "\"p50_ns\": {:.0f}, \"p99_ns\": {:.0f}, "
+                       "\"p999_ns\": {:.0f}, \"max_ns\": {:.0f}}}",
+                       r.name, r.iterations, r.ns_per_op, r.mb_per_sec, r.p50,
+                       r.p99, r.p999, r.max)
+        << (i + 1 < results().size() ? ",\n" : "\n");
+  }
+  out << "]\n";
+  return static_cast<bool>(out);
+}
+} // namespace mutils::bench
@@ -0,0 +1,91 @@
+#include "bench.hpp"
+#include "mutils/io.hpp"
+#include "mutils/strings.hpp"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace mutils::bench {
+namespace {
+std::filesystem::path make_input(size_t bytes) {
+  auto path = std::filesystem::temp_directory_path() /
+              std::format("mutils_bench_{}.txt", bytes);
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  std::string line;
+  for (size_t written = 0, i = 0; written < bytes; ++i) {
+    line = std::format("{:08} 2024-01-01T00:00:00Z worker-{} request handled "
+                       "in {} us status=ok\n",
+                       i, i % 64, i * 7 % 10000);
+    out << line;
+    written += line.size();
+  }
+  return path;
+}
+
+void bench_file(size_t bytes, std::string_view label) {
+  auto path = make_input(bytes);
+  auto file = path.string();
+  auto size = static_cast<size_t>(std::filesystem::file_size(path));
+
+  run(std::format("readFile {}", label), size,
+      [&] { do_not_optimize(readFile(file)); });
+  run(std::format("readFileToString {}", label), size,
+      [&] { do_not_optimize(readFileToString(file)); });
+  run(std::format("mapFile + count_byte {}", label), size, [&] {
+    auto mapped = mapFile(file);
+    do_not_optimize(count_byte(mapped->view(), '\n'));
+  });
+
+  if (auto text = readFileToString(file)) {
+    run(std::format("lines() {}", label), size, [&] {
+      size_t total = 0;
+      for (auto line : lines(*text))
+        total += line.size();
+      do_not_optimize(total);
+    });
+  }
+
+  run(std::format("ChunkedReader lines {}", label), size, [&] {
+    auto reader = ChunkedReader::open(file);
+    size_t total = 0;
+    for (auto line : lines(*reader))
+      total += line.size();
+    do_not_optimize(total);
+  });
+
+  std::filesystem::remove(path);
+}
+
+// Many small files, like a directory of config shards.
+void bench_many_files(size_t count, size_t bytes) {
+  auto dir = std::filesystem::temp_directory_path() / "mutils_bench_files";
+  std::filesystem::create_directories(dir);
+  std::vector<std::filesystem::path> paths;
+  for (size_t i = 0; i < count; ++i) {
+    paths.push_back(dir / std::format("shard_{}.conf", i));
+    std::ofstream(paths.back(), std::ios::binary) << std::string(bytes, 'x');
+  }
+
+  auto label = std::format("{} x {}B", count, bytes);
+  run(std::format("readFile loop {}", label), count * bytes, [&] {
+    for (auto &path : paths)
+      do_not_optimize(readFile(path.string()));
+  });
+  run(std::format("readFiles {}", label), count * bytes,
+      [&] { do_not_optimize(readFiles(paths)); });
+
+  std::filesystem::remove_all(dir);
+}
+} // namespace
+
+void bench_io() {
+  section("file I/O");
+  bench_file(size_t{1} << 20, "1MB");
+  bench_file(size_t{100} << 20, "100MB");
+  if (options().large)
+    bench_file(size_t{1} << 30, "1GB");
+  bench_many_files(1000, 4096);
+}
+} // namespace mutils::bench
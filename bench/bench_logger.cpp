@@ -0,0 +1,155 @@
+#include "bench.hpp"
+#include "mutils/logger.hpp"
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <streambuf>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace mutils::bench {
+namespace {
+// Swallows console output so the numbers measure the logger rather than
+// the terminal.
+class NullBuffer : public std::streambuf {
+protected:
+  int overflow(int c) override { return c; }
+  std::streamsize xsputn(const char *, std::streamsize n) override {
+    return n;
+  }
+};
+
+// The logger writes the console straight to fds 1 and 2, past the
+// iostream buffers, so those are pointed at /dev/null while it runs.
+class NullConsole {
+public:
+  NullConsole() {
+#ifndef _WIN32
+    std::fflush(stdout);
+    int null = ::open("/dev/null", O_WRONLY);
+    if (null < 0)
+      return;
+    for (int i = 0; i < 2; ++i) {
+      saved_[i] = ::dup(i + 1);
+      ::dup2(null, i + 1);
+    }
+    ::close(null);
+#endif
+  }
+  ~NullConsole() {
+#ifndef _WIN32
+    for (int i = 0; i < 2; ++i)
+      if (saved_[i] >= 0) {
+        ::dup2(saved_[i], i + 1);
+        ::close(saved_[i]);
+      }
+#endif
+  }
+  NullConsole(const NullConsole &) = delete;
+  NullConsole &operator=(const NullConsole &) = delete;
+
+private:
+  int saved_[2] = {-1, -1};
+};
+
+enum class FileMode { OFF, TEXT, BINARY, DIRECT };
+
+void log_throughput(bool async, FileMode mode, unsigned threads,
+                    Timestamps stamps = Timestamps::OFF) {
+  static constexpr const char *modes[] = {"off", "on", "bin console=off",
+                                          "direct"};
+  auto name = std::format("LOG {} file={} threads={}{}",
+                          async ? "async" : "sync",
+                          modes[static_cast<int>(mode)], threads,
+                          stamps == Timestamps::OFF ? "" : " timestamps");
+  if (!selected(name))
+    return;
+
+  bool file = mode != FileMode::OFF;
+
+  constexpr size_t total_messages = 1 << 17;
+  const size_t per_thread = total_messages / threads;
+  auto path = std::filesystem::temp_directory_path() / "mutils_bench.log";
+  std::optional<NullConsole> null_console;
+  null_console.emplace();
+  if (file)
+    Logger::init_file(
+        path, FileOptions{.format = mode == FileMode::BINARY
+                                        ? FileFormat::BINARY
+                                        : FileFormat::TEXT,
+                          .direct = mode == FileMode::DIRECT});
+  Logger::set_console(mode != FileMode::BINARY);
+  Logger::set_timestamps(stamps);
+  if (async)
+    Logger::start_async();
+
+  std::vector<std::vector<uint64_t>> samples(threads);
+  Timer wall;
+  {
+    std::vector<std::jthread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+      workers.emplace_back([&, t] {
+        auto &mine = samples[t];
+        mine.reserve(per_thread);
+        for (size_t i = 0; i < per_thread; ++i) {
+          auto start = std::chrono::steady_clock::now();
+          LOG("bench message {} from thread {} value {:.3f}", i, t, i * 0.5);
+          auto stop = std::chrono::steady_clock::now();
+          mine.push_back(static_cast<uint64_t>(
+              std::chrono::duration_cast<std::chrono::nanoseconds>(stop -
+                                                                   start)
+                  .count()));
+        }
+      });
+    }
+  }
+  Logger::flush_all();
+  double sec = wall.elapsedSec();
+
+  if (async)
+    Logger::stop_async();
+  if (file) {
+    Logger::close_file();
+    std::filesystem::remove(path);
+  }
+  Logger::set_console(true);
+  Logger::set_timestamps(Timestamps::OFF);
+  Logger::flush_all();
+  null_console.reset();
+
+  std::vector<uint64_t> merged;
+  merged.reserve(total_messages);
+  for (auto &s : samples)
+    merged.insert(merged.end(), s.begin(), s.end());
+
+  Result r{name, merged.size(), sec * 1e9 / merged.size()};
+  add_percentiles(r, merged);
+  record(r);
+}
+} // namespace
+
+void bench_logger() {
+  section("logger (ns/op is wall time per message, percentiles per call)");
+
+  NullBuffer null;
+  auto *out = std::cout.rdbuf(&null);
+  auto *err = std::cerr.rdbuf(&null);
+
+  for (bool async : {false, true})
+    for (auto mode : {FileMode::OFF, FileMode::TEXT, FileMode::BINARY})
+      for (unsigned threads : {1u, 4u, 16u, 64u})
+        log_throughput(async, mode, threads);
+  for (bool async : {false, true})
+    log_throughput(async, FileMode::TEXT, 1, Timestamps::MICROS);
+  for (bool async : {false, true})
+    log_throughput(async, FileMode::DIRECT, 1);
+
+  std::cout.rdbuf(out);
+  std::cerr.rdbuf(err);
+}
+} // namespace mutils::bench
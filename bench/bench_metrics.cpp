@@ -0,0 +1,42 @@
+#include "bench.hpp"
+#include "mutils/metrics.hpp"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace mutils::bench {
+namespace {
+// Each of `threads` threads adds 1 `per_thread` times.
+template <typename Add>
+void contended(const char *name, unsigned threads, Add &&add) {
+  constexpr size_t per_thread = 1 << 20;
+  run(std::format("{} threads={}", name, threads), 0, [&] {
+    std::vector<std::jthread> workers;
+    for (unsigned t = 0; t < threads; ++t)
+      workers.emplace_back([&] {
+        for (size_t i = 0; i < per_thread; ++i)
+          add();
+      });
+  });
+}
+} // namespace
+
+void bench_metrics() {
+  section("metrics (contended runs: ns per 1M adds on each thread)");
+  auto counter = Metrics::counter("bench_counter");
+  auto latency = Metrics::distribution("bench_latency");
+  std::atomic<uint64_t> shared{0};
+
+  run("metrics/Counter::add", 0, [&] { counter.add(); });
+  run("metrics/atomic fetch_add", 0,
+      [&] { shared.fetch_add(1, std::memory_order_relaxed); });
+  run("metrics/Distribution::record", 0, [&] { latency.record(1234); });
+  run("metrics/snapshot", 0, [] { do_not_optimize(Metrics::snapshot()); });
+
+  for (unsigned threads : {1u, 4u}) {
+    contended("metrics/Counter::add", threads, [&] { counter.add(); });
+    contended("metrics/atomic fetch_add", threads,
+              [&] { shared.fetch_add(1, std::memory_order_relaxed); });
+  }
+}
+} // namespace mutils::bench
@@ -0,0 +1,184 @@
+#include "bench.hpp"
+#include "mutils/memory.hpp"
+#include "mutils/strings.hpp"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace mutils::bench {
+void bench_strings() {
+  section("string kernels");
+
+  // 1 MiB of mixed-case text with sparse newlines and delimiters
+  std::string text(1 << 20, ' ');
+  std::mt19937 rng(42);
+  for (auto &c : text) {
+    unsigned r = rng() % 64;
+    c = r == 0 ? '\n' : r == 1 ? ';' : static_cast<char>('A' + r % 58);
+  }
+  text.back() = '|'; // only match for the find benchmarks
+  std::string upper = text;
+  std::ranges::transform(upper, upper.begin(), [](unsigned char c) {
+    return static_cast<char>(std::toupper(c));
+  });
+  const char *first = text.data();
+  const char *last = text.data() + text.size();
+  const size_t n = text.size();
+
+  run("std::string_view::find_first_of", n, [&] {
+    do_not_optimize(std::string_view(text).find_first_of("|#"));
+  });
+  run("std::count", n,
+      [&] { do_not_optimize(std::ranges::count(text, '\n')); });
+  run("std::equal + tolower", n, [&] {
+    do_not_optimize(std::ranges::equal(text, upper, [](char a, char b) {
+      return std::tolower(static_cast<unsigned char>(a)) ==
+             std::tolower(static_cast<unsigned char>(b));
+    }));
+  });
+  std::string scratch = text;
+  run("std::transform + tolower", n, [&] {
+    std::ranges::transform(scratch, scratch.begin(), [](unsigned char c) {
+      return static_cast<char>(std::tolower(c));
+    });
+    do_not_optimize(scratch);
+  });
+
+  const simd::ByteSet set("|#");
+  const simd::Isa isas[] = {simd::Isa::SCALAR, simd::Isa::SSE2,
+                            simd::Isa::AVX2, simd::Isa::NEON};
+  const simd::Isa best = simd::detect_isa();
+  for (auto isa : isas) {
+    bool supported = isa == simd::Isa::SCALAR || isa == best ||
+                     (isa == simd::Isa::SSE2 && best == simd::Isa::AVX2);
+    if (!supported)
+      continue;
+    auto k = simd::kernels_for(isa);
+    std::string tag = std::format(" [{}]", simd::isa_name(isa));
+
+    run("find_any" + tag, n,
+        [&] { do_not_optimize(k.find_any(first, last, set)); });
+    run("count_byte" + tag, n,
+        [&] { do_not_optimize(k.count_byte(first, last, '\n')); });
+    run("iequals" + tag, n, [&] {
+      do_not_optimize(k.iequals(text.data(), upper.data(), n));
+    });
+    run("to_lower" + tag, n, [&] {
+      k.to_lower(scratch.data(), n);
+      do_not_optimize(scratch);
+    });
+  }
+}
+
+void bench_csv() {
+  section("split/trim on CSV rows");
+
+  std::vector<std::string> rows;
+  size_t bytes = 0;
+  std::mt19937 rng(7);
+  for (int i = 0; i < 10000; ++i) {
+    rows.push_back(std::format(" {}, user{} , {:.2f},2024-{:02}-{:02}, "
+                               "\"some free text\" ,{},,ok ",
+                               rng() % 1000000, rng() % 5000,
+                               (rng() % 100000) / 100.0, rng() % 12 + 1,
+                               rng() % 28 + 1, rng() % 7));
+    bytes += rows.back().size();
+  }
+
+  run("split", bytes, [&] {
+    for (const auto &row : rows)
+      do_not_optimize(split(row, ','));
+  });
+  Arena arena;
+  run("split (arena, reset per row)", bytes, [&] {
+    for (const auto &row : rows) {
+      ArenaScope scope(arena);
+      do_not_optimize(split(row, ',', &arena));
+    }
+  });
+  run("split_view", bytes, [&] {
+    size_t total = 0;
+    for (const auto &row : rows)
+      for (auto field : split_view(row, ','))
+        total += field.size();
+    do_not_optimize(total);
+  });
+  std::vector<std::string_view> fields;
+  run("split_into (reused vector)", bytes, [&] {
+    for (const auto &row : rows) {
+      split_into(row, ',', fields);
+      do_not_optimize(fields.data());
+    }
+  });
+  run("split + trim", bytes, [&] {
+    for (const auto &row : rows)
+      for (const auto &field : split(row, ','))
+        do_not_optimize(trim(field));
+  });
+  run("split_view + trim_view", bytes, [&] {
+    for (const auto &row : rows)
+      for (auto field : split_view(row, ','))
+        do_not_optimize(trim_view(field));
+  });
+
+  std::mt19937_64 rng64(7);
+  // the first column, then ids 8 to 16 digits long
+  for (int wide = 0; wide < 2; ++wide) {
+    std::vector<std::string> owned;
+    for (const auto &row : rows)
+      owned.emplace_back(
+          wide ? std::to_string(10000000 + rng64() % 9999999990000000)
+               : trim_view(row.substr(0, row.find(','))));
+    std::vector<std::string_view> column(owned.begin(), owned.end());
+    size_t column_bytes = 0;
+    for (auto field : column)
+      column_bytes += field.size();
+    std::vector<int64_t> values;
+    const char *width = wide ? "8-16" : "1-6";
+    run(std::format("std::stoll ({} digits)", width), column_bytes, [&] {
+      values.clear();
+      for (auto field : column)
+        values.push_back(std::stoll(std::string(field)));
+      do_not_optimize(values.data());
+    });
+    run(std::format("std::from_chars ({} digits)", width), column_bytes, [&] {
+      values.resize(column.size());
+      for (size_t i = 0; i < column.size(); ++i)
+        std::from_chars(column[i].data(),
+                        column[i].data() + column[i].size(), values[i]);
+      do_not_optimize(values.data());
+    });
+    run(std::format("parse_into ({} digits)", width), column_bytes, [&] {
+      do_not_optimize(parse_into(column, values));
+    });
+  }
+
+  std::vector<int64_t> numbers(10000);
+  for (auto &v : numbers)
+    v = static_cast<int64_t>(rng64() % 100000000000) - 50000000000;
+  std::string out;
+  run("std::format {} x10000", 0, [&] {
+    out.clear();
+    for (auto v : numbers)
+      std::format_to(std::back_inserter(out), "{}", v);
+    do_not_optimize(out.data());
+  });
+  run("std::to_chars x10000", 0, [&] {
+    out.clear();
+    for (auto v : numbers) {
+      char buf[max_int_chars];
+      out.append(buf, std::to_chars(buf, buf + sizeof(buf), v).ptr);
+    }
+    do_not_optimize(out.data());
+  });
+  run("append_number x10000", 0, [&] {
+    out.clear();
+    for (auto v : numbers)
+      append_number(out, v);
+    do_not_optimize(out.data());
+  });
+}
+} // namespace mutils::bench
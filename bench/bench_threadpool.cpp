@@ -0,0 +1,34 @@
+#include "bench.hpp"
+#include "mutils/threadpool.hpp"
+#include <cmath>
+#include <future>
+#include <vector>
+
+namespace mutils::bench {
+void bench_threadpool() {
+  section("thread pool");
+  ThreadPool pool;
+
+  // round trip of an empty task: what a caller pays to offload work
+  run("pool/submit+get", 0, [&] { pool.submit([] { return 1; }).get(); });
+  run("pool/std::async+get", 0,
+      [] { std::async(std::launch::async, [] { return 1; }).get(); });
+
+  std::vector<double> values(1 << 20);
+  run("pool/parallel_for 1M sqrt", values.size() * sizeof(double), [&] {
+    pool.parallel_for(0, values.size(), [&](size_t i) {
+      values[i] = std::sqrt(static_cast<double>(i));
+    });
+  });
+  run("pool/serial for 1M sqrt", values.size() * sizeof(double), [&] {
+    for (size_t i = 0; i < values.size(); ++i)
+      values[i] = std::sqrt(static_cast<double>(i));
+    do_not_optimize(values.data());
+  });
+  run("pool/parallel_reduce 1M", values.size() * sizeof(double), [&] {
+    do_not_optimize(pool.parallel_reduce(
+        0, values.size(), 0.0, [&](size_t i) { return values[i]; },
+        std::plus<>{}));
+  });
+}
+} // namespace mutils::bench
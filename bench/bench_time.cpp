@@ -0,0 +1,37 @@
+#include "bench.hpp"
+#include "mutils/profiler.hpp"
+#include "mutils/time.hpp"
+#include <chrono>
+#include <filesystem>
+
+namespace mutils::bench {
+void bench_time() {
+  section("clocks");
+  run("clock/high_resolution_clock::now", 0, [] {
+    do_not_optimize(std::chrono::high_resolution_clock::now());
+  });
+  run("clock/steady_clock::now", 0,
+      [] { do_not_optimize(std::chrono::steady_clock::now()); });
+  run("clock/FastClock::now", 0,
+      [] { do_not_optimize(FastClock::now()); });
+  run("clock/FastClock::ticks", 0,
+      [] { do_not_optimize(FastClock::ticks()); });
+
+  Timer timer;
+  run("clock/Timer::elapsedUs", 0,
+      [&] { do_not_optimize(timer.elapsedUs()); });
+  CycleTimer cycle_timer;
+  run("clock/CycleTimer::elapsedUs", 0,
+      [&] { do_not_optimize(cycle_timer.elapsedUs()); });
+  run("clock/PROFILE_SCOPE", 0, [] { PROFILE_SCOPE("bench zone"); });
+
+  if (selected("clock/PROFILE_SCOPE traced")) {
+    auto path = std::filesystem::temp_directory_path() / "mutils_bench.json";
+    Tracer::start(path);
+    run("clock/PROFILE_SCOPE traced", 0,
+        [] { PROFILE_SCOPE("traced bench zone"); });
+    Tracer::stop();
+    std::filesystem::remove(path);
+  }
+}
+} // namespace mutils::bench
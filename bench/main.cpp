@@ -0,0 +1,49 @@
+#include "bench.hpp"
+#include <cstdio>
+#include <string_view>
+
+namespace mutils::bench {
+void bench_strings();
+void bench_csv();
+void bench_io();
+void bench_logger();
+void bench_time();
+void bench_threadpool();
+void bench_metrics();
+} // namespace mutils::bench
+
+// Usage: mutils_bench [--filter <substring>] [--json <file>] [--large]
+int main(int argc, char **argv) {
+  auto &opts = mutils::bench::options();
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (arg == "--filter" && i + 1 < argc) {
+      opts.filter = argv[++i];
+    } else if (arg == "--json" && i + 1 < argc) {
+      opts.json_path = argv[++i];
+    } else if (arg == "--large") {
+      opts.large = true;
+    } else {
+      std::fprintf(stderr,
+                   "usage: %s [--filter <substring>] [--json <file>] "
+                   "[--large]\n",
+                   argv[0]);
+      return 1;
+    }
+  }
+
+  mutils::bench::bench_strings();
+  mutils::bench::bench_csv();
+  mutils::bench::bench_io();
+  mutils::bench::bench_logger();
+  mutils::bench::bench_time();
+  mutils::bench::bench_threadpool();
+  mutils::bench::bench_metrics();
+
+  if (!opts.json_path.empty() &&
+      !mutils::bench::write_json(opts.json_path)) {
+    std::fprintf(stderr, "failed to write %s\n", opts.json_path.c_str());
+    return 1;
+  }
+  return 0;
+}
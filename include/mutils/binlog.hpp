@@ -0,0 +1,479 @@
+#pragma once
+
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+// Binary log file format (LogSink in FileFormat::BINARY mode).
+//
+// A file is the magic string followed by records; appending to a file adds
+// another magic string, which resets the decoder. Each record is a tag byte,
+// a varint body length and the body, so readers can skip tags they do not
+// know. Integers are LEB128 varints, signed ones zigzag encoded.
+//
+//   TAG_THREAD  index, thread id (rest of body)
+//   TAG_FORMAT  id, format string length, format string, context (rest)
+//   TAG_LOG     timestamp delta, level byte, thread index, format id, args
+//   TAG_TEXT    timestamp delta, thread index, text (rest of body)
+//
+// Timestamps are nanoseconds since the Unix epoch, stored as the (signed)
+// difference to the previous TAG_LOG/TAG_TEXT record of the file. Every
+// thread and format string is defined once per file, before first use; a
+// thread index is defined again when an exited thread's index is reused.
+// Arguments are a type byte followed by the value; see ArgType.
+namespace mutils::binlog {
+inline constexpr std::string_view magic = "MUTLOG1\n";
+
+enum RecordTag : uint8_t {
+  TAG_THREAD = 1,
+  TAG_FORMAT = 2,
+  TAG_LOG = 3,
+  TAG_TEXT = 4,
+};
+
+enum ArgType : uint8_t {
+  ARG_BOOL = 1,    // one byte
+  ARG_CHAR = 2,    // one byte
+  ARG_INT = 3,     // zigzag varint
+  ARG_UINT = 4,    // varint
+  ARG_FLOAT = 5,   // 4 bytes, little endian
+  ARG_DOUBLE = 6,  // 8 bytes, little endian
+  ARG_STRING = 7,  // varint length, bytes
+  ARG_POINTER = 8, // varint
+};
+
+inline void put_varint(std::string &out, uint64_t v) {
+  while (v >= 0x80) {
+    out += static_cast<char>(v | 0x80);
+    v >>= 7;
+  }
+  out += static_cast<char>(v);
+}
+
+inline uint64_t zigzag(int64_t v) {
+  return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+inline int64_t unzigzag(uint64_t v) {
+  return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+// Reads a varint from the front of `in`; false if it is truncated.
+inline bool get_varint(std::string_view &in, uint64_t &v) {
+  v = 0;
+  for (unsigned shift = 0; shift < 64 && !in.empty(); shift += 7) {
+    auto byte = static_cast<uint8_t>(in.front());
+    in.remove_prefix(1);
+    v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+template <typename T> void put_fixed(std::string &out, T v) {
+  static_assert(std::endian::native == std::endian::little,
+                "binary logs are written little endian");
+  char bytes[sizeof(T)];
+  std::memcpy(bytes, &v, sizeof(T));
+  out.append(bytes, sizeof(T));
+}
+
+// Types with a binary encoding; a call with any other argument type is
+// stored as its formatted text.
+template <typename T>
+concept Encodable =
+    std::is_same_v<T, bool> || std::is_same_v<T, char> ||
+    (std::is_integral_v<T> && !std::is_same_v<T, wchar_t> &&
+     !std::is_same_v<T, char8_t> && !std::is_same_v<T, char16_t> &&
+     !std::is_same_v<T, char32_t>) ||
+    std::is_same_v<T, float> || std::is_same_v<T, double> ||
+    std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view> ||
+    std::is_same_v<T, const char *> || std::is_same_v<T, char *> ||
+    (std::is_array_v<T> && std::is_same_v<std::remove_extent_t<T>, char>) ||
+    std::is_same_v<T, const void *> || std::is_same_v<T, void *> ||
+    std::is_same_v<T, std::nullptr_t>;
+
+template <Encodable T> void encode_arg(std::string &out, const T &v) {
+  if constexpr (std::is_same_v<T, bool>) {
+    out += static_cast<char>(ARG_BOOL);
+    out += static_cast<char>(v);
+  } else if constexpr (std::is_same_v<T, char>) {
+    out += static_cast<char>(ARG_CHAR);
+    out += v;
+  } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+    out += static_cast<char>(ARG_INT);
+    put_varint(out, zigzag(v));
+  } else if constexpr (std::is_integral_v<T>) {
+    out += static_cast<char>(ARG_UINT);
+    put_varint(out, v);
+  } else if constexpr (std::is_same_v<T, float>) {
+    out += static_cast<char>(ARG_FLOAT);
+    put_fixed(out, v);
+  } else if constexpr (std::is_same_v<T, double>) {
+    out += static_cast<char>(ARG_DOUBLE);
+    put_fixed(out, v);
+  } else if constexpr (std::is_pointer_v<T> &&
+                       !std::is_same_v<std::remove_cv_t<
+                                           std::remove_pointer_t<T>>,
+                                       char>) {
+    out += static_cast<char>(ARG_POINTER);
+    put_varint(out, reinterpret_cast<uintptr_t>(v));
+  } else if constexpr (std::is_same_v<T, std::nullptr_t>) {
+    out += static_cast<char>(ARG_POINTER);
+    put_varint(out, 0);
+  } else {
+    std::string_view s(v);
+    out += static_cast<char>(ARG_STRING);
+    put_varint(out, s.size());
+    out.append(s);
+  }
+}
+
+// One TAG_LOG or TAG_TEXT record. Views point into the file data and the
+// reader's tables.
+struct Entry {
+  RecordTag tag;
+  int64_t timestamp_ns;
+  uint8_t level; // a LogLevel; INFO for TAG_TEXT
+  std::string_view thread;
+  std::string_view format;  // the text itself for TAG_TEXT
+  std::string_view context; // the LOG_WCTX scope, may be empty
+  std::string_view args;    // still encoded; see format_message()
+};
+
+// Walks the records of a binary log held in memory (e.g. a MappedFile).
+// Filtering on an Entry's level, thread or time does not decode arguments.
+class Reader {
+public:
+  explicit Reader(std::string_view data) : in_(data) {}
+
+  // Advances to the next log entry; false at the end or on corrupt input
+  // (see error()).
+  bool next(Entry &e) {
+    while (!in_.empty()) {
+      if (in_.starts_with(magic)) {
+        in_.remove_prefix(magic.size());
+        threads_.clear();
+        formats_.clear();
+        last_ts_ = 0;
+        started_ = true;
+        continue;
+      }
+      if (!started_)
+        return fail("not a binary mutils log");
+
+      auto tag = static_cast<uint8_t>(in_.front());
+      in_.remove_prefix(1);
+      uint64_t len;
+      if (!get_varint(in_, len) || len > in_.size())
+        return fail("truncated record");
+      std::string_view body = in_.substr(0, len);
+      in_.remove_prefix(len);
+
+      uint64_t a, b;
+      switch (tag) {
+      case TAG_THREAD:
+        if (!get_varint(body, a))
+          return fail("bad thread record");
+        threads_[a] = body;
+        break;
+      case TAG_FORMAT:
+        if (!get_varint(body, a) || !get_varint(body, b) || b > body.size())
+          return fail("bad format record");
+        formats_[a] = {body.substr(0, b), body.substr(b)};
+        break;
+      case TAG_LOG:
+      case TAG_TEXT: {
+        if (!get_varint(body, a))
+          return fail("bad log record");
+        last_ts_ += unzigzag(a);
+        e.tag = static_cast<RecordTag>(tag);
+        e.timestamp_ns = last_ts_;
+        e.level = 1;
+        if (tag == TAG_LOG) {
+          if (body.empty())
+            return fail("bad log record");
+          e.level = static_cast<uint8_t>(body.front());
+          body.remove_prefix(1);
+        }
+        if (!get_varint(body, a))
+          return fail("bad log record");
+        auto thread = threads_.find(a);
+        e.thread = thread != threads_.end() ? thread->second : "?";
+        if (tag == TAG_TEXT) {
+          e.format = body;
+          e.context = {};
+          e.args = {};
+          return true;
+        }
+        if (!get_varint(body, b))
+          return fail("bad log record");
+        auto format = formats_.find(b);
+        if (format == formats_.end())
+          return fail("undefined format string");
+        e.format = format->second.format;
+        e.context = format->second.context;
+        e.args = body;
+        return true;
+      }
+      default:
+        break; // written by a newer version, skip it
+      }
+    }
+    return false;
+  }
+
+  std::string_view error() const { return error_; }
+
+private:
+  struct Format {
+    std::string_view format;
+    std::string_view context;
+  };
+
+  bool fail(std::string_view why) {
+    error_ = why;
+    in_ = {};
+    return false;
+  }
+
+  std::string_view in_;
+  std::string_view error_;
+  bool started_ = false;
+  int64_t last_ts_ = 0;
+  std::unordered_map<uint64_t, std::string_view> threads_;
+  std::unordered_map<uint64_t, Format> formats_;
+};
+
+namespace detail {
+struct Arg {
+  ArgType type;
+  union {
+    bool b;
+    char c;
+    int64_t i;
+    uint64_t u;
+    float f;
+    double d;
+  };
+  std::string_view s;
+};
+
+inline bool decode_args(std::string_view in, std::vector<Arg> &args) {
+  args.clear();
+  while (!in.empty()) {
+    Arg a{};
+    a.type = static_cast<ArgType>(in.front());
+    in.remove_prefix(1);
+    uint64_t v = 0;
+    switch (a.type) {
+    case ARG_BOOL:
+    case ARG_CHAR:
+      if (in.empty())
+        return false;
+      // b and c share storage: set only the one format_arg reads
+      if (a.type == ARG_BOOL)
+        a.b = in.front() != 0;
+      else
+        a.c = in.front();
+      in.remove_prefix(1);
+      break;
+    case ARG_INT:
+    case ARG_UINT:
+    case ARG_POINTER:
+      if (!get_varint(in, v))
+        return false;
+      a.u = v;
+      if (a.type == ARG_INT)
+        a.i = unzigzag(v);
+      break;
+    case ARG_FLOAT:
+      if (in.size() < sizeof(float))
+        return false;
+      std::memcpy(&a.f, in.data(), sizeof(float));
+      in.remove_prefix(sizeof(float));
+      break;
+    case ARG_DOUBLE:
+      if (in.size() < sizeof(double))
+        return false;
+      std::memcpy(&a.d, in.data(), sizeof(double));
+      in.remove_prefix(sizeof(double));
+      break;
+    case ARG_STRING:
+      if (!get_varint(in, v) || v > in.size())
+        return false;
+      a.s = in.substr(0, v);
+      in.remove_prefix(v);
+      break;
+    default:
+      return false;
+    }
+    args.push_back(a);
+  }
+  return true;
+}
+
+// Formats one replacement field, `spec` being "{...}" with the argument
+// index removed.
+inline void format_arg(std::string &out, std::string_view spec,
+                       const Arg &a) {
+  auto it = std::back_inserter(out);
+  switch (a.type) {
+  case ARG_BOOL: {
+    bool v = a.b;
+    std::vformat_to(it, spec, std::make_format_args(v));
+    break;
+  }
+  case ARG_CHAR: {
+    char v = a.c;
+    std::vformat_to(it, spec, std::make_format_args(v));
+    break;
+  }
+  case ARG_INT: {
+    long long v = a.i;
+    std::vformat_to(it, spec, std::make_format_args(v));
+    break;
+  }
+  case ARG_UINT: {
+    unsigned long long v = a.u;
+    std::vformat_to(it, spec, std::make_format_args(v));
+    break;
+  }
+  case ARG_FLOAT: {
+    float v = a.f;
+    std::vformat_to(it, spec, std::make_format_args(v));
+    break;
+  }
+  case ARG_DOUBLE: {
+    double v = a.d;
+    std::vformat_to(it, spec, std::make_format_args(v));
+    break;
+  }
+  case ARG_STRING: {
+    std::string_view v = a.s;
+    std::vformat_to(it, spec, std::make_format_args(v));
+    break;
+  }
+  case ARG_POINTER: {
+    const void *v = reinterpret_cast<const void *>(a.u);
+    std::vformat_to(it, spec, std::make_format_args(v));
+    break;
+  }
+  }
+}
+} // namespace detail
+
+// Appends the message of `e` as std::format would have produced it. Fields
+// that do not match their argument are written as "{?}".
+inline void format_message(std::string &out, const Entry &e) {
+  if (e.tag == TAG_TEXT) {
+    out += e.format;
+    return;
+  }
+  thread_local std::vector<detail::Arg> args;
+  if (!detail::decode_args(e.args, args)) {
+    out += "{corrupt arguments}";
+    return;
+  }
+
+  std::string_view fmt = e.format;
+  size_t next_arg = 0;
+  std::string spec;
+  for (size_t i = 0; i < fmt.size(); ++i) {
+    char c = fmt[i];
+    if ((c == '{' || c == '}') && i + 1 < fmt.size() && fmt[i + 1] == c) {
+      out += c;
+      ++i;
+      continue;
+    }
+    if (c != '{') {
+      out += c;
+      continue;
+    }
+    // the field ends at its matching '}': a dynamic width or precision
+    // nests a replacement field of its own
+    size_t close = i + 1;
+    for (int depth = 1; close < fmt.size(); ++close) {
+      if (fmt[close] == '{')
+        ++depth;
+      else if (fmt[close] == '}' && --depth == 0)
+        break;
+    }
+    if (close >= fmt.size()) {
+      out += fmt.substr(i);
+      break;
+    }
+    std::string_view field = fmt.substr(i + 1, close - i - 1);
+    size_t colon = field.find(':');
+    auto parse_index = [&](std::string_view index) {
+      if (index.empty())
+        return next_arg++;
+      size_t n = 0;
+      for (char d : index)
+        n = n * 10 + static_cast<size_t>(d - '0');
+      return n;
+    };
+    size_t arg = parse_index(field.substr(0, colon));
+    try {
+      spec.assign(1, '{');
+      if (colon != std::string_view::npos) {
+        // substitute the values of nested fields, which std::format only
+        // accepts for integer arguments
+        std::string_view rest = field.substr(colon);
+        for (size_t open; (open = rest.find('{')) != std::string_view::npos;) {
+          size_t end = rest.find('}', open);
+          if (end == std::string_view::npos)
+            throw std::format_error("unterminated nested field");
+          size_t nested = parse_index(rest.substr(open + 1, end - open - 1));
+          if (nested >= args.size())
+            throw std::format_error("missing argument");
+          const detail::Arg &n = args[nested];
+          if (n.type == ARG_INT && n.i < 0)
+            throw std::format_error("negative width or precision");
+          if (n.type != ARG_INT && n.type != ARG_UINT)
+            throw std::format_error("width or precision is not an integer");
+          spec += rest.substr(0, open);
+          spec += std::to_string(n.type == ARG_INT
+                                     ? static_cast<unsigned long long>(n.i)
+                                     : n.u);
+          rest.remove_prefix(end + 1);
+        }
+        spec += rest;
+      }
+      spec += '}';
+      if (arg >= args.size())
+        throw std::format_error("missing argument");
+      detail::format_arg(out, spec, args[arg]);
+    } catch (const std::format_error &) {
+      out += "{?}";
+    }
+    i = close;
+  }
+}
+
+// "2024-01-31T12:34:56.123456789Z"
+inline void format_timestamp(std::string &out, int64_t ns) {
+  using namespace std::chrono;
+  sys_time<nanoseconds> tp{nanoseconds(ns)};
+  auto day = floor<days>(tp);
+  year_month_day ymd{day};
+  hh_mm_ss<nanoseconds> tod{tp - day};
+  std::format_to(std::back_inserter(out),
+                 "{:04}-{:02}-{:02}T{:02}:{:02}:{:02}.{:09}Z",
+                 static_cast<int>(ymd.year()),
+                 static_cast<unsigned>(ymd.month()),
+                 static_cast<unsigned>(ymd.day()), tod.hours().count(),
+                 tod.minutes().count(), tod.seconds().count(),
+                 tod.subseconds().count());
+}
+} // namespace mutils::binlog
@@ -1,6 +1,8 @@
 #pragma once
 
-#include <functional>
+#include <exception>
+#include <type_traits>
+#include <utility>
 #define DEFER_CONCAT_(a, b) a##b
 #define DEFER_CONCAT(a, b) DEFER_CONCAT_(a, b)
 
@@ -8,16 +10,80 @@
 #define DEFER(fn)                                                              \
   mutils::ScopeGuard DEFER_CONCAT(_guard_, __LINE__)([&] { fn; })
 
+// Like DEFER, but only when the scope is left normally / by an exception.
+#define DEFER_SUCCESS(fn)                                                      \
+  mutils::ScopeSuccess DEFER_CONCAT(_guard_, __LINE__)([&] { fn; })
+#define DEFER_FAIL(fn)                                                         \
+  mutils::ScopeFail DEFER_CONCAT(_guard_, __LINE__)([&] { fn; })
+
 namespace mutils {
-class ScopeGuard {
+// Runs `fn` when the guard goes out of scope, unless dismissed. The callable
+// is stored by value, so the cleanup is inlined like hand-written code.
+template <typename F> class ScopeGuard {
 public:
-  explicit ScopeGuard(std::function<void()> fn) : fn_(fn) {}
-  ~ScopeGuard() { fn_(); }
+  explicit ScopeGuard(F fn) noexcept(std::is_nothrow_move_constructible_v<F>)
+      : fn_(std::move(fn)) {}
+  ScopeGuard(ScopeGuard &&other) noexcept(
+      std::is_nothrow_move_constructible_v<F>)
+      : fn_(std::move(other.fn_)),
+        active_(std::exchange(other.active_, false)) {}
+  ~ScopeGuard() {
+    if (active_)
+      fn_();
+  }
   ScopeGuard(const ScopeGuard &) = delete;
   ScopeGuard &operator=(const ScopeGuard &) = delete;
+  ScopeGuard &operator=(ScopeGuard &&) = delete;
+
+  // Cancels the cleanup, e.g. once a transaction has been committed
+  void dismiss() noexcept { active_ = false; }
+
+private:
+  F fn_;
+  bool active_ = true;
+};
+
+template <typename F> ScopeGuard(F) -> ScopeGuard<F>;
+
+namespace detail {
+// Runs `fn` at scope exit if an exception is (on_fail) or is not
+// (!on_fail) propagating out of the scope the guard was created in.
+template <typename F, bool on_fail> class ExceptionGuard {
+public:
+  explicit ExceptionGuard(F fn) noexcept(
+      std::is_nothrow_move_constructible_v<F>)
+      : fn_(std::move(fn)) {}
+  // a success cleanup may throw, since no other exception is in flight
+  ~ExceptionGuard() noexcept(on_fail) {
+    if (active_ && (std::uncaught_exceptions() > exceptions_) == on_fail)
+      fn_();
+  }
+  ExceptionGuard(const ExceptionGuard &) = delete;
+  ExceptionGuard &operator=(const ExceptionGuard &) = delete;
+
+  void dismiss() noexcept { active_ = false; }
 
 private:
-  std::function<void()> fn_;
+  F fn_;
+  int exceptions_ = std::uncaught_exceptions();
+  bool active_ = true;
+};
+} // namespace detail
+
+// Runs `fn` at scope exit only if no exception is leaving the scope
+template <typename F>
+class ScopeSuccess : public detail::ExceptionGuard<F, false> {
+public:
+  using detail::ExceptionGuard<F, false>::ExceptionGuard;
 };
 
+// Runs `fn` at scope exit only if an exception is leaving the scope
+template <typename F> class ScopeFail : public detail::ExceptionGuard<F, true> {
+public:
+  using detail::ExceptionGuard<F, true>::ExceptionGuard;
+};
+
+template <typename F> ScopeSuccess(F) -> ScopeSuccess<F>;
+template <typename F> ScopeFail(F) -> ScopeFail<F>;
+
 } // namespace mutils
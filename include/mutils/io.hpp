@@ -1,31 +1,129 @@
 #pragma once
 
 #include "logger.hpp"
-#include <fstream>
+#include "simd.hpp"
+#include "threadpool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <filesystem>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <optional>
+#include <ranges>
+#include <span>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
 #include <vector>
 
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define MUTILS_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
 namespace mutils {
-// Reads the entire contents of a file into a vector of chars. Returns
-// std::nullopt on failure.
-inline std::optional<std::vector<char>> readFile(const std::string &filename) {
-  std::ifstream file(filename, std::ios::ate | std::ios::binary);
-  if (!file.is_open()) {
+namespace detail {
+// Sized by fstat() for regular files; pipes, devices and files that report
+// no size are read until EOF.
+template <typename Buffer>
+bool read_whole_file(const std::string &filename, Buffer &buffer) {
+#ifdef _WIN32
+  int fd = ::_open(filename.c_str(), _O_RDONLY | _O_BINARY | _O_NOINHERIT);
+  struct _stat64 st;
+  bool sized = fd >= 0 && ::_fstat64(fd, &st) == 0 &&
+               (st.st_mode & _S_IFMT) == _S_IFREG && st.st_size > 0;
+#else
+  int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  bool sized = fd >= 0 && ::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+               st.st_size > 0;
+#endif
+  if (fd < 0) {
     LOG_ERR("Failed to open file: {} - {}", filename,
             std::system_category().message(errno));
-    return std::nullopt;
+    return false;
   }
-  size_t fileSize = static_cast<size_t>(file.tellg());
-  std::vector<char> buffer(fileSize);
-  file.seekg(0);
-  file.read(buffer.data(), fileSize);
-  if (file.fail()) {
+  constexpr size_t step = 64 * 1024;
+  buffer.resize(sized ? static_cast<size_t>(st.st_size) : step);
+  size_t done = 0;
+  int err = 0;
+  for (;;) {
+    if (done == buffer.size()) {
+      if (sized)
+        break;
+      buffer.resize(done + step);
+    }
+    size_t want = buffer.size() - done;
+#ifdef _WIN32
+    auto n = ::_read(fd, buffer.data() + done,
+                     static_cast<unsigned>(std::min<size_t>(want, 1u << 30)));
+#else
+    ssize_t n = ::read(fd, buffer.data() + done, want);
+    if (n < 0 && errno == EINTR)
+      continue;
+#endif
+    if (n < 0) {
+      err = errno;
+      break;
+    }
+    if (n == 0)
+      break;
+    done += static_cast<size_t>(n);
+  }
+#ifdef _WIN32
+  ::_close(fd);
+#else
+  ::close(fd);
+#endif
+  if (err != 0) {
     LOG_ERR("Failed to read file: {} - {}", filename,
-            std::system_category().message(errno));
-    return std::nullopt;
+            std::system_category().message(err));
+    return false;
   }
-  file.close();
+  buffer.resize(done);
+  return true;
+}
+} // namespace detail
+
+// Reads the entire contents of a file into a vector of chars. Returns
+// std::nullopt on failure.
+inline std::optional<std::vector<char>> readFile(const std::string &filename) {
+  std::vector<char> buffer;
+  if (!detail::read_whole_file(filename, buffer))
+    return std::nullopt;
+  return buffer;
+}
+
+// Same, with the buffer allocated from `resource`.
+inline std::optional<std::pmr::vector<char>>
+readFile(const std::string &filename, std::pmr::memory_resource *resource) {
+  std::pmr::vector<char> buffer(resource);
+  if (!detail::read_whole_file(filename, buffer))
+    return std::nullopt;
   return buffer;
 }
 
@@ -33,64 +131,1207 @@ inline std::optional<std::vector<char>> readFile(const std::string &filename) {
 // failure.
 inline std::optional<std::string>
 readFileToString(const std::string &filename) {
-  std::ifstream file(filename, std::ios::ate);
-  if (!file.is_open()) {
+  std::string buffer;
+  if (!detail::read_whole_file(filename, buffer))
+    return std::nullopt;
+  return buffer;
+}
+
+namespace detail {
+#ifndef _WIN32
+// Reads all of `fd` through pread(), sized by fstat() but read until EOF,
+// so files that report no size (procfs, sysfs) work too.
+inline bool pread_fd(int fd, const std::string &filename,
+                     std::vector<char> &out) {
+  struct stat st;
+  out.resize(fstat(fd, &st) == 0 && st.st_size > 0
+                 ? static_cast<size_t>(st.st_size)
+                 : 4096);
+  size_t done = 0;
+  for (;;) {
+    if (done == out.size())
+      // room to see EOF, or more than fstat() claimed
+      out.resize(out.size() + out.size() / 2);
+    ssize_t n = ::pread(fd, out.data() + done, out.size() - done,
+                        static_cast<off_t>(done));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      LOG_ERR("Failed to read file: {} - {}", filename,
+              std::system_category().message(errno));
+      return false;
+    }
+    if (n == 0)
+      break;
+    done += static_cast<size_t>(n);
+  }
+  out.resize(done);
+  return true;
+}
+
+inline bool pread_file(const std::string &filename, std::vector<char> &out) {
+  int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
     LOG_ERR("Failed to open file: {} - {}", filename,
             std::system_category().message(errno));
-    return std::nullopt;
+    return false;
   }
-  std::string buffer(static_cast<size_t>(file.tellg()), '\0');
-  file.seekg(0);
-  file.read(buffer.data(), buffer.size());
-  return buffer;
+  bool ok = pread_fd(fd, filename, out);
+  ::close(fd);
+  return ok;
+}
+#endif
+
+// Reads every file on its own from the shared thread pool, handing results
+// to fn one at a time.
+template <typename Fn>
+void read_files_pooled(std::span<const std::filesystem::path> paths, Fn &fn) {
+  std::mutex fn_mtx;
+  ThreadPool::global().parallel_for(
+      0, paths.size(),
+      [&](size_t i) {
+        std::optional<std::vector<char>> data(std::in_place);
+#ifdef _WIN32
+        if (!read_whole_file(paths[i].string(), *data))
+#else
+        if (!pread_file(paths[i].string(), *data))
+#endif
+          data.reset();
+        std::lock_guard lock(fn_mtx);
+        fn(i, std::move(data));
+      },
+      1);
 }
 
-// A simple range class to iterate over lines in a string without copying
-class LineRange {
+#if MUTILS_IO_URING
+#ifdef MUTILS_TESTING
+// The number of IoUring::submit() calls that go through before the rest
+// fail with EIO; negative, none fail. Set only while no other thread reads
+// files.
+inline int io_uring_fail_submit_after = -1;
+#endif
+
+// Just enough of an io_uring to batch opens, statx calls, reads and closes,
+// without depending on liburing. Single-threaded.
+class IoUring {
 public:
-  explicit LineRange(const std::string &str) : str_(str) {}
+  explicit IoUring(unsigned entries) {
+    io_uring_params params{};
+    fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    if (fd_ < 0)
+      return;
+    sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size_ =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single)
+      sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+    sq_ring_ = map(sq_size_, IORING_OFF_SQ_RING);
+    cq_ring_ = single ? sq_ring_ : map(cq_size_, IORING_OFF_CQ_RING);
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe *>(map(sqes_size_, IORING_OFF_SQES));
+    if (!sq_ring_ || !cq_ring_ || !sqes_) {
+      unmap();
+      return;
+    }
+    auto *sq = static_cast<char *>(sq_ring_);
+    auto *cq = static_cast<char *>(cq_ring_);
+    sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+    cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    // slot i of the submission array always names sqe i
+    auto *array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    for (unsigned i = 0; i < sq_entries_; ++i)
+      array[i] = i;
+  }
+
+  IoUring(const IoUring &) = delete;
+  IoUring &operator=(const IoUring &) = delete;
+  ~IoUring() { unmap(); }
 
-  struct Iterator {
-    const std::string &str;
-    size_t pos;
-    std::string current;
+  bool valid() const { return fd_ >= 0; }
 
-    Iterator(const std::string &str, size_t pos) : str(str), pos(pos) {
-      advance();
+  // Makes room for n more entries, submitting queued ones if needed. False
+  // if the kernel would not take enough of them.
+  bool reserve(unsigned n) {
+    if (free_entries() >= n)
+      return true;
+    if (!submit(0))
+      return false;
+    if (free_entries() >= n)
+      return true;
+    errno = EAGAIN;
+    return false;
+  }
+
+  // A zeroed entry to fill in, or null if the ring is full and submitting
+  // did not free any.
+  io_uring_sqe *next_sqe() {
+    if (!reserve(1))
+      return nullptr;
+    io_uring_sqe &sqe = sqes_[local_tail_++ & sq_mask_];
+    sqe = io_uring_sqe{};
+    return &sqe;
+  }
+
+  // Submits queued entries and waits for at least `wait` completions.
+  bool submit(unsigned wait) {
+#ifdef MUTILS_TESTING
+    if (io_uring_fail_submit_after == 0) {
+      errno = EIO;
+      return false;
     }
+    if (io_uring_fail_submit_after > 0)
+      --io_uring_fail_submit_after;
+#endif
+    std::atomic_ref(*sq_tail_).store(local_tail_, std::memory_order_release);
+    unsigned pending = local_tail_ - submitted_;
+    for (;;) {
+      long n = ::syscall(__NR_io_uring_enter, fd_, pending, wait,
+                         wait ? IORING_ENTER_GETEVENTS : 0u, nullptr, 0);
+      if (n >= 0) {
+        submitted_ += static_cast<unsigned>(n);
+        return true;
+      }
+      if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        return false;
+    }
+  }
 
-    void advance() {
-      if (pos >= str.size()) {
-        pos = std::string::npos;
+  // Calls fn(user_data, res) for every completion that has arrived.
+  template <typename Fn> void drain(Fn &&fn) {
+    unsigned head = *cq_head_;
+    unsigned tail = std::atomic_ref(*cq_tail_).load(std::memory_order_acquire);
+    for (; head != tail; ++head) {
+      const io_uring_cqe &cqe = cqes_[head & cq_mask_];
+      ++completed_;
+      fn(cqe.user_data, cqe.res);
+    }
+    std::atomic_ref(*cq_head_).store(head, std::memory_order_release);
+  }
+
+  // Withdraws the entries the kernel has not taken and drains until every
+  // one it has is complete. Closing the ring does not cancel or wait for
+  // those, so this must run before the memory they point at goes away.
+  // Withdrawn closes are done here instead: their callers have moved on.
+  template <typename Fn> void quiesce(Fn &&fn) {
+    for (unsigned i = submitted_; i != local_tail_; ++i)
+      if (const io_uring_sqe &sqe = sqes_[i & sq_mask_];
+          sqe.opcode == IORING_OP_CLOSE)
+        ::close(sqe.fd);
+    local_tail_ = submitted_;
+    std::atomic_ref(*sq_tail_).store(local_tail_, std::memory_order_release);
+    for (;;) {
+      drain(fn);
+      if (completed_ == submitted_)
         return;
+      long n = ::syscall(__NR_io_uring_enter, fd_, 0u, 1u,
+                         IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (n < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        // cannot block on the ring; completions still land in it
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+private:
+  unsigned free_entries() const {
+    unsigned head = std::atomic_ref(*sq_head_).load(std::memory_order_acquire);
+    return sq_entries_ - (local_tail_ - head);
+  }
+
+  void *map(size_t size, off_t offset) {
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd_, offset);
+    return p == MAP_FAILED ? nullptr : p;
+  }
+
+  void unmap() {
+    if (sqes_)
+      munmap(sqes_, sqes_size_);
+    if (cq_ring_ && cq_ring_ != sq_ring_)
+      munmap(cq_ring_, cq_size_);
+    if (sq_ring_)
+      munmap(sq_ring_, sq_size_);
+    sqes_ = nullptr;
+    sq_ring_ = cq_ring_ = nullptr;
+    if (fd_ >= 0)
+      ::close(fd_);
+    fd_ = -1;
+  }
+
+  int fd_ = -1;
+  void *sq_ring_ = nullptr;
+  void *cq_ring_ = nullptr;
+  size_t sq_size_ = 0;
+  size_t cq_size_ = 0;
+  size_t sqes_size_ = 0;
+  io_uring_sqe *sqes_ = nullptr;
+  unsigned *sq_head_ = nullptr;
+  unsigned *sq_tail_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned sq_entries_ = 0;
+  unsigned local_tail_ = 0; // entries queued so far
+  unsigned submitted_ = 0;  // of those, entries the kernel has taken
+  unsigned completed_ = 0;  // completions drained
+  unsigned *cq_head_ = nullptr;
+  unsigned *cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  io_uring_cqe *cqes_ = nullptr;
+};
+
+// Keeps up to `window` files going through the ring: openat and statx are
+// submitted together, the read once both are back, then the close. Returns
+// false, having delivered nothing, if the ring cannot be set up.
+template <typename Fn>
+bool read_files_uring(std::span<const std::filesystem::path> paths, Fn &fn) {
+  constexpr size_t window = 64;
+  enum Op : uint64_t { OPEN, STAT, READ, CLOSE };
+  struct File {
+    size_t index; // into paths
+    std::string name;
+    int fd = -1;
+    int open_error = 0;
+    int stat_error = 0;
+    int pending = 0; // of open and statx
+    struct statx stx;
+    std::optional<std::vector<char>> data;
+    size_t done = 0;
+  };
+  std::vector<File> files(std::min(paths.size(), window));
+  std::vector<size_t> free_slots;
+  for (size_t i = files.size(); i-- > 0;)
+    free_slots.push_back(i);
+  // open + statx, or read + close, per file in flight. Requests point into
+  // `files`; once the last read is back only closes can be left, and the
+  // failure path below quiesces the ring before returning.
+  IoUring ring(window * 2);
+  if (!ring.valid())
+    return false;
+  auto tag = [](size_t slot, Op op) { return uint64_t{slot} << 2 | op; };
+  // set when an entry cannot be queued; the failure path picks up the file
+  bool ring_full = false;
+
+  auto queue_read = [&](size_t slot) {
+    File &f = files[slot];
+    io_uring_sqe *sqe = ring.next_sqe();
+    if (!sqe) {
+      ring_full = true;
+      return;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = f.fd;
+    sqe->addr = reinterpret_cast<uint64_t>(f.data->data() + f.done);
+    sqe->len = static_cast<uint32_t>(
+        std::min<size_t>(f.data->size() - f.done, 1u << 30));
+    sqe->off = f.done;
+    sqe->user_data = tag(slot, READ);
+  };
+  auto finish = [&](size_t slot) {
+    File &f = files[slot];
+    if (io_uring_sqe *sqe = f.fd >= 0 ? ring.next_sqe() : nullptr) {
+      sqe->opcode = IORING_OP_CLOSE;
+      sqe->fd = f.fd;
+      sqe->user_data = tag(slot, CLOSE);
+    } else if (f.fd >= 0) {
+      ::close(f.fd);
+    }
+    fn(f.index, std::move(f.data));
+    f.data.reset();
+    free_slots.push_back(slot);
+  };
+  // Both open and statx are back: start reading, or deal with what the
+  // ring cannot do.
+  auto opened = [&](size_t slot) {
+    File &f = files[slot];
+    f.data.emplace();
+    if (f.open_error == EINVAL || f.stat_error == EINVAL) {
+      // a kernel without these opcodes
+      if (f.fd >= 0)
+        ::close(f.fd);
+      f.fd = -1;
+      if (!pread_file(f.name, *f.data))
+        f.data.reset();
+    } else if (f.open_error) {
+      LOG_ERR("Failed to open file: {} - {}", f.name,
+              std::system_category().message(f.open_error));
+      f.data.reset();
+    } else if (f.stat_error || f.stx.stx_size == 0) {
+      // size unknown (procfs and the like) or empty
+      if (!pread_fd(f.fd, f.name, *f.data))
+        f.data.reset();
+    } else {
+      f.data->resize(static_cast<size_t>(f.stx.stx_size));
+      queue_read(slot);
+      return false;
+    }
+    finish(slot);
+    return true;
+  };
+
+  size_t next = 0, completed = 0;
+  while (completed < paths.size()) {
+    while (next < paths.size() && !free_slots.empty()) {
+      if (!ring.reserve(2)) {
+        ring_full = true;
+        break;
       }
-      size_t end = str.find('\n', pos);
-      if (end == std::string::npos) {
-        current = str.substr(pos);
-        pos = std::string::npos;
-      } else {
-        current = str.substr(pos, end - pos);
-        pos = end + 1;
+      size_t slot = free_slots.back();
+      free_slots.pop_back();
+      File &f = files[slot];
+      f.index = next;
+      f.name = paths[next++].string();
+      f.fd = -1;
+      f.open_error = f.stat_error = 0;
+      f.pending = 2;
+      f.done = 0;
+
+      io_uring_sqe *open = ring.next_sqe();
+      open->opcode = IORING_OP_OPENAT;
+      open->fd = AT_FDCWD;
+      open->addr = reinterpret_cast<uint64_t>(f.name.c_str());
+      open->open_flags = O_RDONLY | O_CLOEXEC;
+      open->user_data = tag(slot, OPEN);
+      io_uring_sqe *stat = ring.next_sqe();
+      stat->opcode = IORING_OP_STATX;
+      stat->fd = AT_FDCWD;
+      stat->addr = reinterpret_cast<uint64_t>(f.name.c_str());
+      stat->len = STATX_SIZE;
+      stat->off = reinterpret_cast<uint64_t>(&f.stx);
+      stat->user_data = tag(slot, STAT);
+    }
+    if (ring_full || !ring.submit(1)) {
+      // not expected once the ring is up; read the rest the plain way
+      LOG_ERR("io_uring_enter failed - {}",
+              std::system_category().message(errno));
+      ring.quiesce([&](uint64_t user_data, int res) {
+        if (static_cast<Op>(user_data & 3) == OPEN && res >= 0)
+          files[user_data >> 2].fd = res;
+      });
+      for (size_t slot = 0; slot < files.size(); ++slot) {
+        if (std::ranges::find(free_slots, slot) != free_slots.end())
+          continue;
+        if (files[slot].fd >= 0)
+          ::close(files[slot].fd);
+        std::optional<std::vector<char>> data(std::in_place);
+        if (!pread_file(files[slot].name, *data))
+          data.reset();
+        fn(files[slot].index, std::move(data));
+      }
+      for (; next < paths.size(); ++next) {
+        std::optional<std::vector<char>> data(std::in_place);
+        if (!pread_file(paths[next].string(), *data))
+          data.reset();
+        fn(next, std::move(data));
       }
+      return true;
+    }
+    ring.drain([&](uint64_t user_data, int res) {
+      size_t slot = user_data >> 2;
+      File &f = files[slot];
+      switch (static_cast<Op>(user_data & 3)) {
+      case OPEN:
+        if (res >= 0)
+          f.fd = res;
+        else
+          f.open_error = -res;
+        break;
+      case STAT:
+        if (res < 0)
+          f.stat_error = -res;
+        break;
+      case READ:
+        if (res < 0) {
+          LOG_ERR("Failed to read file: {} - {}", f.name,
+                  std::system_category().message(-res));
+          f.data.reset();
+        } else if (f.done += static_cast<size_t>(res);
+                   res > 0 && f.done < f.data->size()) {
+          queue_read(slot);
+          return;
+        } else {
+          // short only if the file shrank since statx
+          f.data->resize(f.done);
+        }
+        finish(slot);
+        ++completed;
+        return;
+      case CLOSE:
+        return;
+      }
+      if (--f.pending == 0 && opened(slot))
+        ++completed;
+    });
+  }
+  // hand over the last closes, or do them here if that fails
+  if (!ring.submit(0))
+    ring.quiesce([](uint64_t, int) {});
+  return true;
+}
+#endif
+} // namespace detail
+
+struct ReadFilesOptions {
+  // Linux only; off, the files are read from the thread pool as elsewhere.
+  bool io_uring = true;
+};
+
+// Reads many whole files at once, for loads of small files where opening
+// and reading them one by one costs more than the data. On Linux the opens,
+// size lookups, reads and closes go through io_uring in batches, a few
+// system calls for dozens of files; elsewhere, or when io_uring is not
+// available, the files are read from the shared thread pool.
+//
+// fn(size_t index, std::optional<std::vector<char>> data) is called once per
+// path, as files finish and so in no particular order, never concurrently.
+// Files that cannot be read get std::nullopt (and are logged).
+template <typename Fn>
+void readFiles(std::span<const std::filesystem::path> paths, Fn &&fn,
+               const ReadFilesOptions &opts = {}) {
+  if (paths.empty())
+    return;
+#if MUTILS_IO_URING
+  if (opts.io_uring && detail::read_files_uring(paths, fn))
+    return;
+#else
+  (void)opts;
+#endif
+  detail::read_files_pooled(paths, fn);
+}
+
+// Same, collecting the contents in path order.
+inline std::vector<std::optional<std::vector<char>>>
+readFiles(std::span<const std::filesystem::path> paths,
+          const ReadFilesOptions &opts = {}) {
+  std::vector<std::optional<std::vector<char>>> out(paths.size());
+  readFiles(
+      paths,
+      [&](size_t i, std::optional<std::vector<char>> data) {
+        out[i] = std::move(data);
+      },
+      opts);
+  return out;
+}
+
+// Access pattern hints for MappedFile, passed to madvise on POSIX.
+enum class MapAdvice {
+  NORMAL,
+  SEQUENTIAL, // aggressive read-ahead, pages can be dropped once read
+  RANDOM,     // no read-ahead
+  WILLNEED,   // start reading the whole file in now
+  HUGEPAGES,  // back the mapping with transparent huge pages if possible
+};
+
+// Read-only memory mapping of a whole file. Move-only; unmaps on
+// destruction. Views handed out by bytes()/view() point straight into the
+// page cache and stay valid for the lifetime of the MappedFile.
+class MappedFile {
+public:
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  MappedFile(MappedFile &&other) noexcept
+      : data_(std::exchange(other.data_, nullptr)),
+        size_(std::exchange(other.size_, 0)) {}
+
+  MappedFile &operator=(MappedFile &&other) noexcept {
+    if (this != &other) {
+      unmap();
+      data_ = std::exchange(other.data_, nullptr);
+      size_ = std::exchange(other.size_, 0);
+    }
+    return *this;
+  }
+
+  ~MappedFile() { unmap(); }
+
+  // Maps `filename` read-only. Returns std::nullopt on failure. Empty files
+  // map to an empty MappedFile.
+  static std::optional<MappedFile> open(const std::string &filename,
+                                        MapAdvice advice = MapAdvice::NORMAL) {
+    MappedFile mapped;
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              nullptr, OPEN_EXISTING,
+                              advice == MapAdvice::SEQUENTIAL
+                                  ? FILE_FLAG_SEQUENTIAL_SCAN
+                                  : FILE_ATTRIBUTE_NORMAL,
+                              nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+      LOG_ERR("Failed to open file: {} - {}", filename,
+              std::system_category().message(GetLastError()));
+      return std::nullopt;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+      LOG_ERR("Failed to stat file: {} - {}", filename,
+              std::system_category().message(GetLastError()));
+      CloseHandle(file);
+      return std::nullopt;
+    }
+    mapped.size_ = static_cast<size_t>(size.QuadPart);
+    if (mapped.size_ > 0) {
+      HANDLE mapping =
+          CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      if (mapping)
+        mapped.data_ = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      auto error = GetLastError();
+      // the view keeps the mapping and the file alive
+      if (mapping)
+        CloseHandle(mapping);
+      if (!mapped.data_) {
+        LOG_ERR("Failed to map file: {} - {}", filename,
+                std::system_category().message(error));
+        CloseHandle(file);
+        return std::nullopt;
+      }
+    }
+    CloseHandle(file);
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      LOG_ERR("Failed to open file: {} - {}", filename,
+              std::system_category().message(errno));
+      return std::nullopt;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      LOG_ERR("Failed to stat file: {} - {}", filename,
+              std::system_category().message(errno));
+      ::close(fd);
+      return std::nullopt;
+    }
+    mapped.size_ = static_cast<size_t>(st.st_size);
+    if (mapped.size_ > 0) {
+      void *addr = mmap(nullptr, mapped.size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr == MAP_FAILED) {
+        LOG_ERR("Failed to map file: {} - {}", filename,
+                std::system_category().message(errno));
+        ::close(fd);
+        return std::nullopt;
+      }
+      mapped.data_ = addr;
+    }
+    // the mapping keeps the file alive
+    ::close(fd);
+#endif
+    mapped.advise(advice);
+    return mapped;
+  }
+
+  // Applies an access pattern hint to the whole mapping. Best effort: hints
+  // the platform does not support are ignored.
+  void advise(MapAdvice advice) const {
+    if (!data_)
+      return;
+#ifdef _WIN32
+    if (advice == MapAdvice::WILLNEED) {
+      WIN32_MEMORY_RANGE_ENTRY range{data_, size_};
+      PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+    }
+#else
+    int flag = MADV_NORMAL;
+    switch (advice) {
+    case MapAdvice::NORMAL:
+      break;
+    case MapAdvice::SEQUENTIAL:
+      flag = MADV_SEQUENTIAL;
+      break;
+    case MapAdvice::RANDOM:
+      flag = MADV_RANDOM;
+      break;
+    case MapAdvice::WILLNEED:
+      flag = MADV_WILLNEED;
+      break;
+    case MapAdvice::HUGEPAGES:
+#ifdef MADV_HUGEPAGE
+      flag = MADV_HUGEPAGE;
+      break;
+#else
+      return;
+#endif
+    }
+    madvise(data_, size_, flag);
+#endif
+  }
+
+  const std::byte *data() const { return static_cast<std::byte *>(data_); }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  std::span<const std::byte> bytes() const { return {data(), size_}; }
+
+  std::string_view view() const {
+    return {static_cast<const char *>(data_), size_};
+  }
+
+private:
+  void unmap() {
+    if (!data_)
+      return;
+#ifdef _WIN32
+    UnmapViewOfFile(data_);
+#else
+    munmap(data_, size_);
+#endif
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  void *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Maps the entire file into memory without reading or copying it. Returns
+// std::nullopt on failure.
+inline std::optional<MappedFile>
+mapFile(const std::string &filename, MapAdvice advice = MapAdvice::NORMAL) {
+  return MappedFile::open(filename, advice);
+}
+
+// Forward range over the lines of a buffer. Yields std::string_view into
+// the buffer without copying, so the buffer must outlive the iteration.
+// Accepts both "\n" and "\r\n" line endings; a trailing newline does not
+// produce an extra empty line.
+class LineRange : public std::ranges::view_interface<LineRange> {
+public:
+  LineRange() = default;
+  explicit LineRange(std::string_view str) : str_(str) {}
+
+  class Iterator {
+  public:
+    using value_type = std::string_view;
+    using difference_type = std::ptrdiff_t;
+    using iterator_concept = std::forward_iterator_tag;
+    // operator* returns by value, which only qualifies as a legacy input
+    // iterator
+    using iterator_category = std::input_iterator_tag;
+
+    Iterator() = default;
+    Iterator(const char *first, const char *last) : last_(last) {
+      if (first != last)
+        advance(first);
     }
 
-    const std::string &operator*() const { return current; }
+    std::string_view operator*() const { return line_; }
+
     Iterator &operator++() {
-      advance();
+      if (next_ == last_)
+        line_ = {};
+      else
+        advance(next_);
       return *this;
     }
-    bool operator!=(const Iterator &other) const { return pos != other.pos; }
+
+    Iterator operator++(int) {
+      auto tmp = *this;
+      ++*this;
+      return tmp;
+    }
+
+    // the end iterator is the only one with a null line
+    bool operator==(const Iterator &other) const {
+      return line_.data() == other.line_.data();
+    }
+
+  private:
+    void advance(const char *first) {
+      const char *nl = simd::find_byte(first, last_, '\n');
+      const char *stop = nl;
+      if (nl != last_ && nl != first && nl[-1] == '\r')
+        --stop;
+      line_ = {first, static_cast<size_t>(stop - first)};
+      next_ = nl == last_ ? last_ : nl + 1;
+    }
+
+    std::string_view line_;
+    const char *next_ = nullptr;
+    const char *last_ = nullptr;
   };
 
-  Iterator begin() const { return Iterator(str_, 0); }
-  Iterator end() const { return Iterator(str_, std::string::npos); }
+  Iterator begin() const {
+    return Iterator(str_.data(), str_.data() + str_.size());
+  }
+  Iterator end() const { return Iterator(); }
 
 private:
-  const std::string &str_;
+  std::string_view str_;
 };
 
 // Returns a LineRange that can be used to iterate over lines in the input
 // string
-inline LineRange lines(const std::string &str) { return LineRange(str); }
+inline LineRange lines(std::string_view str) { return LineRange(str); }
+
+inline LineRange lines(const MappedFile &file) {
+  return LineRange(file.view());
+}
+
+namespace detail {
+template <typename Chunks>
+void split_line_chunks(std::string_view str, size_t count, Chunks &chunks) {
+  count = std::max<size_t>(count, 1);
+  chunks.reserve(count);
+
+  const char *first = str.data();
+  const char *last = str.data() + str.size();
+  for (size_t i = 1; i < count && first != last; ++i) {
+    const char *target = str.data() + str.size() / count * i;
+    if (target < first)
+      continue;
+    const char *nl = simd::find_byte(target, last, '\n');
+    const char *cut = nl == last ? last : nl + 1;
+    chunks.emplace_back(first, static_cast<size_t>(cut - first));
+    first = cut;
+  }
+  if (first != last)
+    chunks.emplace_back(first, static_cast<size_t>(last - first));
+}
+} // namespace detail
+
+// Splits `str` into at most `count` pieces of roughly equal size, each
+// ending right after a newline (except the last), so no line straddles two
+// pieces.
+inline std::vector<std::string_view> line_chunks(std::string_view str,
+                                                 size_t count) {
+  std::vector<std::string_view> chunks;
+  detail::split_line_chunks(str, count, chunks);
+  return chunks;
+}
+
+// Same, with the vector allocated from `resource`.
+inline std::pmr::vector<std::string_view>
+line_chunks(std::string_view str, size_t count,
+            std::pmr::memory_resource *resource) {
+  std::pmr::vector<std::string_view> chunks(resource);
+  detail::split_line_chunks(str, count, chunks);
+  return chunks;
+}
+
+// Collects the lines of `str` (see LineRange) into a vector allocated from
+// `resource`.
+inline std::pmr::vector<std::string_view>
+lines(std::string_view str, std::pmr::memory_resource *resource) {
+  std::pmr::vector<std::string_view> out(resource);
+  for (auto line : LineRange(str))
+    out.push_back(line);
+  return out;
+}
+
+// Reads a file, pipe or socket front to back in blocks of `block_size`
+// bytes, for inputs too large to load or map, or whose size is unknown.
+// Two block buffers are reused throughout: with read-ahead on, a thread of
+// the reader's own fills one while the caller works on the other. Records
+// that straddle two blocks are joined in a side buffer, so memory stays at
+// two blocks plus the longest record. Move-only.
+class ChunkedReader {
+public:
+  static constexpr size_t default_block_size = 1 << 20;
+
+  ChunkedReader(ChunkedReader &&) noexcept = default;
+  ChunkedReader &operator=(ChunkedReader &&) noexcept = default;
+  ~ChunkedReader() = default;
+
+  // Returns std::nullopt (and logs why) if the file cannot be opened.
+  static std::optional<ChunkedReader>
+  open(const std::string &filename, size_t block_size = default_block_size,
+       bool read_ahead = true) {
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(filename.c_str(), GENERIC_READ,
+                                FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+      LOG_ERR("Failed to open file: {} - {}", filename,
+              std::system_category().message(GetLastError()));
+      return std::nullopt;
+    }
+    return ChunkedReader(std::make_unique<Source>(filename, handle, true),
+                         block_size, read_ahead);
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      LOG_ERR("Failed to open file: {} - {}", filename,
+              std::system_category().message(errno));
+      return std::nullopt;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    return ChunkedReader(std::make_unique<Source>(filename, fd, true),
+                         block_size, read_ahead);
+#endif
+  }
+
+#ifdef _WIN32
+  // Reads from an open handle, e.g. a pipe or GetStdHandle(STD_INPUT_HANDLE).
+  // The handle is closed at the end only if `owned`.
+  static ChunkedReader from_handle(HANDLE handle, bool owned = false,
+                                   size_t block_size = default_block_size,
+                                   bool read_ahead = true) {
+    return ChunkedReader(std::make_unique<Source>("<handle>", handle, owned),
+                         block_size, read_ahead);
+  }
+#else
+  // Reads from an open descriptor, e.g. a pipe, a socket or STDIN_FILENO.
+  // The descriptor is closed at the end only if `owned`.
+  static ChunkedReader from_fd(int fd, bool owned = false,
+                               size_t block_size = default_block_size,
+                               bool read_ahead = true) {
+    return ChunkedReader(std::make_unique<Source>("<fd>", fd, owned),
+                         block_size, read_ahead);
+  }
+#endif
+
+  // The next block exactly as read, which may be shorter than block_size
+  // (pipes hand out what they have). Valid until the next call; empty at
+  // the end of the input. Do not mix with next_record()/next_line().
+  std::string_view next_block() {
+    if (!source_)
+      return {};
+    if (current_ >= 0)
+      source_->release(current_);
+    current_ = (current_ + 1) % 2;
+    return source_->acquire(current_);
+  }
+
+  // The next record terminated by `delimiter`, without it. The view points
+  // into a block or into the side buffer and is valid until the next call.
+  // Unterminated data at the end of the input makes a last record, so a
+  // trailing delimiter does not produce an empty one.
+  std::optional<std::string_view> next_record(char delimiter) {
+    if (joined_) {
+      carry_.clear();
+      joined_ = false;
+    }
+    for (;;) {
+      if (pos_ < block_.size()) {
+        const char *first = block_.data() + pos_;
+        const char *last = block_.data() + block_.size();
+        const char *hit = simd::find_byte(first, last, delimiter);
+        if (hit != last) {
+          pos_ = static_cast<size_t>(hit - block_.data()) + 1;
+          std::string_view record(first, static_cast<size_t>(hit - first));
+          if (carry_.empty())
+            return record;
+          carry_ += record;
+          joined_ = true;
+          return carry_;
+        }
+        // the record goes on in the next block
+        carry_.append(first, last);
+      }
+      block_ = next_block();
+      pos_ = 0;
+      if (block_.empty()) {
+        if (carry_.empty())
+          return std::nullopt;
+        joined_ = true;
+        return carry_;
+      }
+    }
+  }
+
+  // The next line, accepting "\n" and "\r\n" endings like LineRange.
+  std::optional<std::string_view> next_line() {
+    auto line = next_record('\n');
+    if (line && line->ends_with('\r'))
+      line->remove_suffix(1);
+    return line;
+  }
+
+  // True once a read has failed; the input then ends early.
+  bool failed() const { return source_ && source_->failed(); }
+
+  // Single-pass range over the remaining lines, see next_line().
+  class LineIterator {
+  public:
+    using value_type = std::string_view;
+    using difference_type = std::ptrdiff_t;
+    using iterator_concept = std::input_iterator_tag;
+
+    LineIterator() = default;
+    explicit LineIterator(ChunkedReader &reader)
+        : reader_(&reader), line_(reader.next_line()) {}
+
+    std::string_view operator*() const { return *line_; }
+    LineIterator &operator++() {
+      line_ = reader_->next_line();
+      return *this;
+    }
+    void operator++(int) { ++*this; }
+
+    friend bool operator==(const LineIterator &it, std::default_sentinel_t) {
+      return !it.line_;
+    }
+
+  private:
+    ChunkedReader *reader_ = nullptr;
+    std::optional<std::string_view> line_;
+  };
+
+  LineIterator begin() { return LineIterator(*this); }
+  std::default_sentinel_t end() const { return {}; }
+
+private:
+  // Owns the descriptor, both blocks and the read-ahead thread. Kept behind
+  // a pointer so the reader can move while the thread is running. The
+  // destructor waits for a read in progress, which on a pipe lasts until
+  // data or EOF arrives.
+  class Source {
+  public:
+#ifdef _WIN32
+    using Native = HANDLE;
+#else
+    using Native = int;
+#endif
+
+    Source(std::string name, Native native, bool owned)
+        : name_(std::move(name)), native_(native), owned_(owned) {}
+
+    ~Source() {
+      {
+        std::lock_guard lock(mtx_);
+        stop_ = true;
+      }
+      changed_.notify_all();
+      if (thread_.joinable())
+        thread_.join();
+      if (owned_) {
+#ifdef _WIN32
+        CloseHandle(native_);
+#else
+        ::close(native_);
+#endif
+      }
+    }
+
+    void start(size_t block_size, bool read_ahead) {
+      block_size_ = std::max<size_t>(block_size, 1);
+      for (auto &block : blocks_)
+        block.data = std::make_unique_for_overwrite<char[]>(block_size_);
+      if (read_ahead)
+        thread_ = std::thread([this] { run(); });
+    }
+
+    // Waits for block `i` to be filled and returns its contents.
+    std::string_view acquire(int i) {
+      Block &block = blocks_[i];
+      if (!thread_.joinable()) {
+        if (!done_)
+          fill(block);
+      } else {
+        std::unique_lock lock(mtx_);
+        changed_.wait(lock, [&] { return block.full || done_; });
+      }
+      return {block.data.get(), block.full ? block.size : 0};
+    }
+
+    // Hands block `i` back to be refilled.
+    void release(int i) {
+      if (!thread_.joinable()) {
+        blocks_[i].full = false;
+        return;
+      }
+      {
+        std::lock_guard lock(mtx_);
+        blocks_[i].full = false;
+      }
+      changed_.notify_all();
+    }
+
+    bool failed() const { return failed_.load(std::memory_order_relaxed); }
+
+  private:
+    struct Block {
+      std::unique_ptr<char[]> data;
+      size_t size = 0;
+      bool full = false;
+    };
+
+    // Fills the blocks alternately, each once the reader has handed it back.
+    void run() {
+      for (int i = 0; !done_; i ^= 1) {
+        Block &block = blocks_[i];
+        {
+          std::unique_lock lock(mtx_);
+          changed_.wait(lock, [&] { return !block.full || stop_; });
+          if (stop_)
+            return;
+        }
+        // the reader leaves the data of a block alone until it is full
+        size_t n = read_some(block.data.get());
+        {
+          std::lock_guard lock(mtx_);
+          block.size = n;
+          block.full = n > 0;
+          done_ = n == 0;
+        }
+        changed_.notify_all();
+      }
+    }
+
+    void fill(Block &block) {
+      block.size = read_some(block.data.get());
+      block.full = block.size > 0;
+      done_ = block.size == 0;
+    }
+
+    // One read of up to a block; 0 at the end of the input or on failure.
+    size_t read_some(char *out) {
+#ifdef _WIN32
+      DWORD n = 0;
+      auto size = static_cast<DWORD>(std::min<size_t>(block_size_, 1u << 30));
+      if (!ReadFile(native_, out, size, &n, nullptr)) {
+        auto error = GetLastError();
+        // a pipe whose writer is gone reports its end this way
+        if (error != ERROR_BROKEN_PIPE) {
+          LOG_ERR("Failed to read file: {} - {}", name_,
+                  std::system_category().message(error));
+          failed_.store(true, std::memory_order_relaxed);
+        }
+        return 0;
+      }
+      return n;
+#else
+      for (;;) {
+        ssize_t n = ::read(native_, out, block_size_);
+        if (n >= 0)
+          return static_cast<size_t>(n);
+        if (errno != EINTR) {
+          LOG_ERR("Failed to read file: {} - {}", name_,
+                  std::system_category().message(errno));
+          failed_.store(true, std::memory_order_relaxed);
+          return 0;
+        }
+      }
+#endif
+    }
+
+    std::string name_;
+    Native native_;
+    bool owned_;
+    size_t block_size_ = 0;
+    Block blocks_[2];
+    std::mutex mtx_;
+    std::condition_variable changed_;
+    bool done_ = false; // end of input; under mtx_ once the thread runs
+    bool stop_ = false;
+    std::atomic<bool> failed_{false};
+    std::thread thread_; // last, so it starts after the members it uses
+  };
+
+  ChunkedReader(std::unique_ptr<Source> source, size_t block_size,
+                bool read_ahead)
+      : source_(std::move(source)) {
+    source_->start(block_size, read_ahead);
+  }
+
+  std::unique_ptr<Source> source_;
+  int current_ = -1; // block handed out last, if any
+  std::string_view block_;
+  size_t pos_ = 0;
+  std::string carry_; // start of a record that continues in the next block
+  bool joined_ = false;
+};
+
+// The lines of a stream, read in constant memory; see ChunkedReader.
+inline ChunkedReader &lines(ChunkedReader &reader) { return reader; }
+
+namespace detail {
+// Chunks smaller than this are not worth a thread of their own.
+inline constexpr size_t min_parallel_chunk = 64 * 1024;
+
+inline size_t parallel_chunk_count(size_t bytes, unsigned threads) {
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  return std::clamp<size_t>(bytes / min_parallel_chunk, 1, threads);
+}
+
+// Runs body(i) for every i in [0, count), the last one on the calling
+// thread, and rethrows the first exception once every worker has finished.
+template <typename Body> void run_chunks(size_t count, Body &&body) {
+  std::vector<std::exception_ptr> errors(count);
+  {
+    std::vector<std::jthread> workers;
+    workers.reserve(count - 1);
+    for (size_t i = 0; i + 1 < count; ++i) {
+      workers.emplace_back([&, i] {
+        try {
+          body(i);
+        } catch (...) {
+          errors[i] = std::current_exception();
+        }
+      });
+    }
+    try {
+      body(count - 1);
+    } catch (...) {
+      errors[count - 1] = std::current_exception();
+    }
+  }
+  for (auto &e : errors)
+    if (e)
+      std::rethrow_exception(e);
+}
+} // namespace detail
+
+// Calls fn(std::string_view line) for every line of `str` from up to
+// `threads` threads (0 = one per core). Lines within a chunk are visited in
+// order, chunks run concurrently, so fn must be thread-safe.
+template <typename Fn>
+void parallel_lines(std::string_view str, Fn &&fn, unsigned threads = 0) {
+  auto chunks =
+      line_chunks(str, detail::parallel_chunk_count(str.size(), threads));
+  if (chunks.empty())
+    return;
+  detail::run_chunks(chunks.size(), [&](size_t i) {
+    for (auto line : lines(chunks[i]))
+      fn(line);
+  });
+}
+
+// Map/reduce flavour: each chunk starts from a copy of `init` and folds its
+// lines with fn(T &acc, std::string_view line); the per-chunk results are
+// then merged in file order with reduce(T, T) -> T. `init` should be the
+// identity of `reduce` since it is used once per chunk.
+template <typename T, typename Fn, typename Reduce>
+T parallel_lines(std::string_view str, T init, Fn &&fn, Reduce &&reduce,
+                 unsigned threads = 0) {
+  auto chunks =
+      line_chunks(str, detail::parallel_chunk_count(str.size(), threads));
+  if (chunks.empty())
+    return init;
+
+  std::vector<T> partial(chunks.size(), init);
+  detail::run_chunks(chunks.size(), [&](size_t i) {
+    for (auto line : lines(chunks[i]))
+      fn(partial[i], line);
+  });
+
+  T result = std::move(partial[0]);
+  for (size_t i = 1; i < partial.size(); ++i)
+    result = reduce(std::move(result), std::move(partial[i]));
+  return result;
+}
+
+template <typename Fn>
+void parallel_lines(const MappedFile &file, Fn &&fn, unsigned threads = 0) {
+  parallel_lines(file.view(), std::forward<Fn>(fn), threads);
+}
+
+template <typename T, typename Fn, typename Reduce>
+T parallel_lines(const MappedFile &file, T init, Fn &&fn, Reduce &&reduce,
+                 unsigned threads = 0) {
+  return parallel_lines(file.view(), std::move(init), std::forward<Fn>(fn),
+                        std::forward<Reduce>(reduce), threads);
+}
 
 } // namespace mutils
+
+template <>
+inline constexpr bool std::ranges::enable_borrowed_range<mutils::LineRange> =
+    true;
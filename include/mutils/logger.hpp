@@ -1,60 +1,272 @@
 #pragma once
 
+#include "binlog.hpp"
+#include "ring.hpp"
+#include "strings.hpp"
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
 #include <cstring>
 #include <filesystem>
 #include <format>
-#include <fstream>
 #include <functional>
-#include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
 #include <mutex>
+#include <new>
+#include <shared_mutex>
 #include <source_location>
-#include <sstream>
+#include <string>
 #include <string_view>
 #include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
 
 #ifdef _WIN32
 #include <io.h>
+#include <iostream>
+#include <sys/stat.h>
 #define ISATTY _isatty
 #define FILENO _fileno
 #else
+#include <pthread.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #define ISATTY isatty
 #define FILENO fileno
 #endif
 
-inline bool tty = ISATTY(FILENO(stdout)) || ISATTY(FILENO(stderr));
+#if !defined(__cpp_lib_formatters) && !defined(__GLIBC__)
+#include <sstream>
+#endif
+
+#define MUTILS_LOG_LEVEL_DEBUG 0
+#define MUTILS_LOG_LEVEL_INFO 1
+#define MUTILS_LOG_LEVEL_WARN 2
+#define MUTILS_LOG_LEVEL_ERR 3
+#define MUTILS_LOG_LEVEL_OFF 4
+
+// Statements below this level are removed by the preprocessor, arguments
+// included. Defaults to everything in debug builds and INFO and up otherwise.
+#ifndef MUTILS_MIN_LOG_LEVEL
+#ifndef NDEBUG
+#define MUTILS_MIN_LOG_LEVEL MUTILS_LOG_LEVEL_DEBUG
+#else
+#define MUTILS_MIN_LOG_LEVEL MUTILS_LOG_LEVEL_INFO
+#endif
+#endif
+
+// How much of the enclosing function LOG_WCTX tags lines with: 4 keeps the
+// whole signature, lower levels only the class or namespace it belongs to.
+#ifndef MUTILS_LOG_CONTEXT_LEVEL
+#define MUTILS_LOG_CONTEXT_LEVEL 4
+#endif
+
+// With MUTILS_COMPILED_LIB defined (the MUTILS_COMPILED CMake option), the
+// parts in *_impl.hpp are built once into the mutils library instead of
+// being inlined into every translation unit.
+#ifdef MUTILS_COMPILED_LIB
+#define MUTILS_INLINE
+#else
+#define MUTILS_INLINE inline
+#endif
+
+// Checks the runtime threshold before the arguments are evaluated.
+#define MUTILS_LOG_IF_(level, call)                                            \
+  (mutils::Logger::enabled(mutils::LogLevel::level) ? call : void())
 
 #ifndef LOG
-#define LOG mutils::Logger::get().log
+#if MUTILS_MIN_LOG_LEVEL <= MUTILS_LOG_LEVEL_INFO
+#define LOG(...) MUTILS_LOG_IF_(INFO, mutils::Logger::get().log(__VA_ARGS__))
+#else
+#define LOG(...) ((void)0)
+#endif
 #endif
 
+// The LOG_WCTX tag of the enclosing function, as a FixedString sized to fit.
+#define MUTILS_CONTEXT_NAME_()                                                 \
+  mutils::detail::context_name<mutils::detail::context_size(                   \
+      std::source_location::current())>(std::source_location::current())
+
 #ifndef LOG_WCTX
+#if MUTILS_MIN_LOG_LEVEL <= MUTILS_LOG_LEVEL_INFO
+// The tag is cut out of the function name at compile time.
 #define LOG_WCTX(...)                                                          \
-  mutils::Logger::get().log_wctx(std::source_location::current(), __VA_ARGS__)
+  MUTILS_LOG_IF_(INFO, mutils::Logger::get()                                   \
+                           .log_wctx<MUTILS_CONTEXT_NAME_()>(                  \
+                               std::source_location::current(), __VA_ARGS__))
+#else
+#define LOG_WCTX(...) ((void)0)
+#endif
 #endif
 
 #ifndef LOG_ERR
-#define LOG_ERR mutils::Logger::get().err
+#if MUTILS_MIN_LOG_LEVEL <= MUTILS_LOG_LEVEL_ERR
+#define LOG_ERR(...) MUTILS_LOG_IF_(ERR, mutils::Logger::get().err(__VA_ARGS__))
+#else
+#define LOG_ERR(...) ((void)0)
+#endif
 #endif
 
 #ifndef LOG_WARN
-#define LOG_WARN mutils::Logger::get().warn
+#if MUTILS_MIN_LOG_LEVEL <= MUTILS_LOG_LEVEL_WARN
+#define LOG_WARN(...)                                                          \
+  MUTILS_LOG_IF_(WARN, mutils::Logger::get().warn(__VA_ARGS__))
+#else
+#define LOG_WARN(...) ((void)0)
+#endif
 #endif
 
 #ifndef LOG_DBG
-#ifndef NDEBUG
-#define LOG_DBG mutils::Logger::get().dbg
+#if MUTILS_MIN_LOG_LEVEL <= MUTILS_LOG_LEVEL_DEBUG
+#define LOG_DBG(...)                                                           \
+  MUTILS_LOG_IF_(DEBUG, mutils::Logger::get().dbg(__VA_ARGS__))
 #else
 #define LOG_DBG(...) ((void)0)
 #endif
 #endif
 
+// Rate-limited variants for hot paths. Each call site keeps its own static
+// state, checked after the level and before any argument is evaluated. The
+// format must be a string literal: when calls were skipped, the next line
+// that gets through says how many.
+//   LOG_EVERY_N(n, ...)    the 1st, (n+1)th, (2n+1)th... call
+//   LOG_FIRST_N(n, ...)    the first n calls
+//   LOG_EVERY_MS(ms, ...)  at most one call per `ms` milliseconds
+// LOG_WARN_* and LOG_ERR_* do the same at their level. Like LOG, they are
+// expressions whichever MUTILS_MIN_LOG_LEVEL is set; the limiter is a static
+// in a lambda of its own, hence one per call site.
+#define MUTILS_LOG_LIMITED_(level, method, limiter, limit, fmt, ...)          \
+  MUTILS_LOG_IF_(level, [&] {                                                  \
+    static limiter mutils_limiter_;                                            \
+    std::uint64_t mutils_skipped_ = 0;                                         \
+    if (!mutils_limiter_.allow(limit, mutils_skipped_))                        \
+      return;                                                                  \
+    if (mutils_skipped_ == 0)                                                  \
+      mutils::Logger::get().method(fmt __VA_OPT__(, ) __VA_ARGS__);            \
+    else                                                                       \
+      mutils::Logger::get().method(fmt " ({} similar messages skipped)"        \
+                                   __VA_OPT__(, ) __VA_ARGS__,                 \
+                                   mutils_skipped_);                           \
+  }())
+
+#if MUTILS_MIN_LOG_LEVEL <= MUTILS_LOG_LEVEL_INFO
+#define MUTILS_LOG_LIMITED_INFO_(...)                                          \
+  MUTILS_LOG_LIMITED_(INFO, log, __VA_ARGS__)
+#else
+#define MUTILS_LOG_LIMITED_INFO_(...) ((void)0)
+#endif
+
+#if MUTILS_MIN_LOG_LEVEL <= MUTILS_LOG_LEVEL_WARN
+#define MUTILS_LOG_LIMITED_WARN_(...)                                          \
+  MUTILS_LOG_LIMITED_(WARN, warn, __VA_ARGS__)
+#else
+#define MUTILS_LOG_LIMITED_WARN_(...) ((void)0)
+#endif
+
+#if MUTILS_MIN_LOG_LEVEL <= MUTILS_LOG_LEVEL_ERR
+#define MUTILS_LOG_LIMITED_ERR_(...) MUTILS_LOG_LIMITED_(ERR, err, __VA_ARGS__)
+#else
+#define MUTILS_LOG_LIMITED_ERR_(...) ((void)0)
+#endif
+
+#ifndef LOG_EVERY_N
+#define LOG_EVERY_N(n, ...)                                                    \
+  MUTILS_LOG_LIMITED_INFO_(mutils::detail::EveryN, n, __VA_ARGS__)
+#endif
+#ifndef LOG_FIRST_N
+#define LOG_FIRST_N(n, ...)                                                    \
+  MUTILS_LOG_LIMITED_INFO_(mutils::detail::FirstN, n, __VA_ARGS__)
+#endif
+#ifndef LOG_EVERY_MS
+#define LOG_EVERY_MS(ms, ...)                                                  \
+  MUTILS_LOG_LIMITED_INFO_(mutils::detail::EveryMs, ms, __VA_ARGS__)
+#endif
+
+#ifndef LOG_WARN_EVERY_N
+#define LOG_WARN_EVERY_N(n, ...)                                               \
+  MUTILS_LOG_LIMITED_WARN_(mutils::detail::EveryN, n, __VA_ARGS__)
+#endif
+#ifndef LOG_WARN_FIRST_N
+#define LOG_WARN_FIRST_N(n, ...)                                               \
+  MUTILS_LOG_LIMITED_WARN_(mutils::detail::FirstN, n, __VA_ARGS__)
+#endif
+#ifndef LOG_WARN_EVERY_MS
+#define LOG_WARN_EVERY_MS(ms, ...)                                             \
+  MUTILS_LOG_LIMITED_WARN_(mutils::detail::EveryMs, ms, __VA_ARGS__)
+#endif
+
+#ifndef LOG_ERR_EVERY_N
+#define LOG_ERR_EVERY_N(n, ...)                                                \
+  MUTILS_LOG_LIMITED_ERR_(mutils::detail::EveryN, n, __VA_ARGS__)
+#endif
+#ifndef LOG_ERR_FIRST_N
+#define LOG_ERR_FIRST_N(n, ...)                                                \
+  MUTILS_LOG_LIMITED_ERR_(mutils::detail::FirstN, n, __VA_ARGS__)
+#endif
+#ifndef LOG_ERR_EVERY_MS
+#define LOG_ERR_EVERY_MS(ms, ...)                                              \
+  MUTILS_LOG_LIMITED_ERR_(mutils::detail::EveryMs, ms, __VA_ARGS__)
+#endif
+
 #define STRINGIFY_(x) #x
 #define STRINGIFY(x) STRINGIFY_(x)
 
 namespace mutils {
+namespace detail {
+// Used when stdout or stderr is a terminal.
+inline constexpr std::string_view ansi_green = "\033[32m";
+inline constexpr std::string_view ansi_yellow = "\033[33m";
+inline constexpr std::string_view ansi_red = "\033[31m";
+inline constexpr std::string_view ansi_reset = "\033[0m";
+
+// Asked on first use rather than during static initialization, so programs
+// that never log don't pay for it. That first use is often a LOG_ERR whose
+// arguments read errno, which isatty() must not clobber.
+inline bool is_tty(std::FILE *stream) {
+  int saved = errno;
+  bool tty = ISATTY(FILENO(stream));
+  errno = saved;
+  return tty;
+}
+
+inline bool stdio_is_tty() {
+  static const bool tty = is_tty(stdout) || is_tty(stderr);
+  return tty;
+}
+
+// The calling thread's id as operator<< would print it, which Tracer relies
+// on too. C++23 std::format prints it the same way. Before that, on glibc,
+// where pthread_t is an integer, libstdc++ and libc++ both print it in
+// decimal; only the rest need <sstream>.
+inline std::string current_thread_id() {
+#if defined(__cpp_lib_formatters)
+  return std::format("{}", std::this_thread::get_id());
+#elif defined(__GLIBC__)
+  static_assert(std::is_integral_v<pthread_t>);
+  std::string id;
+  append_number(id, static_cast<unsigned long>(::pthread_self()));
+  return id;
+#else
+  std::ostringstream oss;
+  oss << std::this_thread::get_id();
+  return oss.str();
+#endif
+}
+} // namespace detail
+
 struct StaticConfig {
   const std::string_view log_color;
   const std::string_view warn_color;
@@ -64,11 +276,12 @@ struct StaticConfig {
 
   static const StaticConfig &get() {
     static StaticConfig cfg = [] {
+      bool tty = detail::stdio_is_tty();
       return StaticConfig{
-          tty ? "\033[32m" : "",
-          tty ? "\033[33m" : "",
-          tty ? "\033[31m" : "",
-          tty ? "\033[0m" : "",
+          tty ? detail::ansi_green : "",
+          tty ? detail::ansi_yellow : "",
+          tty ? detail::ansi_red : "",
+          tty ? detail::ansi_reset : "",
           tty,
       };
     }();
@@ -109,9 +322,331 @@ constexpr std::string_view extract_context(std::string_view fn,
   return fn.substr(0, last_colon);
 }
 
+namespace detail {
+// Direct I/O transfers start and end on multiples of this, in memory and in
+// the file; 4 KiB suits every common filesystem.
+inline constexpr size_t direct_io_block = 4096;
+
+// With `direct`, the file is opened for O_DIRECT and written with pwrite at
+// explicit offsets, so without O_APPEND; returns -1 if that is not allowed.
+inline int open_log_file(const std::filesystem::path &path, bool append,
+                         bool direct = false) {
+#ifdef _WIN32
+  (void)direct;
+  int flags = _O_WRONLY | _O_CREAT | _O_BINARY | _O_NOINHERIT |
+              (append ? _O_APPEND : _O_TRUNC);
+  return _wopen(path.c_str(), flags, _S_IREAD | _S_IWRITE);
+#else
+  int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC);
+#ifdef O_DIRECT
+  // read access to pick up the last partial block when appending
+  if (direct)
+    flags = O_RDWR | O_CREAT | O_CLOEXEC | O_DIRECT | (append ? 0 : O_TRUNC);
+#else
+  if (direct)
+    return -1;
+#endif
+  return ::open(path.c_str(), flags, 0644);
+#endif
+}
+
+struct AlignedDelete {
+  void operator()(char *p) const {
+    ::operator delete[](p, std::align_val_t{direct_io_block});
+  }
+};
+
+inline void close_fd(int fd) {
+#ifdef _WIN32
+  _close(fd);
+#else
+  ::close(fd);
+#endif
+}
+
+// Writes all of `size` bytes, retrying on short writes and EINTR.
+inline bool write_all(int fd, const char *data, size_t size) {
+  while (size > 0) {
+#ifdef _WIN32
+    auto n = _write(fd, data, static_cast<unsigned>(size));
+#else
+    auto n = ::write(fd, data, size);
+#endif
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += n;
+    size -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+#ifndef _WIN32
+inline bool pwrite_all(int fd, const char *data, size_t size, off_t offset) {
+  while (size > 0) {
+    auto n = ::pwrite(fd, data, size, offset);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += n;
+    size -= static_cast<size_t>(n);
+    offset += n;
+  }
+  return true;
+}
+#endif
+
+#ifndef _WIN32
+// Writes `line` and a newline, with a single writev() unless the descriptor
+// takes less (a full pipe, a signal).
+inline bool write_line(int fd, std::string_view line) {
+  iovec iov[2] = {{const_cast<char *>(line.data()), line.size()},
+                  {const_cast<char *>("\n"), 1}};
+  ssize_t n;
+  do {
+    n = ::writev(fd, iov, 2);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0)
+    return false;
+  auto done = static_cast<size_t>(n);
+  if (done < line.size() &&
+      !write_all(fd, line.data() + done, line.size() - done))
+    return false;
+  return done > line.size() || write_all(fd, "\n", 1);
+}
+#endif
+
+inline int64_t wall_clock_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+// Names of the threads that log, indexed by Logger's thread index, so
+// binary log files can define each thread once. Threads with the same name
+// share an index, and the index of a name no thread holds any more is
+// reused; its generation then changes, so files define it again.
+struct ThreadNames {
+  struct Id {
+    uint32_t index;
+    uint32_t generation;
+  };
+
+  std::mutex mtx;
+
+  static ThreadNames &get() {
+    static ThreadNames instance;
+    return instance;
+  }
+
+  Id acquire(std::string_view name) {
+    std::lock_guard lock(mtx);
+    Entry *unused = nullptr;
+    for (auto &e : entries_) {
+      if (e.name == name) {
+        ++e.refs;
+        return {index_of(e), e.generation};
+      }
+      if (!unused && e.refs == 0)
+        unused = &e;
+    }
+    if (!unused)
+      unused = &entries_.emplace_back();
+    unused->name = name;
+    ++unused->generation;
+    unused->refs = 1;
+    return {index_of(*unused), unused->generation};
+  }
+
+  // Async rings keep the index of the records they still hold.
+  void retain(uint32_t index) {
+    std::lock_guard lock(mtx);
+    ++entries_[index].refs;
+  }
+
+  void release(uint32_t index) {
+    std::lock_guard lock(mtx);
+    --entries_[index].refs;
+  }
+
+  std::string at(uint32_t index) {
+    std::lock_guard lock(mtx);
+    return index < entries_.size() ? entries_[index].name : std::string();
+  }
+
+  // Indices handed out so far: the most names ever held at once.
+  size_t size() {
+    std::lock_guard lock(mtx);
+    return entries_.size();
+  }
+
+private:
+  struct Entry {
+    std::string name;
+    uint32_t generation = 0; // 0 is never handed out
+    uint32_t refs = 0;
+  };
+
+  uint32_t index_of(const Entry &e) const {
+    return static_cast<uint32_t>(&e - entries_.data());
+  }
+
+  std::vector<Entry> entries_;
+};
+
+// Fixed part of a binary record on its way to LogSink, followed by the
+// encoded arguments (or by the message, for is_text).
+struct BinaryHeader {
+  const char *fmt;
+  size_t fmt_size;
+  const char *function; // source of the context tag, null without one
+  int64_t timestamp_ns; // system_clock, since epoch
+  uint32_t thread;
+  uint32_t thread_generation; // see ThreadNames
+  uint8_t level;
+  bool is_text;
+};
+} // namespace detail
+
+enum class FileFormat {
+  TEXT,   // the same lines as the console, without colors
+  BINARY, // compact records, see binlog.hpp; decode with mutils_logcat
+};
+
+struct FileOptions {
+  // Keep what the file holds. Appends use O_APPEND, so several processes
+  // can log to the same file without overwriting each other.
+  bool append = false;
+  FileFormat format = FileFormat::TEXT;
+  // Write around the page cache (O_DIRECT), in whole blocks, so a busy log
+  // does not push other data out of memory. Linux and filesystems that
+  // support it only; the file is opened normally otherwise. The file should
+  // then have a single writer.
+  bool direct = false;
+};
+
+// The log file is rolled to "<path>.1" (older ones shift to .2, .3, ...) once
+// it reaches max_bytes or is max_age old; 0 disables either trigger.
+struct RotationOptions {
+  size_t max_bytes = 0;
+  std::chrono::seconds max_age{0};
+  unsigned keep = 5; // rolled files kept, the oldest is deleted
+  bool compress = false; // gzip rolled files; needs MUTILS_HAS_ZLIB
+};
+
+namespace detail {
+inline std::filesystem::path rolled_path(const std::filesystem::path &path,
+                                         unsigned index, bool gz) {
+  auto rolled = path;
+  rolled += "." + std::to_string(index) + (gz ? ".gz" : "");
+  return rolled;
+}
+
+// Makes room for a new "<path>.1": drops the oldest and shifts the rest.
+inline void shift_rolled_files(const std::filesystem::path &path,
+                               unsigned keep) {
+  std::error_code ec;
+  for (bool gz : {false, true}) {
+    std::filesystem::remove(rolled_path(path, keep, gz), ec);
+    for (unsigned i = keep; i-- > 1;) {
+      auto from = rolled_path(path, i, gz);
+      if (std::filesystem::exists(from, ec))
+        std::filesystem::rename(from, rolled_path(path, i + 1, gz), ec);
+    }
+  }
+}
+
+// Replaces `path` with "<path>.gz"; false (keeping `path`) on failure.
+bool gzip_file(const std::filesystem::path &path);
+} // namespace detail
+
+enum class LogLevel { DEBUG, INFO, WARN, ERR };
+
+static_assert(static_cast<int>(LogLevel::ERR) == MUTILS_LOG_LEVEL_ERR);
+
+inline constexpr LogLevel min_log_level =
+    static_cast<LogLevel>(MUTILS_MIN_LOG_LEVEL);
+
+// True if statements at `level` survive MUTILS_MIN_LOG_LEVEL.
+constexpr bool compiled_in(LogLevel level) {
+  return static_cast<int>(level) >= MUTILS_MIN_LOG_LEVEL;
+}
+
+namespace detail {
+// Calls out(span) for the parts of `msg` between ANSI escape sequences.
+template <typename Out> void strip_ansi(std::string_view msg, Out &&out) {
+  // copy the spans between escapes, skipping each escape up to its final
+  // letter
+  const char *p = msg.data();
+  const char *end = p + msg.size();
+  while (p < end) {
+    auto esc = static_cast<const char *>(std::memchr(p, '\033', end - p));
+    if (!esc) {
+      out(std::string_view(p, end));
+      break;
+    }
+    out(std::string_view(p, esc));
+    p = esc + 1;
+    while (p < end && !((*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z')))
+      ++p;
+    if (p < end)
+      ++p;
+  }
+}
+
+struct LevelThreshold {
+  std::atomic<int> threshold{static_cast<int>(LogLevel::DEBUG)};
+
+  void set(LogLevel level) {
+    threshold.store(static_cast<int>(level), std::memory_order_relaxed);
+  }
+
+  bool accepts(LogLevel level) const {
+    return static_cast<int>(level) >=
+           threshold.load(std::memory_order_relaxed);
+  }
+};
+} // namespace detail
+
+// A destination registered with Logger::add_sink, on top of the built-in
+// console and file; see sinks.hpp for ready-made ones. write() runs on the
+// logging thread (or the async backend) without LogSink's locks held, so
+// each sink does its own locking, and a slow one should be wrapped in an
+// AsyncSink rather than hold up its caller.
+class Sink {
+public:
+  virtual ~Sink() = default;
+
+  // `line` is the formatted message, without colors or a newline.
+  virtual void write(LogLevel level, std::string_view line) = 0;
+  // Called for lines logged with flush set and by Logger::flush_all.
+  virtual void flush() {}
+
+  // Lines below `level` are not passed to this sink. Logger::set_level
+  // still applies first: filtered calls are never formatted.
+  void set_level(LogLevel level) { level_.set(level); }
+  bool accepts(LogLevel level) const { return level_.accepts(level); }
+
+private:
+  detail::LevelThreshold level_;
+};
+
 struct LogSink {
+  static constexpr size_t file_buffer_size = 64 * 1024;
+
   std::mutex mtx;
-  std::ofstream file;
+  int fd = -1;
+  // The file buffer is written out once it holds `flush_threshold` bytes or
+  // its oldest line is older than `flush_interval`, whichever comes first.
+  // The age is checked on every write and, while the log is idle, by the
+  // async backend and the rotation thread; with neither running, a quiet
+  // log keeps its last lines until the next write or flush.
+  size_t flush_threshold = file_buffer_size / 2;
+  std::chrono::milliseconds flush_interval{1000};
 
   static LogSink &get() {
     static LogSink instance;
@@ -120,48 +655,1134 @@ struct LogSink {
 
   // Call once before spawning threads. Safe to call multiple times;
   // subsequent calls reopen the file (truncating unless append=true).
-  bool open(const std::filesystem::path &path, bool append = false) {
-    std::lock_guard lock(mtx);
-    if (file.is_open()) {
-      file.close();
+  bool open(const std::filesystem::path &path, const FileOptions &opts) {
+    std::unique_lock lock(mtx);
+    wait_for_rotation(lock);
+    close_unlocked();
+    direct_ = opts.direct;
+    fd = direct_ ? detail::open_log_file(path, opts.append, true) : -1;
+    if (fd < 0) {
+      // no O_DIRECT here (or on this filesystem), so use the page cache
+      direct_ = false;
+      fd = detail::open_log_file(path, opts.append);
+    }
+    if (fd < 0)
+      return false;
+    if (!buf_)
+      buf_.reset(static_cast<char *>(::operator new[](
+          file_buffer_size, std::align_val_t{detail::direct_io_block})));
+    path_ = path;
+    std::error_code ec;
+    file_bytes_ = opts.append ? std::filesystem::file_size(path, ec) : 0;
+    if (ec)
+      file_bytes_ = 0;
+    start_file(file_bytes_);
+    opened_ = std::chrono::steady_clock::now();
+    rotate_requested_ = false;
+    format_ = opts.format;
+    if (format_ == FileFormat::BINARY) {
+      reset_binary_state();
+      append(binlog::magic);
+      flush_file();
+      binary_.store(true, std::memory_order_relaxed);
     }
-    auto mode = std::ios::out | (append ? std::ios::app : std::ios::trunc);
-    file.open(path, mode);
-    return file.is_open();
+    rotate_cv_.notify_all(); // the rotator recomputes its deadline
+    return true;
+  }
+
+  // Enables (or, with both triggers 0, disables) rotation of the file opened
+  // now or later. Rolling happens on a background thread: writers only see
+  // the descriptor being swapped under the lock, never a rename or open.
+  // Returns false if compression is asked for without zlib support.
+  bool set_rotation(const RotationOptions &opts) {
+#ifndef MUTILS_HAS_ZLIB
+    if (opts.compress)
+      return false;
+#endif
+    std::lock_guard lock(mtx);
+    rotation_ = opts;
+    rotation_.keep = std::max(rotation_.keep, 1u);
+    if (!rotator_.joinable() &&
+        (opts.max_bytes > 0 || opts.max_age.count() > 0))
+      rotator_ = std::thread([this] { rotate_loop(); });
+    rotate_cv_.notify_all();
+    return true;
   }
 
   void close() {
+    std::unique_lock lock(mtx);
+    wait_for_rotation(lock);
+    close_unlocked();
+  }
+
+  bool is_open() const { return fd >= 0; }
+
+  // True while a FileFormat::BINARY file is open; checked without the lock.
+  bool binary() const { return binary_.load(std::memory_order_relaxed); }
+
+  bool console() const { return console_.load(std::memory_order_relaxed); }
+  void set_console(bool enabled) {
+    console_.store(enabled, std::memory_order_relaxed);
+  }
+
+  // False when nothing would receive a text line, e.g. with only a binary
+  // file open: the Logger then skips text formatting altogether.
+  bool wants_text() const {
+    return console() || has_sinks_.load(std::memory_order_relaxed);
+  }
+
+  void set_console_level(LogLevel level) { console_level_.set(level); }
+  void set_file_level(LogLevel level) { file_level_.set(level); }
+
+  void add_sink(std::shared_ptr<Sink> sink) {
+    std::unique_lock lock(sinks_mtx_);
+    sinks_.push_back(std::move(sink));
+    has_sinks_.store(true, std::memory_order_relaxed);
+  }
+
+  void remove_sink(const Sink *sink) {
+    std::unique_lock lock(sinks_mtx_);
+    std::erase_if(sinks_, [&](const auto &s) { return s.get() == sink; });
+    has_sinks_.store(!sinks_.empty(), std::memory_order_relaxed);
+  }
+
+  // Write one message to the console, the file and the registered sinks.
+  // Each has its own lock, so a blocked terminal does not stall the file.
+  // Binary files only receive write_binary() records.
+  void write(std::string_view msg, LogLevel level, bool flush,
+             bool use_stderr) {
+    if (console() && console_level_.accepts(level)) {
+      std::lock_guard lock(console_mtx_);
+      write_console(msg, use_stderr);
+    }
+
+    if (file_level_.accepts(level)) {
+      std::lock_guard lock(mtx);
+      if (is_open() && format_ == FileFormat::TEXT) {
+        write_to_file(msg);
+        flush_if_due(flush);
+      }
+    }
+
+    if (has_sinks_.load(std::memory_order_relaxed))
+      write_sinks(msg, level, flush);
+  }
+
+  void write_binary(const std::byte *payload, size_t size, bool flush) {
     std::lock_guard lock(mtx);
-    if (file.is_open()) {
-      file.close();
+    write_binary_unlocked(payload, size, flush);
+  }
+
+  // Write one record built by the Logger, a detail::BinaryHeader followed by
+  // the encoded arguments (must be called with mtx held).
+  void write_binary_unlocked(const std::byte *payload, size_t size,
+                             bool flush) {
+    if (!is_open() || format_ != FileFormat::BINARY)
+      return;
+    detail::BinaryHeader hdr;
+    std::memcpy(&hdr, payload, sizeof(hdr));
+    if (!hdr.is_text &&
+        !file_level_.accepts(static_cast<LogLevel>(hdr.level)))
+      return;
+    std::string_view rest(reinterpret_cast<const char *>(payload) +
+                              sizeof(hdr),
+                          size - sizeof(hdr));
+
+    auto &out = binary_out_;
+    auto &body = binary_body_;
+    out.clear();
+
+    if (hdr.thread >= binary_threads_.size())
+      binary_threads_.resize(hdr.thread + 1);
+    if (binary_threads_[hdr.thread] != hdr.thread_generation) {
+      // the writer still holds the index, so the name is still its own
+      binary_threads_[hdr.thread] = hdr.thread_generation;
+      body.clear();
+      binlog::put_varint(body, hdr.thread);
+      body += detail::ThreadNames::get().at(hdr.thread);
+      put_binary_record(binlog::TAG_THREAD, body);
     }
+
+    uint64_t id = 0;
+    if (!hdr.is_text) {
+      auto [it, added] = binary_formats_.try_emplace(
+          {hdr.fmt, hdr.function}, binary_formats_.size());
+      id = it->second;
+      if (added) {
+        std::string_view fmt(hdr.fmt, hdr.fmt_size);
+        body.clear();
+        binlog::put_varint(body, id);
+        binlog::put_varint(body, fmt.size());
+        body += fmt;
+        if (hdr.function)
+          body += extract_context(hdr.function, MUTILS_LOG_CONTEXT_LEVEL);
+        put_binary_record(binlog::TAG_FORMAT, body);
+      }
+    }
+
+    body.clear();
+    binlog::put_varint(body,
+                       binlog::zigzag(hdr.timestamp_ns - last_timestamp_));
+    last_timestamp_ = hdr.timestamp_ns;
+    if (!hdr.is_text)
+      body += static_cast<char>(hdr.level);
+    binlog::put_varint(body, hdr.thread);
+    if (!hdr.is_text)
+      binlog::put_varint(body, id);
+    body += rest;
+    put_binary_record(hdr.is_text ? binlog::TAG_TEXT : binlog::TAG_LOG, body);
+
+    if (buf_len_ == written_len_)
+      oldest_ = std::chrono::steady_clock::now();
+    append(out);
+    flush_if_due(flush);
   }
 
-  bool is_open() const { return file.is_open(); }
+  // While batching is on, console lines are collected and written together
+  // when it is switched off again; the async backend does this around
+  // every pass over the rings.
+  void set_console_batching(bool enabled) {
+    std::lock_guard lock(console_mtx_);
+    console_batching_ = enabled;
+    if (!enabled)
+      flush_console();
+  }
+
+  void flush() {
+    {
+      std::lock_guard lock(console_mtx_);
+      flush_console();
+    }
+    {
+      std::lock_guard lock(mtx);
+      flush_file();
+    }
+    if (has_sinks_.load(std::memory_order_relaxed)) {
+      std::shared_lock lock(sinks_mtx_);
+      for (auto &sink : sinks_)
+        sink->flush();
+    }
+  }
+
+  // Console lines bypass iostreams and go to fd 1 and 2, each with its
+  // newline in a single writev(). Only while batching, during an async pass,
+  // are they collected in console_buf_ and written in one go. Whatever the
+  // program printed through stdio (or std::cout, which shares its buffer)
+  // goes out first, so the two keep their order (must be called with
+  // console_mtx_ held).
+  void write_console(std::string_view msg, bool use_stderr) {
+#ifdef _WIN32
+    auto &stream = use_stderr ? std::cerr : std::cout;
+    stream << msg << '\n';
+#else
+    if (use_stderr) {
+      // unbuffered, but after whatever stdout still holds
+      flush_console();
+      detail::write_line(STDERR_FILENO, msg);
+      return;
+    }
+    if (!console_batching_) {
+      std::fflush(stdout);
+      detail::write_line(STDOUT_FILENO, msg);
+      return;
+    }
+    if (console_len_ + msg.size() + 1 > console_buffer_size) {
+      flush_console();
+      if (msg.size() + 1 > console_buffer_size) {
+        detail::write_line(STDOUT_FILENO, msg);
+        return;
+      }
+    }
+    std::memcpy(console_buf_.get() + console_len_, msg.data(), msg.size());
+    console_len_ += msg.size();
+    console_buf_[console_len_++] = '\n';
+#endif
+  }
+
+  // must be called with console_mtx_ held
+  void flush_console() {
+#ifdef _WIN32
+    std::cout.flush();
+#else
+    std::fflush(stdout);
+    if (console_len_ > 0)
+      detail::write_all(STDOUT_FILENO, console_buf_.get(), console_len_);
+    console_len_ = 0;
+#endif
+  }
 
   // Write to file (must be called with mtx held).
-  // Strips ANSI escape sequences so the file stays clean.
+  // Strips ANSI escape sequences so the file stays clean. Nothing to strip
+  // when stdout is not a terminal, since no colors were emitted then.
   void write_to_file(std::string_view msg) {
-    // Simple state-machine ANSI stripper
-    bool in_escape = false;
-    for (char c : msg) {
-      if (in_escape) {
-        if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'))
-          in_escape = false;
-      } else if (c == '\033') {
-        in_escape = true;
+    if (buf_len_ == written_len_)
+      oldest_ = std::chrono::steady_clock::now();
+
+    if (!StaticConfig::get().is_tty)
+      append(msg);
+    else
+      detail::strip_ansi(msg, [&](std::string_view part) { append(part); });
+    append("\n");
+  }
+
+  // Writes out the buffer once its oldest line has waited flush_interval,
+  // for callers that run while nothing is being logged.
+  void flush_stale() {
+    std::lock_guard lock(mtx);
+    flush_stale_unlocked();
+  }
+
+  // Hands the buffered bytes to the OS (must be called with mtx held).
+  void flush_file() {
+    if (direct_) {
+      write_direct(true);
+      return;
+    }
+    if (buf_len_ > 0 && is_open())
+      detail::write_all(fd, buf_.get(), buf_len_);
+    buf_len_ = 0;
+  }
+
+private:
+  struct FormatKey {
+    const char *fmt;
+    const char *function;
+
+    bool operator==(const FormatKey &) const = default;
+  };
+
+  struct FormatKeyHash {
+    size_t operator()(const FormatKey &k) const {
+      return std::hash<const void *>{}(k.fmt) * 31 +
+             std::hash<const void *>{}(k.function);
+    }
+  };
+
+  LogSink() = default;
+  ~LogSink() {
+    {
+      std::lock_guard lock(mtx);
+      rotator_stop_ = true;
+    }
+    rotate_cv_.notify_all();
+    if (rotator_.joinable())
+      rotator_.join();
+    close_unlocked();
+    std::lock_guard lock(console_mtx_);
+    flush_console();
+  }
+
+  // Counts bytes as they are buffered, so a file is rolled close to
+  // max_bytes regardless of the buffer size.
+  void count_bytes(size_t size) {
+    file_bytes_ += size;
+    if (rotation_.max_bytes > 0 && file_bytes_ >= rotation_.max_bytes &&
+        !rotate_requested_) {
+      rotate_requested_ = true;
+      rotate_cv_.notify_one();
+    }
+  }
+
+  void reset_binary_state() {
+    // every file (or appended run) carries its own string table
+    binary_formats_.clear();
+    binary_threads_.clear();
+    last_timestamp_ = 0;
+  }
+
+  void wait_for_rotation(std::unique_lock<std::mutex> &lock) {
+    rotate_cv_.wait(lock, [&] { return !rotating_; });
+  }
+
+  bool rotation_due() const {
+    return rotate_requested_ ||
+           (rotation_.max_age.count() > 0 &&
+            std::chrono::steady_clock::now() - opened_ >= rotation_.max_age);
+  }
+
+  // Background thread behind set_rotation(). The rename, the open of the new
+  // file and compression run without the lock; writers keep appending to
+  // the old descriptor (already renamed) until it is swapped.
+  void rotate_loop() {
+    std::unique_lock lock(mtx);
+    while (!rotator_stop_) {
+      if (!is_open() || !rotation_due()) {
+        // woken by writers, open(), set_rotation() and the destructor, and
+        // often enough to write out lines left in the buffer by a quiet log
+        flush_stale_unlocked();
+        if (!is_open()) {
+          rotate_cv_.wait(lock);
+          continue;
+        }
+        auto deadline = buf_len_ != written_len_
+                            ? oldest_ + flush_interval
+                            : std::chrono::steady_clock::now() + flush_interval;
+        if (rotation_.max_age.count() > 0)
+          deadline = std::min(deadline, opened_ + rotation_.max_age);
+        rotate_cv_.wait_until(lock, deadline);
+        continue;
+      }
+
+      auto path = path_;
+      auto opts = rotation_;
+      rotating_ = true; // open() and close() wait for us
+      bool binary_file = format_ == FileFormat::BINARY;
+      bool direct = direct_;
+      lock.unlock();
+
+      detail::shift_rolled_files(path, opts.keep);
+      auto rolled = detail::rolled_path(path, 1, false);
+      std::error_code ec;
+      std::filesystem::rename(path, rolled, ec);
+      int new_fd = -1;
+      if (!ec) {
+        new_fd = direct ? detail::open_log_file(path, false, true) : -1;
+        if (new_fd < 0) {
+          direct = false;
+          new_fd = detail::open_log_file(path, false);
+        }
+      }
+
+      lock.lock();
+      int old_fd = -1;
+      bool rolled_ok = true;
+      flush_file();
+      if (new_fd >= 0) {
+        old_fd = std::exchange(fd, new_fd);
       } else {
-        file << c;
+        // Windows cannot rename a file that is open: close it first, which
+        // does hold up writers, and append to it again on failure.
+        detail::close_fd(fd);
+        std::filesystem::rename(path, rolled, ec);
+        rolled_ok = !ec;
+        direct = false;
+        fd = detail::open_log_file(path, !rolled_ok);
+        if (fd < 0)
+          binary_.store(false, std::memory_order_relaxed);
+      }
+      direct_ = direct;
+      start_file(0);
+      // on failure, retry after another max_bytes or max_age
+      file_bytes_ = 0;
+      if (rolled_ok && binary_file && is_open()) {
+        reset_binary_state();
+        append(binlog::magic);
       }
+      opened_ = std::chrono::steady_clock::now();
+      rotate_requested_ = false;
+      // open() and close() only wait for the swap, not the compression;
+      // no one else moves rolled files, so it can go on without the flag
+      rotating_ = false;
+      rotate_cv_.notify_all();
+      lock.unlock();
+
+      if (old_fd >= 0)
+        detail::close_fd(old_fd);
+      if (rolled_ok && opts.compress)
+        detail::gzip_file(rolled);
+      lock.lock();
     }
-    file << '\n';
+  }
+
+  // The line is formatted once; with colors on, it is stripped once too.
+  void write_sinks(std::string_view msg, LogLevel level, bool flush) {
+    thread_local std::string plain;
+    if (StaticConfig::get().is_tty) {
+      plain.clear();
+      detail::strip_ansi(msg, [&](std::string_view part) { plain += part; });
+      msg = plain;
+    }
+    std::shared_lock lock(sinks_mtx_);
+    for (auto &sink : sinks_) {
+      if (!sink->accepts(level))
+        continue;
+      sink->write(level, msg);
+      if (flush)
+        sink->flush();
+    }
+  }
+
+  void flush_if_due(bool flush) {
+    if (flush || buf_len_ >= flush_threshold ||
+        std::chrono::steady_clock::now() - oldest_ >= flush_interval)
+      flush_file();
+  }
+
+  // must be called with mtx held
+  void flush_stale_unlocked() {
+    if (buf_len_ != written_len_)
+      flush_if_due(false);
+  }
+
+  void put_binary_record(binlog::RecordTag tag, std::string_view body) {
+    binary_out_ += static_cast<char>(tag);
+    binlog::put_varint(binary_out_, body.size());
+    binary_out_ += body;
+  }
+
+  void append(std::string_view bytes) {
+    count_bytes(bytes.size());
+    if (direct_) {
+      // everything goes through the aligned buffer, a block at a time
+      while (!bytes.empty()) {
+        size_t n = std::min(bytes.size(), file_buffer_size - buf_len_);
+        std::memcpy(buf_.get() + buf_len_, bytes.data(), n);
+        buf_len_ += n;
+        bytes.remove_prefix(n);
+        if (buf_len_ == file_buffer_size)
+          write_direct(false);
+      }
+      return;
+    }
+    if (buf_len_ + bytes.size() > file_buffer_size) {
+      flush_file();
+      if (bytes.size() > file_buffer_size) {
+        detail::write_all(fd, bytes.data(), bytes.size());
+        return;
+      }
+    }
+    std::memcpy(buf_.get() + buf_len_, bytes.data(), bytes.size());
+    buf_len_ += bytes.size();
+  }
+
+  // Resets the buffer for a file just opened with `size` bytes in it. For
+  // direct I/O, writes have to start on a block boundary, so the partial
+  // last block is read back into the buffer and rewritten with the next.
+  void start_file(uint64_t size) {
+    buf_len_ = 0;
+    written_len_ = 0;
+    file_offset_ = 0;
+#ifndef _WIN32
+    if (!direct_)
+      return;
+    file_offset_ = size / detail::direct_io_block * detail::direct_io_block;
+    size_t tail = static_cast<size_t>(size - file_offset_);
+    if (tail > 0) {
+      auto n = ::pread(fd, buf_.get(), detail::direct_io_block,
+                       static_cast<off_t>(file_offset_));
+      if (n < static_cast<ssize_t>(tail)) {
+        // cannot rebuild the block: carry on through the page cache
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) & ~O_DIRECT);
+        ::lseek(fd, 0, SEEK_END);
+        direct_ = false;
+        return;
+      }
+    }
+    buf_len_ = written_len_ = tail;
+#else
+    (void)size;
+#endif
+  }
+
+  // Writes the whole blocks in the buffer with O_DIRECT and keeps the
+  // rest. With `all`, that rest is written too, through the page cache
+  // since it is not a whole block, and stays buffered to start the next
+  // block write (must be called with mtx held).
+  void write_direct(bool all) {
+#ifndef _WIN32
+    if (!is_open() || buf_len_ == written_len_)
+      return;
+    constexpr size_t block = detail::direct_io_block;
+    size_t blocks = buf_len_ / block * block;
+    if (blocks > 0) {
+      detail::pwrite_all(fd, buf_.get(), blocks,
+                         static_cast<off_t>(file_offset_));
+      file_offset_ += blocks;
+      buf_len_ -= blocks;
+      std::memmove(buf_.get(), buf_.get() + blocks, buf_len_);
+      written_len_ = 0;
+    }
+    if (all && buf_len_ > written_len_) {
+      int flags = ::fcntl(fd, F_GETFL);
+      ::fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+      detail::pwrite_all(fd, buf_.get() + written_len_,
+                         buf_len_ - written_len_,
+                         static_cast<off_t>(file_offset_ + written_len_));
+      ::fcntl(fd, F_SETFL, flags);
+      written_len_ = buf_len_;
+    }
+#else
+    (void)all;
+#endif
+  }
+
+  void close_unlocked() {
+    if (!is_open())
+      return;
+    flush_file();
+    detail::close_fd(fd);
+    fd = -1;
+    binary_.store(false, std::memory_order_relaxed);
+  }
+
+  std::unique_ptr<char[], detail::AlignedDelete> buf_;
+  size_t buf_len_ = 0;
+  // direct I/O only: buf_ starts at this file offset, and its first
+  // written_len_ bytes are already in the file
+  bool direct_ = false;
+  uint64_t file_offset_ = 0;
+  size_t written_len_ = 0;
+  std::chrono::steady_clock::time_point oldest_;
+  FileFormat format_ = FileFormat::TEXT;
+  std::atomic<bool> binary_{false};
+  std::atomic<bool> console_{true};
+  std::mutex console_mtx_;
+  static constexpr size_t console_buffer_size = 64 * 1024;
+  bool console_batching_ = false;
+  std::unique_ptr<char[]> console_buf_ =
+      std::make_unique_for_overwrite<char[]>(console_buffer_size);
+  size_t console_len_ = 0;
+  detail::LevelThreshold console_level_;
+  detail::LevelThreshold file_level_;
+  std::shared_mutex sinks_mtx_;
+  std::vector<std::shared_ptr<Sink>> sinks_;
+  std::atomic<bool> has_sinks_{false};
+  // binary file state: string table, defined threads, last timestamp
+  std::unordered_map<FormatKey, uint64_t, FormatKeyHash> binary_formats_;
+  std::vector<uint32_t> binary_threads_; // generation defined in the file
+  int64_t last_timestamp_ = 0;
+  std::string binary_out_;
+  std::string binary_body_;
+  // rotation
+  std::filesystem::path path_;
+  size_t file_bytes_ = 0;
+  std::chrono::steady_clock::time_point opened_;
+  RotationOptions rotation_;
+  bool rotate_requested_ = false;
+  bool rotating_ = false;
+  bool rotator_stop_ = false;
+  std::condition_variable rotate_cv_;
+  std::thread rotator_;
+};
+
+// What a thread does when its async ring is full.
+enum class OverflowPolicy {
+  BLOCK, // wait for the backend to make room
+  DROP,  // discard the message and count it (see Logger::dropped_count)
+  SYNC,  // write the message synchronously, like the non-async mode
+};
+
+struct AsyncOptions {
+  // Per-thread ring size in bytes, rounded up to a power of two. Messages
+  // larger than half of it are always written synchronously.
+  size_t ring_bytes = 1 << 20;
+  OverflowPolicy overflow = OverflowPolicy::BLOCK;
+  // How long the backend sleeps when every ring is empty.
+  std::chrono::microseconds poll_interval{500};
+  // Binary logging: calls whose arguments are all deferrable (see
+  // is_deferrable_v) only copy the raw arguments into the ring, and the
+  // backend thread runs std::format.
+  bool defer_formatting = false;
+};
+
+// Optional UTC timestamp in front of each text line, in the layout
+// mutils_logcat --time prints; the value is the number of sub-second digits.
+enum class Timestamps : uint8_t {
+  OFF = 0,
+  MILLIS = 3,
+  MICROS = 6,
+  NANOS = 9,
+};
+
+// Arguments that can be copied byte-wise into the ring and formatted later
+// on another thread. Pointers and views are excluded because whatever they
+// refer to may be gone by then. Specialize to false for trivially copyable
+// types that still reference external memory.
+template <typename T>
+inline constexpr bool is_deferrable_v =
+    std::is_trivially_copyable_v<T> && !std::is_pointer_v<T> &&
+    !std::is_array_v<T> && !std::is_member_pointer_v<T> &&
+    alignof(T) <= SpscRing::alignment;
+
+template <typename CharT, typename Traits>
+inline constexpr bool is_deferrable_v<std::basic_string_view<CharT, Traits>> =
+    false;
+
+namespace detail {
+enum RecordFlags : uint16_t {
+  RECORD_FLUSH = 1 << 0,
+  RECORD_STDERR = 1 << 1,
+  RECORD_LEVEL_SHIFT = 2, // the LogLevel of text records, in bits 2-3
+};
+
+enum RecordKind : uint16_t {
+  RECORD_TEXT = 0,     // payload is a fully formatted message
+  RECORD_DEFERRED = 1, // payload is a DeferredHeader followed by the args
+  RECORD_BINARY = 2,   // payload is a BinaryHeader followed by the args
+};
+
+inline constexpr std::string_view level_color(LogLevel level) {
+  switch (level) {
+  case LogLevel::WARN:
+    return ansi_yellow;
+  case LogLevel::ERR:
+    return ansi_red;
+  default:
+    return ansi_green;
+  }
+}
+
+inline constexpr std::string_view level_label(LogLevel level) {
+  switch (level) {
+  case LogLevel::DEBUG:
+    return "[DEBUG]: ";
+  case LogLevel::WARN:
+    return "[WARN]: ";
+  case LogLevel::ERR:
+    return "[ERROR]: ";
+  default:
+    return "[LOG]: ";
+  }
+}
+
+// String built during constant evaluation that can be passed as a template
+// argument. Whatever does not fit in Capacity is cut off.
+template <size_t Capacity> struct FixedString {
+  static constexpr size_t capacity = Capacity;
+
+  char data[Capacity > 0 ? Capacity : 1]{};
+  size_t size = 0;
+
+  constexpr void append(std::string_view s) {
+    size_t n = std::min(s.size(), Capacity - size);
+    std::copy_n(s.data(), n, data + size);
+    size += n;
+  }
+
+  constexpr std::string_view view() const { return {data, size}; }
+};
+
+// Length of the LOG_WCTX tag of the function `loc` is in. Templated and
+// namespaced signatures run long, so context_name() is sized by this rather
+// than by a fixed cap.
+consteval size_t context_size(std::source_location loc) {
+  return extract_context(loc.function_name(), MUTILS_LOG_CONTEXT_LEVEL).size();
+}
+
+// The LOG_WCTX tag of the function `loc` is in; Size is context_size(loc).
+template <size_t Size>
+consteval FixedString<Size> context_name(std::source_location loc) {
+  FixedString<Size> name;
+  name.append(extract_context(loc.function_name(), MUTILS_LOG_CONTEXT_LEVEL));
+  return name;
+}
+
+// What a line has between the thread tag and the message: the context tag,
+// if any, the level color and the level label. Both variants live in
+// read-only data, so a log call copies one of them and nothing else.
+template <LogLevel Level, auto Context = FixedString<0>{}>
+struct LinePrefix {
+  static constexpr auto make(bool color) {
+    FixedString<decltype(Context)::capacity + 32> prefix;
+    if (Context.size) {
+      prefix.append("[");
+      prefix.append(Context.view());
+      prefix.append("] ");
+    }
+    if (color)
+      prefix.append(level_color(Level));
+    prefix.append(level_label(Level));
+    return prefix;
+  }
+
+  static constexpr auto colored = make(true);
+  static constexpr auto plain = make(false);
+
+  static std::string_view get(bool color) {
+    return color ? colored.view() : plain.view();
+  }
+};
+
+inline std::atomic<uint8_t> timestamp_digits{0}; // see Logger::set_timestamps
+
+// Formats "YYYY-MM-DDTHH:MM:SS.fffZ " prefixes. The part up to the seconds
+// is only rebuilt when the second changes; other lines copy it and patch in
+// the sub-second digits. One per thread, so no locking.
+class TimestampCache {
+public:
+  static constexpr size_t max_size = 32; // room needed at `out`
+
+  size_t write(char *out, int64_t ns, int digits) {
+    int64_t second = ns / 1000000000;
+    int64_t fraction = ns % 1000000000;
+    if (fraction < 0) {
+      --second;
+      fraction += 1000000000;
+    }
+    if (second != second_)
+      rebuild_(second);
+
+    std::memcpy(out, head_.data(), head_size_);
+    size_t size = head_size_;
+    static constexpr uint32_t divisors[] = {1000000000, 100000000, 10000000,
+                                            1000000,    100000,    10000,
+                                            1000,       100,       10,
+                                            1};
+    write_digits(out + size, static_cast<uint32_t>(fraction) / divisors[digits],
+                 digits);
+    size += static_cast<size_t>(digits);
+    std::memcpy(out + size, "Z ", 2);
+    return size + 2;
   }
 
 private:
-  LogSink() = default;
+  void rebuild_(int64_t second) {
+    using namespace std::chrono;
+    sys_seconds tp{seconds(second)};
+    auto day = floor<days>(tp);
+    year_month_day ymd{day};
+    hh_mm_ss<seconds> tod{tp - day};
+    const unsigned fields[] = {
+        static_cast<unsigned>(static_cast<int>(ymd.year())),
+        static_cast<unsigned>(ymd.month()),
+        static_cast<unsigned>(ymd.day()),
+        static_cast<unsigned>(tod.hours().count()),
+        static_cast<unsigned>(tod.minutes().count()),
+        static_cast<unsigned>(tod.seconds().count())};
+    char *p = head_.data();
+    for (size_t i = 0; i < std::size(fields); ++i) {
+      int width = i == 0 ? 4 : 2;
+      write_digits(p, fields[i], width);
+      p += width;
+      *p++ = "--T::."[i];
+    }
+    head_size_ = static_cast<size_t>(p - head_.data());
+    second_ = second;
+  }
+
+  int64_t second_ = std::numeric_limits<int64_t>::min();
+  std::array<char, 20> head_{};
+  size_t head_size_ = 0;
 };
 
-enum class LogLevel { DEBUG, INFO, WARN, ERR };
+// Call-site state of the rate-limited macros. allow() decides whether this
+// call is logged and, if so, reports how many calls were skipped since the
+// previous one that was.
+struct EveryN {
+  std::atomic<uint64_t> calls{0};
+
+  bool allow(uint64_t n, uint64_t &skipped) {
+    uint64_t call = calls.fetch_add(1, std::memory_order_relaxed);
+    if (n <= 1)
+      return true;
+    if (call % n != 0)
+      return false;
+    skipped = call == 0 ? 0 : n - 1;
+    return true;
+  }
+};
+
+struct FirstN {
+  std::atomic<uint64_t> calls{0};
+
+  bool allow(uint64_t n, uint64_t &) {
+    // stop counting once past n, so the counter cannot wrap
+    return calls.load(std::memory_order_relaxed) < n &&
+           calls.fetch_add(1, std::memory_order_relaxed) < n;
+  }
+};
+
+struct EveryMs {
+  std::atomic<int64_t> next_ns{std::numeric_limits<int64_t>::min()};
+  std::atomic<uint64_t> skipped_calls{0};
+
+  bool allow(int64_t ms, uint64_t &skipped) {
+    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now().time_since_epoch())
+                      .count();
+    int64_t next = next_ns.load(std::memory_order_relaxed);
+    // one thread wins the slot, the others count as skipped
+    if (now < next ||
+        !next_ns.compare_exchange_strong(next, now + ms * 1000000,
+                                         std::memory_order_relaxed)) {
+      skipped_calls.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    skipped = skipped_calls.exchange(0, std::memory_order_relaxed);
+    return true;
+  }
+};
+
+using DeferredFormatFn = void (*)(std::string &out, std::string_view fmt,
+                                  const std::byte *args);
+
+// Fixed part of a RECORD_DEFERRED payload. The format string always refers
+// to a literal, so only its address travels through the ring.
+struct DeferredHeader {
+  DeferredFormatFn format;
+  const char *fmt;
+  size_t fmt_size;
+  const char *prefix; // a LinePrefix, which outlives every record
+  size_t prefix_size;
+  int64_t timestamp_ns; // system_clock, since epoch
+  LogLevel level;
+};
+
+template <typename... Args> constexpr auto deferred_offsets() {
+  std::array<size_t, sizeof...(Args) + 1> offsets{};
+  size_t offset = sizeof(DeferredHeader);
+  size_t i = 0;
+  ((offset = (offset + alignof(Args) - 1) & ~(alignof(Args) - 1),
+    offsets[i++] = offset, offset += sizeof(Args)),
+   ...);
+  offsets[sizeof...(Args)] = offset; // total payload size
+  return offsets;
+}
+
+template <typename... Args>
+void format_deferred(std::string &out, std::string_view fmt,
+                     const std::byte *payload) {
+  [[maybe_unused]] static constexpr auto offsets = deferred_offsets<Args...>();
+  [&]<size_t... I>(std::index_sequence<I...>) {
+    std::vformat_to(
+        std::back_inserter(out), fmt,
+        std::make_format_args(*std::launder(
+            reinterpret_cast<const Args *>(payload + offsets[I]))...));
+  }(std::index_sequence_for<Args...>{});
+}
+
+// Rebuilds, on the backend thread, the same line log_impl_ would have
+// produced on the caller's thread.
+inline void format_deferred_line(std::string &out, TimestampCache &timestamps,
+                                 std::string_view thread_prefix,
+                                 const std::byte *payload) {
+  DeferredHeader hdr;
+  std::memcpy(&hdr, payload, sizeof(hdr));
+
+  out.clear();
+  if (int digits = timestamp_digits.load(std::memory_order_relaxed)) {
+    char stamp[TimestampCache::max_size];
+    out.append(stamp, timestamps.write(stamp, hdr.timestamp_ns, digits));
+  }
+  out += thread_prefix;
+  out.append(hdr.prefix, hdr.prefix_size);
+  hdr.format(out, {hdr.fmt, hdr.fmt_size}, payload);
+  out += StaticConfig::get().reset;
+}
+
+// One ring per thread that logged while async mode was on. Owned jointly by
+// the thread's Logger and the backend so either side may go away first.
+struct ThreadRing {
+  ThreadRing(size_t bytes, std::string_view prefix, uint32_t index)
+      : ring(bytes), thread_prefix(prefix), thread_index(index) {
+    ThreadNames::get().retain(thread_index);
+  }
+  ThreadRing(const ThreadRing &) = delete;
+  ThreadRing &operator=(const ThreadRing &) = delete;
+  ~ThreadRing() { ThreadNames::get().release(thread_index); }
+
+  SpscRing ring;
+  std::string thread_prefix; // needed to format deferred records
+  uint32_t thread_index;     // kept until binary records are drained
+  std::atomic<bool> retired{false};
+};
+} // namespace detail
+
+// Single consumer thread that drains every thread's ring into the LogSink.
+class AsyncBackend {
+public:
+  AsyncBackend(const AsyncBackend &) = delete;
+  AsyncBackend &operator=(const AsyncBackend &) = delete;
+
+  static AsyncBackend &get() {
+    static AsyncBackend instance;
+    return instance;
+  }
+
+  // Checked by every log call, so it is kept outside of the instance.
+  static bool active() { return active_.load(std::memory_order_acquire); }
+
+  static bool deferring() {
+    return deferring_.load(std::memory_order_acquire);
+  }
+
+  // True on the backend thread, which must not wait for its own ring to be
+  // drained: it logs through formatters of deferred arguments and sinks.
+  static bool on_backend_thread() { return on_backend_thread_; }
+
+  const AsyncOptions &options() const { return options_; }
+
+  void start(const AsyncOptions &opts) {
+    std::lock_guard lock(mtx_);
+    if (worker_.joinable())
+      return;
+    options_ = opts;
+    stop_ = false;
+    worker_ = std::thread([this] { run(); });
+    deferring_.store(opts.defer_formatting, std::memory_order_release);
+    active_.store(true, std::memory_order_release);
+  }
+
+  // Drains whatever is queued and joins the backend thread. Threads that are
+  // still logging while this runs may lose their last messages.
+  void stop() {
+    {
+      std::lock_guard lock(mtx_);
+      if (!worker_.joinable())
+        return;
+      active_.store(false, std::memory_order_release);
+      deferring_.store(false, std::memory_order_release);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    worker_.join();
+
+    // release anyone who asked for a flush after the final pass started
+    std::lock_guard lock(mtx_);
+    flush_done_ = flush_requested_;
+    flushed_.notify_all();
+  }
+
+  std::shared_ptr<detail::ThreadRing> attach(std::string_view thread_prefix,
+                                             uint32_t thread_index) {
+    auto ring = std::make_shared<detail::ThreadRing>(
+        options_.ring_bytes, thread_prefix, thread_index);
+    std::lock_guard lock(mtx_);
+    rings_.push_back(ring);
+    rings_version_.fetch_add(1, std::memory_order_release);
+    return ring;
+  }
+
+  // Blocks until everything logged before the call has been written and the
+  // sink has been flushed.
+  void flush() {
+    std::unique_lock lock(mtx_);
+    if (!worker_.joinable()) {
+      lock.unlock();
+      LogSink::get().flush();
+      return;
+    }
+    uint64_t ticket = ++flush_requested_;
+    wake_.notify_all();
+    flushed_.wait(lock, [&] { return flush_done_ >= ticket; });
+  }
+
+  void wake() { wake_.notify_one(); }
+
+  void count_drop() { dropped_.fetch_add(1, std::memory_order_relaxed); }
+
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+  // make sure the sink, and the names the rings release, outlive us
+  AsyncBackend() {
+    LogSink::get();
+    detail::ThreadNames::get();
+  }
+  ~AsyncBackend() { stop(); }
+
+  void run() {
+    on_backend_thread_ = true;
+    std::vector<std::shared_ptr<detail::ThreadRing>> rings;
+    uint64_t seen_version = ~uint64_t{0};
+
+    for (;;) {
+      uint64_t flush_ticket;
+      bool stopping;
+      {
+        std::lock_guard lock(mtx_);
+        flush_ticket = flush_requested_;
+        stopping = stop_;
+        if (rings_version_.load(std::memory_order_acquire) != seen_version) {
+          prune_locked();
+          rings = rings_;
+          seen_version = rings_version_.load(std::memory_order_relaxed);
+        }
+      }
+
+      size_t written = drain(rings);
+
+      if (flush_ticket != flush_done_ || stopping) {
+        LogSink::get().flush();
+        std::lock_guard lock(mtx_);
+        flush_done_ = flush_ticket;
+        flushed_.notify_all();
+      }
+
+      if (stopping)
+        return;
+
+      if (written == 0) {
+        // a burst followed by silence is not left in the file buffer
+        LogSink::get().flush_stale();
+        std::unique_lock lock(mtx_);
+        // retired rings are only pruned once they are drained
+        for (auto &r : rings) {
+          if (r->retired.load(std::memory_order_acquire) && r->ring.empty()) {
+            rings_version_.fetch_add(1, std::memory_order_relaxed);
+            break;
+          }
+        }
+        wake_.wait_for(lock, options_.poll_interval, [&] {
+          return stop_ || flush_requested_ != flush_ticket;
+        });
+      }
+    }
+  }
+
+  size_t drain(const std::vector<std::shared_ptr<detail::ThreadRing>> &rings) {
+    auto &sink = LogSink::get();
+    size_t written = 0;
+    bool batching = false;
+    for (auto &r : rings) {
+      if (r->ring.empty())
+        continue;
+      if (!batching) {
+        // the console lines of the whole pass go out in one write
+        sink.set_console_batching(true);
+        batching = true;
+      }
+      written += r->ring.drain(
+          [&](const SpscRing::Record &rec, const std::byte *payload) {
+            if (rec.kind == detail::RECORD_BINARY) {
+              sink.write_binary(payload, rec.size,
+                                rec.flags & detail::RECORD_FLUSH);
+              return;
+            }
+            std::string_view msg;
+            if (rec.kind == detail::RECORD_DEFERRED) {
+              detail::format_deferred_line(line_, timestamps_,
+                                           r->thread_prefix, payload);
+              msg = line_;
+            } else {
+              msg = {reinterpret_cast<const char *>(payload), rec.size};
+            }
+            auto level = static_cast<LogLevel>(
+                (rec.flags >> detail::RECORD_LEVEL_SHIFT) & 3);
+            sink.write(msg, level, rec.flags & detail::RECORD_FLUSH,
+                       rec.flags & detail::RECORD_STDERR);
+          });
+    }
+    if (batching)
+      sink.set_console_batching(false);
+    return written;
+  }
+
+  // must be called with mtx_ held
+  void prune_locked() {
+    std::erase_if(rings_, [](const auto &r) {
+      return r->retired.load(std::memory_order_acquire) && r->ring.empty();
+    });
+  }
+
+  inline static std::atomic<bool> active_{false};
+  inline static std::atomic<bool> deferring_{false};
+  inline static thread_local bool on_backend_thread_ = false;
+
+  AsyncOptions options_;
+  std::mutex mtx_;
+  std::condition_variable wake_;
+  std::condition_variable flushed_;
+  std::thread worker_;
+  bool stop_ = false;
+  uint64_t flush_requested_ = 0;
+  uint64_t flush_done_ = 0;
+  std::vector<std::shared_ptr<detail::ThreadRing>> rings_;
+  std::atomic<uint64_t> rings_version_{0};
+  std::atomic<uint64_t> dropped_{0};
+  std::string line_; // backend-only scratch for deferred records
+  detail::TimestampCache timestamps_;
+};
 
 class Logger {
 public:
@@ -176,169 +1797,174 @@ public:
   }
 
   static bool init_file(const std::filesystem::path &path,
-                        bool append = false) {
-    return LogSink::get().open(path, append);
+                        bool append = false,
+                        FileFormat format = FileFormat::TEXT) {
+    return init_file(path, FileOptions{.append = append, .format = format});
+  }
+
+  static bool init_file(const std::filesystem::path &path,
+                        const FileOptions &opts) {
+    return LogSink::get().open(path, opts);
   }
 
-  static void close_file() { LogSink::get().close(); }
+  // Size- and/or time-based rolling of the log file; see RotationOptions.
+  static bool set_rotation(const RotationOptions &opts) {
+    return LogSink::get().set_rotation(opts);
+  }
 
-  template <typename... Args>
+  // Console output can be switched off, e.g. when only a binary file is
+  // wanted: calls then skip text formatting altogether.
+  static void set_console(bool enabled) {
+    LogSink::get().set_console(enabled);
+  }
+
+  // Per-destination thresholds, applied after set_level.
+  static void set_console_level(LogLevel level) {
+    LogSink::get().set_console_level(level);
+  }
+  static void set_file_level(LogLevel level) {
+    LogSink::get().set_file_level(level);
+  }
+
+  // Extra destinations; each line is formatted once for all of them.
+  static void add_sink(std::shared_ptr<Sink> sink) {
+    LogSink::get().add_sink(std::move(sink));
+  }
+  static void remove_sink(const Sink *sink) {
+    LogSink::get().remove_sink(sink);
+  }
+
+  // Runtime threshold, on top of MUTILS_MIN_LOG_LEVEL. Filtered calls cost a
+  // single relaxed load and never format.
+  static void set_level(LogLevel level) {
+    threshold_.store(static_cast<int>(level), std::memory_order_relaxed);
+  }
+
+  // Prefixes text lines with the UTC time, e.g. "2024-05-01T12:00:00.123Z".
+  // Each thread formats the date once per second and then only patches in
+  // the sub-second digits, so the prefix costs about two memcpy calls.
+  static void set_timestamps(Timestamps precision) {
+    detail::timestamp_digits.store(static_cast<uint8_t>(precision),
+                                   std::memory_order_relaxed);
+  }
+
+  // Longest line buffer a thread keeps around between calls. Longer lines
+  // are still written in full; the buffer is just released afterwards.
+  static void set_buffer_cap(size_t bytes) {
+    buffer_cap_.store(bytes, std::memory_order_relaxed);
+  }
+
+  static LogLevel level() {
+    return static_cast<LogLevel>(threshold_.load(std::memory_order_relaxed));
+  }
+
+  static bool enabled(LogLevel level) {
+    return compiled_in(level) && static_cast<int>(level) >=
+                                     threshold_.load(std::memory_order_relaxed);
+  }
+
+  static void close_file() {
+    flush_all();
+    LogSink::get().close();
+  }
+
+  // Opt-in asynchronous mode: every thread formats into its own buffer as
+  // usual, then hands the message to a per-thread SPSC ring that a single
+  // backend thread drains to the console and the file.
+  static void start_async(const AsyncOptions &opts = {}) {
+    AsyncBackend::get().start(opts);
+  }
+
+  // Drains pending messages and goes back to synchronous writes.
+  static void stop_async() { AsyncBackend::get().stop(); }
+
+  // Barrier: returns once every message logged before the call has been
+  // written out and the file has been flushed. Cheap when async is off.
+  static void flush_all() { AsyncBackend::get().flush(); }
+
+  // Messages discarded under OverflowPolicy::DROP since startup.
+  static uint64_t dropped_count() { return AsyncBackend::get().dropped(); }
+
+  // Called by LOG_WCTX, which computes Context at compile time.
+  template <auto Context, typename... Args>
   inline void log_wctx(std::source_location loc,
                        std::format_string<Args...> fmt,
                        Args &&...fmt_args) const {
-    log_impl_(LogLevel::INFO, /*flush=*/false, /*use_stderr=*/false, loc, fmt,
-              std::forward<Args>(fmt_args)...);
+    if constexpr (compiled_in(LogLevel::INFO)) {
+      if (enabled(LogLevel::INFO))
+        log_impl_<LogLevel::INFO>(
+            detail::LinePrefix<LogLevel::INFO, Context>::get(config_.is_tty),
+            &loc, fmt, std::forward<Args>(fmt_args)...);
+    }
   }
 
   template <typename... Args>
   inline void log(std::format_string<Args...> fmt, Args &&...fmt_args) const {
-    log_impl_(LogLevel::INFO, /*flush=*/false, /*use_stderr=*/false, fmt,
-              std::forward<Args>(fmt_args)...);
+    log_level_<LogLevel::INFO>(fmt, std::forward<Args>(fmt_args)...);
   }
 
   template <typename... Args>
   inline void dbg(std::format_string<Args...> fmt, Args &&...fmt_args) const {
-    if constexpr (IS_DEBUG_BUILD) {
-      log_impl_(LogLevel::DEBUG, /*flush=*/false, /*use_stderr=*/false, fmt,
-                std::forward<Args>(fmt_args)...);
-    }
+    log_level_<LogLevel::DEBUG>(fmt, std::forward<Args>(fmt_args)...);
   }
 
   template <typename... Args>
   inline void err(std::format_string<Args...> fmt, Args &&...fmt_args) const {
-    log_impl_(LogLevel::ERR, /*flush=*/false, /*use_stderr=*/true, fmt,
-              std::forward<Args>(fmt_args)...);
+    log_level_<LogLevel::ERR>(fmt, std::forward<Args>(fmt_args)...);
   }
 
   template <typename... Args>
   inline void warn(std::format_string<Args...> fmt, Args &&...fmt_args) const {
-    log_impl_(LogLevel::WARN, /*flush=*/false, /*use_stderr=*/true, fmt,
-              std::forward<Args>(fmt_args)...);
+    log_level_<LogLevel::WARN>(fmt, std::forward<Args>(fmt_args)...);
   }
 
-  inline static void print_build_info() {
-    static_write("=== Build Information ===", /*flush=*/true);
-    // Build type
-    if constexpr (IS_DEBUG_BUILD) {
-      static_write("Build Type: DEBUG", /*flush=*/true);
-    } else {
-      static_write("Build Type: RELEASE", /*flush=*/true);
-    }
-    // Compiler information
-#if defined(__clang__)
-    static_write("Compiler: Clang " STRINGIFY(__clang_major__) "." STRINGIFY(
-                     __clang_minor__) "." STRINGIFY(__clang_patchlevel__),
-                 /*flush=*/true);
-#elif defined(__GNUC__) || defined(__GNUG__)
-    static_write("Compiler: GCC " STRINGIFY(__GNUC__) "." STRINGIFY(
-                     __GNUC_MINOR__) "." STRINGIFY(__GNUC_PATCHLEVEL__),
-                 /*flush=*/true);
-#elif defined(_MSC_VER)
-    static_write("Compiler: MSVC " STRINGIFY(_MSC_VER), /*flush=*/true);
-#else
-    static_write("Compiler: Unknown", /*flush=*/true);
-#endif
-    // C++ Standard
-#if __cplusplus == 202302L
-    static_write("C++ Standard: C++23", /*flush=*/true);
-#elif __cplusplus == 202002L
-    static_write("C++ Standard: C++20", /*flush=*/true);
-#elif __cplusplus == 201703L
-    static_write("C++ Standard: C++17", /*flush=*/true);
-#elif __cplusplus == 201402L
-    static_write("C++ Standard: C++14", /*flush=*/true);
-#elif __cplusplus == 201103L
-    static_write("C++ Standard: C++11", /*flush=*/true);
-#else
-    static_write(
-        "C++ Standard: Pre-C++11 or unknown (" STRINGIFY(__cplusplus) ")",
-        /*flush=*/true);
-#endif
-    // Platform
-#if defined(_WIN32) || defined(_WIN64)
-#ifdef _WIN64
-    static_write("Platform: Windows (64-bit)", /*flush=*/true);
-#else
-    static_write("Platform: Windows (32-bit)", /*flush=*/true);
-#endif
-#elif defined(__APPLE__) || defined(__MACH__)
-    static_write("Platform: macOS", /*flush=*/true);
-#elif defined(__linux__)
-    static_write("Platform: Linux", /*flush=*/true);
-#elif defined(__unix__)
-    static_write("Platform: Unix", /*flush=*/true);
-#elif defined(__FreeBSD__)
-    static_write("Platform: FreeBSD", /*flush=*/true);
-#else
-    static_write("Platform: Unknown", /*flush=*/true);
-#endif
-    // Architecture
-#if defined(__x86_64__) || defined(_M_X64)
-    static_write("Architecture: x86_64", /*flush=*/true);
-#elif defined(__i386__) || defined(_M_IX86)
-    static_write("Architecture: x86", /*flush=*/true);
-#elif defined(__aarch64__) || defined(_M_ARM64)
-    static_write("Architecture: ARM64", /*flush=*/true);
-#elif defined(__arm__) || defined(_M_ARM)
-    static_write("Architecture: ARM", /*flush=*/true);
-#else
-    static_write("Architecture: Unknown", /*flush=*/true);
-#endif
-    // Optimizations
-#if defined(__OPTIMIZE__)
-#if defined(__OPTIMIZE_SIZE__)
-    static_write("Optimizations: Enabled (Size)", /*flush=*/true);
-#else
-    static_write("Optimizations: Enabled", /*flush=*/true);
-#endif
-#else
-    static_write("Optimizations: Disabled", /*flush=*/true);
-#endif
-    // Assertions
-#ifdef NDEBUG
-    static_write("Assertions: Disabled", /*flush=*/true);
-#else
-    static_write("Assertions: Enabled", /*flush=*/true);
-#endif
-    // Additional compiler flags
-    static_write("Additional Features:", /*flush=*/true);
-#ifdef __SSE__
-    static_write("  - SSE: Enabled", /*flush=*/true);
-#endif
-#ifdef __SSE2__
-    static_write("  - SSE2: Enabled", /*flush=*/true);
-#endif
-#ifdef __AVX__
-    static_write("  - AVX: Enabled", /*flush=*/true);
-#endif
-#ifdef __AVX2__
-    static_write("  - AVX2: Enabled", /*flush=*/true);
-#endif
-#ifdef _OPENMP
-    static_write("  - OpenMP: Enabled", /*flush=*/true);
-#endif
-#ifdef __cpp_exceptions
-    static_write("  - Exceptions: Enabled", /*flush=*/true);
-#else
-    static_write("  - Exceptions: Disabled", /*flush=*/true);
-#endif
-#ifdef __cpp_rtti
-    static_write("  - RTTI: Enabled", /*flush=*/true);
-#else
-    static_write("  - RTTI: Disabled", /*flush=*/true);
-#endif
-    // Compile time and date
-    static_write("Compiled: " __DATE__ " at " __TIME__, /*flush=*/true);
-    static_write("=========================", /*flush=*/true);
+  // Built into the library in MUTILS_COMPILED mode, so the build it
+  // describes is the library's rather than the caller's.
+  static void print_build_info();
+
+  // The id printed in this thread's "[THREAD ...]" prefix.
+  std::string_view thread_id() const { return thread_id_str_; }
+
+  // Replaces the calling thread's id in its prefix with `name`, e.g. a
+  // worker index. `color` picks the prefix color, so consecutive workers
+  // can get distinct ones; by default it is derived from the name.
+  static void set_thread_name(std::string_view name) {
+    set_thread_name(name, std::hash<std::string_view>{}(name));
+  }
+
+  static void set_thread_name(std::string_view name, size_t color) {
+    auto &self = get();
+    // room for the color and the "[THREAD " ... "] " around the name
+    self.thread_id_str_ = name.substr(0, self.thread_prefix_buf.size() - 32);
+    self.build_prefix_(compute_thread_color(color));
+    auto &names = detail::ThreadNames::get();
+    auto old_index = self.name_id_.index;
+    self.name_id_ = names.acquire(self.thread_id_str_);
+    names.release(old_index);
+    // the async backend keeps a copy of the old prefix
+    if (self.ring_) {
+      self.ring_->retired.store(true, std::memory_order_release);
+      self.ring_.reset();
+    }
+  }
+
+  ~Logger() {
+    if (ring_)
+      ring_->retired.store(true, std::memory_order_release);
+    detail::ThreadNames::get().release(name_id_.index);
   }
 
 private:
-  Logger() : thread_id_(std::this_thread::get_id()) {
-    std::ostringstream oss;
-    oss << thread_id_;
-    std::string thread_id_str_ = oss.str();
+  Logger()
+      : thread_id_(std::this_thread::get_id()),
+        thread_id_str_(detail::current_thread_id()) {
+    build_prefix_(compute_thread_color(
+        std::hash<std::thread::id>{}(thread_id_)));
+    name_id_ = detail::ThreadNames::get().acquire(thread_id_str_);
+    buf_ = std::make_unique_for_overwrite<char[]>(initial_buffer_size);
+  }
 
-    auto thread_color = compute_thread_color();
+  void build_prefix_(std::string_view thread_color) {
     auto base = thread_prefix_buf.data();
     size_t offset = 0;
 
@@ -361,142 +1987,250 @@ private:
     thread_prefix_ = std::string_view(base, offset);
   }
 
-  void write_thread_() const {
-    std::memcpy(buf_.data() + buf_offset_, thread_prefix_.data(),
-                thread_prefix_.size());
-    buf_offset_ += thread_prefix_.size();
+  void write_timestamp_() const {
+    if (int digits = detail::timestamp_digits.load(std::memory_order_relaxed))
+      buf_offset_ += timestamps_.write(buf_.get() + buf_offset_,
+                                       detail::wall_clock_ns(), digits);
   }
 
-  void write_level_(const LogLevel level) const {
-    std::string_view color, label;
-
-    switch (level) {
-    case LogLevel::DEBUG:
-      color = config_.log_color;
-      label = debug_label_;
-      break;
-    case LogLevel::INFO:
-      color = config_.log_color;
-      label = log_label_;
-      break;
-    case LogLevel::WARN:
-      color = config_.warn_color;
-      label = warn_label_;
-      break;
-    case LogLevel::ERR:
-      color = config_.error_color;
-      label = err_label_;
-      break;
-    }
-
-    std::memcpy(buf_.data() + buf_offset_, color.data(), color.size());
-    buf_offset_ += color.size();
+  void write_thread_() const { append_(thread_prefix_); }
 
-    std::memcpy(buf_.data() + buf_offset_, label.data(), label.size());
-    buf_offset_ += label.size();
+  void append_(std::string_view s) const {
+    if (buf_offset_ + s.size() > buf_size_)
+      grow_buffer_(buf_offset_ + s.size());
+    std::memcpy(buf_.get() + buf_offset_, s.data(), s.size());
+    buf_offset_ += s.size();
   }
 
-  void write_context_tag(const std::source_location &loc) const {
-    auto ctx = extract_context(loc.function_name(), 4);
-    if (ctx.empty())
-      return;
+  // Grows geometrically, keeping the part of the line written so far.
+  void grow_buffer_(size_t needed) const {
+    size_t size = std::max(buf_size_ * 2, std::bit_ceil(needed));
+    auto grown = std::make_unique_for_overwrite<char[]>(size);
+    std::memcpy(grown.get(), buf_.get(), buf_offset_);
+    buf_ = std::move(grown);
+    buf_size_ = size;
+  }
 
-    memcpy(buf_.data() + buf_offset_, "[", 1);
-    buf_offset_ += 1;
-    memcpy(buf_.data() + buf_offset_, ctx.data(), ctx.size());
-    buf_offset_ += ctx.size();
-    memcpy(buf_.data() + buf_offset_, "] ", 2);
-    buf_offset_ += 2;
+  // Gives back the memory of an unusually long line once it is written.
+  void trim_buffer_() const {
+    if (buf_size_ > initial_buffer_size &&
+        buf_size_ > buffer_cap_.load(std::memory_order_relaxed)) {
+      buf_ = std::make_unique_for_overwrite<char[]>(initial_buffer_size);
+      buf_size_ = initial_buffer_size;
+    }
   }
 
-  void write(const std::string_view msg, bool flush,
+  void write(const std::string_view msg, LogLevel level, bool flush,
              bool use_stderr = false) const {
-    auto &sink = LogSink::get();
-    std::lock_guard lock(sink.mtx);
+    if (AsyncBackend::active() && write_async_(msg, level, flush, use_stderr))
+      return;
 
-    auto &stream = use_stderr ? std::cerr : std::cout;
-    stream << msg << '\n';
+    LogSink::get().write(msg, level, flush, use_stderr);
+  }
 
-    if (sink.file.is_open()) {
-      sink.write_to_file(msg);
-      if (flush)
-        sink.file.flush();
-    }
+  bool write_async_(const std::string_view msg, LogLevel level, bool flush,
+                    bool use_stderr) const {
+    return push_async_(msg.size(), detail::RECORD_TEXT, level, flush,
+                       use_stderr, [&](std::byte *dst) {
+                         std::memcpy(dst, msg.data(), msg.size());
+                       });
   }
 
+  // Copies the raw arguments into the ring instead of formatting them.
   template <typename... Args>
-  inline void log_impl_(LogLevel level, bool flush, bool use_stderr,
-                        std::format_string<Args...> fmt, Args &&...args) const {
-    buf_offset_ = 0;
-    write_thread_();
-    write_level_(level);
+  bool defer_(LogLevel level, bool flush, bool use_stderr,
+              std::string_view prefix, std::string_view fmt,
+              const Args &...args) const {
+    static constexpr auto offsets = detail::deferred_offsets<Args...>();
+    return push_async_(
+        offsets.back(), detail::RECORD_DEFERRED, level, flush, use_stderr,
+        [&](std::byte *dst) {
+          detail::DeferredHeader hdr{
+              &detail::format_deferred<Args...>,
+              fmt.data(),
+              fmt.size(),
+              prefix.data(),
+              prefix.size(),
+              detail::wall_clock_ns(),
+              level,
+          };
+          std::memcpy(dst, &hdr, sizeof(hdr));
+          size_t i = 0;
+          ((std::memcpy(dst + offsets[i++], &args, sizeof(Args))), ...);
+        });
+  }
 
-    auto res =
-        std::format_to_n(buf_.data() + buf_offset_, buf_.size() - buf_offset_,
-                         fmt, std::forward<Args>(args)...);
+  // FileFormat::BINARY: encodes the arguments instead of formatting them,
+  // or stores the formatted text if some argument has no binary encoding.
+  template <typename... Args>
+  void write_binary_(LogLevel level, bool flush, bool use_stderr,
+                     const std::source_location *loc,
+                     std::format_string<Args...> fmt,
+                     const Args &...args) const {
+    auto &out = binary_buf_;
+    out.resize(sizeof(detail::BinaryHeader));
+    std::string_view f = fmt.get();
+    if constexpr ((binlog::Encodable<std::remove_cvref_t<Args>> && ...)) {
+      (binlog::encode_arg(out, args), ...);
+    } else {
+      binlog::encode_arg(out, std::vformat(f, std::make_format_args(args...)));
+      f = "{}";
+    }
+    detail::BinaryHeader hdr{
+        f.data(),
+        f.size(),
+        loc ? loc->function_name() : nullptr,
+        detail::wall_clock_ns(),
+        name_id_.index,
+        name_id_.generation,
+        static_cast<uint8_t>(level),
+        false,
+    };
+    std::memcpy(out.data(), &hdr, sizeof(hdr));
+    write_binary_record_(level, flush, use_stderr);
+  }
 
-    ptrdiff_t remaining_space =
-        buf_.size() - (buf_offset_ + res.size + 1 + config_.reset.size());
+  void write_binary_text_(std::string_view msg, bool flush,
+                          bool use_stderr) const {
+    auto &out = binary_buf_;
+    out.resize(sizeof(detail::BinaryHeader));
+    out += msg;
+    detail::BinaryHeader hdr{nullptr,
+                             0,
+                             nullptr,
+                             detail::wall_clock_ns(),
+                             name_id_.index,
+                             name_id_.generation,
+                             0,
+                             true};
+    std::memcpy(out.data(), &hdr, sizeof(hdr));
+    write_binary_record_(LogLevel::INFO, flush, use_stderr);
+  }
 
-    if (remaining_space < 0) {
-      auto body = std::format(fmt, std::forward<Args>(args)...);
-      auto msg = std::string(std::string_view(buf_.data(), buf_offset_)) +
-                 body + std::string(config_.reset);
-      write(msg, /*flush=*/false);
+  void write_binary_record_(LogLevel level, bool flush,
+                            bool use_stderr) const {
+    const auto &out = binary_buf_;
+    if (AsyncBackend::active() &&
+        push_async_(out.size(), detail::RECORD_BINARY, level, flush,
+                    use_stderr, [&](std::byte *dst) {
+                      std::memcpy(dst, out.data(), out.size());
+                    }))
       return;
-    }
 
-    char *end = res.out;
+    LogSink::get().write_binary(
+        reinterpret_cast<const std::byte *>(out.data()), out.size(), flush);
+  }
 
-    std::memcpy(end, config_.reset.data(), config_.reset.size());
-    end += config_.reset.size();
-    *end = '\0';
+  // Returns false if the message still has to be written synchronously.
+  template <typename Fill>
+  bool push_async_(size_t size, uint16_t kind, LogLevel level, bool flush,
+                   bool use_stderr, Fill &&fill) const {
+    auto &backend = AsyncBackend::get();
+    if (!ring_)
+      ring_ = backend.attach(thread_prefix_, name_id_.index);
+
+    auto &ring = ring_->ring;
+    if (size > ring.max_payload())
+      return false;
+
+    uint16_t flags =
+        (flush ? detail::RECORD_FLUSH : 0) |
+        (use_stderr ? detail::RECORD_STDERR : 0) |
+        (static_cast<uint16_t>(level) << detail::RECORD_LEVEL_SHIFT);
+
+    std::byte *dst;
+    while (!(dst = ring.reserve(size))) {
+      switch (backend.options().overflow) {
+      case OverflowPolicy::DROP:
+        backend.count_drop();
+        return true;
+      case OverflowPolicy::SYNC:
+        return false;
+      case OverflowPolicy::BLOCK:
+        if (!AsyncBackend::active() || AsyncBackend::on_backend_thread())
+          return false;
+        backend.wake();
+        std::this_thread::yield();
+        break;
+      }
+    }
+    fill(dst);
+    ring.commit(size, kind, flags);
+    return true;
+  }
 
-    write(std::string_view{buf_.data(), end}, flush, use_stderr);
+  template <LogLevel Level, typename... Args>
+  inline void log_level_(std::format_string<Args...> fmt,
+                         Args &&...args) const {
+    if constexpr (compiled_in(Level)) {
+      if (enabled(Level))
+        log_impl_<Level>(detail::LinePrefix<Level>::get(config_.is_tty),
+                         nullptr, fmt, std::forward<Args>(args)...);
+    }
   }
 
-  // log with location overload
-  template <typename... Args>
-  inline void log_impl_(LogLevel level, bool flush, bool use_stderr,
-                        const std::source_location &loc,
+  // `prefix` is the LinePrefix for Level; `loc` is only kept for the binary
+  // format, which stores the function name itself.
+  template <LogLevel Level, typename... Args>
+  inline void log_impl_(std::string_view prefix,
+                        const std::source_location *loc,
                         std::format_string<Args...> fmt, Args &&...args) const {
-    buf_offset_ = 0;
-    write_thread_();
-    write_context_tag(loc);
-    write_level_(level);
-
-    auto res =
-        std::format_to_n(buf_.data() + buf_offset_, buf_.size() - buf_offset_,
-                         fmt, std::forward<Args>(args)...);
-
-    ptrdiff_t remaining_space =
-        buf_.size() - (buf_offset_ + res.size + 1 + config_.reset.size());
+    constexpr bool flush = false;
+    constexpr bool use_stderr = Level >= LogLevel::WARN;
+    if (LogSink::get().binary()) {
+      write_binary_<Args...>(Level, flush, use_stderr, loc, fmt, args...);
+      if (!LogSink::get().wants_text())
+        return;
+    }
 
-    if (remaining_space < 0) {
-      auto body = std::format(fmt, std::forward<Args>(args)...);
-      auto msg = std::string(std::string_view(buf_.data(), buf_offset_)) +
-                 body + std::string(config_.reset);
-      write(msg, /*flush=*/false);
-      return;
+    if constexpr ((is_deferrable_v<std::remove_cvref_t<Args>> && ...)) {
+      if (AsyncBackend::deferring() &&
+          defer_<std::remove_cvref_t<Args>...>(Level, flush, use_stderr,
+                                               prefix, fmt.get(), args...))
+        return;
     }
 
-    char *end = res.out;
+    buf_offset_ = 0;
+    write_timestamp_();
+    write_thread_();
+    append_(prefix);
+
+    // Formats once, unless this thread never had a line this long before:
+    // then the buffer grows to fit and the line is formatted again.
+    size_t room = buf_size_ - buf_offset_;
+    // Formatting only reads the arguments, so forwarding twice is fine.
+    size_t size = static_cast<size_t>(
+        std::format_to_n(buf_.get() + buf_offset_, room, fmt,
+                         std::forward<Args>(args)...)
+            .size);
+    if (size + config_.reset.size() > room) {
+      grow_buffer_(buf_offset_ + size + config_.reset.size());
+      std::format_to_n(buf_.get() + buf_offset_, size, fmt,
+                       std::forward<Args>(args)...);
+    }
+    buf_offset_ += size;
 
-    std::memcpy(end, config_.reset.data(), config_.reset.size());
-    end += config_.reset.size();
-    *end = '\0';
+    std::memcpy(buf_.get() + buf_offset_, config_.reset.data(),
+                config_.reset.size());
+    buf_offset_ += config_.reset.size();
 
-    write(std::string_view{buf_.data(), end}, flush, use_stderr);
+    write(std::string_view{buf_.get(), buf_offset_}, Level, flush,
+          use_stderr);
+    trim_buffer_();
   }
 
   static void static_write(const std::string_view msg, bool flush,
                            bool use_stderr = false) {
-    get().write(msg, flush, use_stderr);
+    auto &self = get();
+    if (LogSink::get().binary()) {
+      self.write_binary_text_(msg, flush, use_stderr);
+      if (!LogSink::get().wants_text())
+        return;
+    }
+    self.write(msg, LogLevel::INFO, flush, use_stderr);
   }
 
-  const std::string_view compute_thread_color() const {
-    size_t hash = std::hash<std::thread::id>{}(thread_id_);
-
+  static std::string_view compute_thread_color(size_t index) {
     static constexpr std::string_view colors[] = {
         "\033[96m", // Bright Cyan
         "\033[95m", // Bright Magenta
@@ -509,7 +2243,7 @@ private:
         "\033[34m", // Blue
     };
 
-    return colors[hash % 9];
+    return colors[index % 9];
   }
 
   static constexpr bool IS_DEBUG_BUILD =
@@ -519,15 +2253,29 @@ private:
       true;
 #endif
 
-  mutable std::array<char, 512> buf_;
+  inline static std::atomic<int> threshold_{MUTILS_LOG_LEVEL_DEBUG};
+
+  static constexpr size_t initial_buffer_size = 512;
+  inline static std::atomic<size_t> buffer_cap_{64 * 1024};
+
+  // Lines are formatted straight into this buffer, which grows as needed
+  // and is reused by the thread's next calls. It always has room for the
+  // timestamp, which is written first.
+  mutable std::unique_ptr<char[]> buf_;
+  mutable size_t buf_size_ = initial_buffer_size;
   mutable size_t buf_offset_ = 0;
+  mutable detail::TimestampCache timestamps_;
   std::thread::id thread_id_;
+  std::string thread_id_str_;
+  detail::ThreadNames::Id name_id_{}; // of thread_id_str_ in ThreadNames
+  mutable std::string binary_buf_;
   std::array<char, 128> thread_prefix_buf;
   std::string_view thread_prefix_;
-  std::string_view log_label_ = "[LOG]: ";
-  std::string_view err_label_ = "[ERROR]: ";
-  std::string_view warn_label_ = "[WARN]: ";
-  std::string_view debug_label_ = "[DEBUG]: ";
+  mutable std::shared_ptr<detail::ThreadRing> ring_;
   const StaticConfig &config_ = StaticConfig::get();
 }; // namespace myproj
 } // namespace mutils
+
+#ifndef MUTILS_COMPILED_LIB
+#include "logger_impl.hpp"
+#endif
@@ -0,0 +1,160 @@
+#pragma once
+
+// Out-of-line parts of logger.hpp: included at its end, or compiled once
+// into the library by src/mutils.cpp when MUTILS_COMPILED_LIB is defined.
+#include "logger.hpp"
+
+#ifdef MUTILS_HAS_ZLIB
+#include <zlib.h>
+#endif
+
+namespace mutils {
+namespace detail {
+MUTILS_INLINE bool gzip_file(const std::filesystem::path &path) {
+#ifdef MUTILS_HAS_ZLIB
+  auto gz_path = path;
+  gz_path += ".gz";
+  std::FILE *in = std::fopen(path.string().c_str(), "rb");
+  if (!in)
+    return false;
+  gzFile out = gzopen(gz_path.string().c_str(), "wb");
+  bool ok = out != nullptr;
+  std::array<char, 64 * 1024> chunk;
+  while (ok) {
+    size_t n = std::fread(chunk.data(), 1, chunk.size(), in);
+    if (n == 0) {
+      ok = !std::ferror(in);
+      break;
+    }
+    ok = gzwrite(out, chunk.data(), static_cast<unsigned>(n)) ==
+         static_cast<int>(n);
+  }
+  std::fclose(in);
+  if (out && gzclose(out) != Z_OK)
+    ok = false;
+  std::error_code ec;
+  std::filesystem::remove(ok ? path : gz_path, ec);
+  return ok;
+#else
+  (void)path;
+  return false;
+#endif
+}
+} // namespace detail
+
+MUTILS_INLINE void Logger::print_build_info() {
+  static_write("=== Build Information ===", /*flush=*/true);
+  // Build type
+  if constexpr (IS_DEBUG_BUILD) {
+    static_write("Build Type: DEBUG", /*flush=*/true);
+  } else {
+    static_write("Build Type: RELEASE", /*flush=*/true);
+  }
+  // Compiler information
+#if defined(__clang__)
+  static_write("Compiler: Clang " STRINGIFY(__clang_major__) "." STRINGIFY(
+                   __clang_minor__) "." STRINGIFY(__clang_patchlevel__),
+               /*flush=*/true);
+#elif defined(__GNUC__) || defined(__GNUG__)
+  static_write("Compiler: GCC " STRINGIFY(__GNUC__) "." STRINGIFY(
+                   __GNUC_MINOR__) "." STRINGIFY(__GNUC_PATCHLEVEL__),
+               /*flush=*/true);
+#elif defined(_MSC_VER)
+  static_write("Compiler: MSVC " STRINGIFY(_MSC_VER), /*flush=*/true);
+#else
+  static_write("Compiler: Unknown", /*flush=*/true);
+#endif
+  // C++ Standard
+#if __cplusplus == 202302L
+  static_write("C++ Standard: C++23", /*flush=*/true);
+#elif __cplusplus == 202002L
+  static_write("C++ Standard: C++20", /*flush=*/true);
+#elif __cplusplus == 201703L
+  static_write("C++ Standard: C++17", /*flush=*/true);
+#elif __cplusplus == 201402L
+  static_write("C++ Standard: C++14", /*flush=*/true);
+#elif __cplusplus == 201103L
+  static_write("C++ Standard: C++11", /*flush=*/true);
+#else
+  static_write(
+      "C++ Standard: Pre-C++11 or unknown (" STRINGIFY(__cplusplus) ")",
+      /*flush=*/true);
+#endif
+  // Platform
+#if defined(_WIN32) || defined(_WIN64)
+#ifdef _WIN64
+  static_write("Platform: Windows (64-bit)", /*flush=*/true);
+#else
+  static_write("Platform: Windows (32-bit)", /*flush=*/true);
+#endif
+#elif defined(__APPLE__) || defined(__MACH__)
+  static_write("Platform: macOS", /*flush=*/true);
+#elif defined(__linux__)
+  static_write("Platform: Linux", /*flush=*/true);
+#elif defined(__unix__)
+  static_write("Platform: Unix", /*flush=*/true);
+#elif defined(__FreeBSD__)
+  static_write("Platform: FreeBSD", /*flush=*/true);
+#else
+  static_write("Platform: Unknown", /*flush=*/true);
+#endif
+  // Architecture
+#if defined(__x86_64__) || defined(_M_X64)
+  static_write("Architecture: x86_64", /*flush=*/true);
+#elif defined(__i386__) || defined(_M_IX86)
+  static_write("Architecture: x86", /*flush=*/true);
+#elif defined(__aarch64__) || defined(_M_ARM64)
+  static_write("Architecture: ARM64", /*flush=*/true);
+#elif defined(__arm__) || defined(_M_ARM)
+  static_write("Architecture: ARM", /*flush=*/true);
+#else
+  static_write("Architecture: Unknown", /*flush=*/true);
+#endif
+  // Optimizations
+#if defined(__OPTIMIZE__)
+#if defined(__OPTIMIZE_SIZE__)
+  static_write("Optimizations: Enabled (Size)", /*flush=*/true);
+#else
+  static_write("Optimizations: Enabled", /*flush=*/true);
+#endif
+#else
+  static_write("Optimizations: Disabled", /*flush=*/true);
+#endif
+  // Assertions
+#ifdef NDEBUG
+  static_write("Assertions: Disabled", /*flush=*/true);
+#else
+  static_write("Assertions: Enabled", /*flush=*/true);
+#endif
+  // Additional compiler flags
+  static_write("Additional Features:", /*flush=*/true);
+#ifdef __SSE__
+  static_write("  - SSE: Enabled", /*flush=*/true);
+#endif
+#ifdef __SSE2__
+  static_write("  - SSE2: Enabled", /*flush=*/true);
+#endif
+#ifdef __AVX__
+  static_write("  - AVX: Enabled", /*flush=*/true);
+#endif
+#ifdef __AVX2__
+  static_write("  - AVX2: Enabled", /*flush=*/true);
+#endif
+#ifdef _OPENMP
+  static_write("  - OpenMP: Enabled", /*flush=*/true);
+#endif
+#ifdef __cpp_exceptions
+  static_write("  - Exceptions: Enabled", /*flush=*/true);
+#else
+  static_write("  - Exceptions: Disabled", /*flush=*/true);
+#endif
+#ifdef __cpp_rtti
+  static_write("  - RTTI: Enabled", /*flush=*/true);
+#else
+  static_write("  - RTTI: Disabled", /*flush=*/true);
+#endif
+  // Compile time and date
+  static_write("Compiled: " __DATE__ " at " __TIME__, /*flush=*/true);
+  static_write("=========================", /*flush=*/true);
+}
+} // namespace mutils
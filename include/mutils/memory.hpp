@@ -0,0 +1,260 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+#include <utility>
+
+namespace mutils {
+// Bump allocator for request-scoped data: allocating moves a pointer, and
+// everything is given back at once by reset() or rewind(), while the blocks
+// are kept for the next request. Single-threaded; deallocate() only reclaims
+// the most recent allocation. Usable wherever a std::pmr::memory_resource is.
+class Arena : public std::pmr::memory_resource {
+public:
+  struct Marker {
+    void *block;
+    char *ptr;
+  };
+
+  explicit Arena(size_t block_size = 64 * 1024,
+                 std::pmr::memory_resource *upstream =
+                     std::pmr::get_default_resource())
+      : upstream_(upstream), block_size_(std::max<size_t>(block_size, 256)) {}
+
+  // Starts out in `buffer` (e.g. on the stack) and only goes upstream once
+  // it is full. The buffer must outlive the arena.
+  Arena(void *buffer, size_t size, size_t block_size = 64 * 1024,
+        std::pmr::memory_resource *upstream = std::pmr::get_default_resource())
+      : Arena(block_size, upstream) {
+    if (size > sizeof(Block) + alignof(Block)) {
+      char *at = align_up(static_cast<char *>(buffer), alignof(Block));
+      size -= static_cast<size_t>(at - static_cast<char *>(buffer));
+      first_ = current_ = new (at) Block{nullptr, size, false};
+      ptr_ = current_->data();
+    }
+  }
+
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  ~Arena() override { release(); }
+
+  Marker mark() const { return {current_, ptr_}; }
+
+  // Frees everything allocated after mark() returned `m`.
+  void rewind(Marker m) {
+    current_ = static_cast<Block *>(m.block);
+    ptr_ = m.ptr;
+    if (!current_ && first_) {
+      current_ = first_;
+      ptr_ = first_->data();
+    }
+  }
+
+  // Frees everything, keeping the blocks for reuse.
+  void reset() {
+    current_ = first_;
+    ptr_ = first_ ? first_->data() : nullptr;
+  }
+
+  // Frees everything and returns the blocks upstream.
+  void release() {
+    // only the caller's buffer, which is always first, is kept
+    Block *kept = first_ && !first_->owned ? first_ : nullptr;
+    for (Block *b = kept ? kept->next : first_; b;) {
+      Block *next = b->next;
+      upstream_->deallocate(b, b->size, alignof(Block));
+      b = next;
+    }
+    first_ = kept;
+    if (kept)
+      kept->next = nullptr;
+    reset();
+  }
+
+  // Bytes handed out since the last reset, counting alignment padding.
+  size_t used() const {
+    size_t total = 0;
+    for (Block *b = first_; b; b = b->next) {
+      if (b == current_)
+        return total + static_cast<size_t>(ptr_ - b->data());
+      total += b->capacity();
+    }
+    return total;
+  }
+
+private:
+  struct alignas(std::max_align_t) Block {
+    Block *next;
+    size_t size; // including this header
+    bool owned;  // false for the caller's initial buffer
+
+    char *data() { return reinterpret_cast<char *>(this + 1); }
+    char *end() { return reinterpret_cast<char *>(this) + size; }
+    size_t capacity() const { return size - sizeof(Block); }
+  };
+
+  static char *align_up(char *p, size_t alignment) {
+    auto v = reinterpret_cast<uintptr_t>(p);
+    return p + ((alignment - v % alignment) % alignment);
+  }
+
+  void *do_allocate(size_t bytes, size_t alignment) override {
+    if (current_) {
+      char *p = align_up(ptr_, alignment);
+      if (p <= current_->end() &&
+          bytes <= static_cast<size_t>(current_->end() - p)) {
+        ptr_ = p + bytes;
+        return p;
+      }
+    }
+    next_block(bytes + alignment);
+    char *p = align_up(ptr_, alignment);
+    ptr_ = p + bytes;
+    return p;
+  }
+
+  void do_deallocate(void *p, size_t bytes, size_t) override {
+    // undo a last allocation, e.g. a vector growing in place
+    if (static_cast<char *>(p) + bytes == ptr_)
+      ptr_ = static_cast<char *>(p);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource &other) const
+      noexcept override {
+    return this == &other;
+  }
+
+  // Moves on to a block with room for `bytes`: the next kept one if it is
+  // large enough, otherwise a new one linked in after the current block.
+  void next_block(size_t bytes) {
+    Block *next = current_ ? current_->next : first_;
+    if (!next || next->capacity() < bytes) {
+      size_t size = std::max(block_size_, bytes + sizeof(Block));
+      auto *b = new (upstream_->allocate(size, alignof(Block)))
+          Block{next, size, true};
+      (current_ ? current_->next : first_) = b;
+      next = b;
+      // later requests are likely as large, so grow the default
+      block_size_ = std::min(block_size_ * 2, max_block_size);
+    }
+    current_ = next;
+    ptr_ = next->data();
+  }
+
+  static constexpr size_t max_block_size = 16 * 1024 * 1024;
+
+  std::pmr::memory_resource *upstream_;
+  size_t block_size_;
+  Block *first_ = nullptr;
+  Block *current_ = nullptr;
+  char *ptr_ = nullptr;
+};
+
+// Rewinds the arena to where it was when the scope was entered.
+class ArenaScope {
+public:
+  explicit ArenaScope(Arena &arena) : arena_(arena), mark_(arena.mark()) {}
+  ~ArenaScope() { arena_.rewind(mark_); }
+  ArenaScope(const ArenaScope &) = delete;
+  ArenaScope &operator=(const ArenaScope &) = delete;
+
+private:
+  Arena &arena_;
+  Arena::Marker mark_;
+};
+
+// Free list of equally sized slots carved out of larger slabs, for objects
+// that are created and destroyed one at a time (nodes, sessions...). Larger
+// or over-aligned requests go upstream. Not thread-safe: use one per thread,
+// e.g. through local(), and free on the thread that allocated.
+template <size_t SlotSize, size_t SlotsPerSlab = 256>
+class ObjectPool : public std::pmr::memory_resource {
+  static_assert(SlotSize > 0 && SlotsPerSlab > 0);
+
+public:
+  static constexpr size_t slot_size =
+      (std::max(SlotSize, sizeof(void *)) + alignof(std::max_align_t) - 1) /
+      alignof(std::max_align_t) * alignof(std::max_align_t);
+
+  explicit ObjectPool(std::pmr::memory_resource *upstream =
+                          std::pmr::get_default_resource())
+      : upstream_(upstream) {}
+
+  ObjectPool(const ObjectPool &) = delete;
+  ObjectPool &operator=(const ObjectPool &) = delete;
+
+  ~ObjectPool() override {
+    while (slabs_) {
+      Slab *next = slabs_->next;
+      upstream_->deallocate(slabs_, slab_bytes, alignof(std::max_align_t));
+      slabs_ = next;
+    }
+  }
+
+  // This thread's pool for SlotSize objects.
+  static ObjectPool &local() {
+    thread_local ObjectPool pool;
+    return pool;
+  }
+
+private:
+  struct FreeSlot {
+    FreeSlot *next;
+  };
+  struct alignas(std::max_align_t) Slab {
+    Slab *next;
+  };
+  static constexpr size_t slab_bytes =
+      sizeof(Slab) + slot_size * SlotsPerSlab;
+
+  static bool fits(size_t bytes, size_t alignment) {
+    return bytes <= slot_size && alignment <= alignof(std::max_align_t);
+  }
+
+  void *do_allocate(size_t bytes, size_t alignment) override {
+    if (!fits(bytes, alignment))
+      return upstream_->allocate(bytes, alignment);
+    if (!free_)
+      add_slab();
+    FreeSlot *slot = free_;
+    free_ = slot->next;
+    return slot;
+  }
+
+  void do_deallocate(void *p, size_t bytes, size_t alignment) override {
+    if (!fits(bytes, alignment)) {
+      upstream_->deallocate(p, bytes, alignment);
+      return;
+    }
+    auto *slot = static_cast<FreeSlot *>(p);
+    slot->next = free_;
+    free_ = slot;
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource &other) const
+      noexcept override {
+    return this == &other;
+  }
+
+  void add_slab() {
+    auto *slab = new (upstream_->allocate(slab_bytes,
+                                          alignof(std::max_align_t)))
+        Slab{slabs_};
+    slabs_ = slab;
+    auto *first = reinterpret_cast<char *>(slab + 1);
+    for (size_t i = SlotsPerSlab; i-- > 0;) {
+      auto *slot = reinterpret_cast<FreeSlot *>(first + i * slot_size);
+      slot->next = free_;
+      free_ = slot;
+    }
+  }
+
+  std::pmr::memory_resource *upstream_;
+  Slab *slabs_ = nullptr;
+  FreeSlot *free_ = nullptr;
+};
+} // namespace mutils
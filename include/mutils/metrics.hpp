@@ -0,0 +1,490 @@
+#pragma once
+
+#include "logger.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+// Usage:
+//   static auto requests = mutils::Metrics::counter("http_requests_total");
+//   requests.add();
+// Counters and distributions are sharded per thread, so updating one is a
+// plain load and store to memory no other thread writes; Metrics::snapshot()
+// and MetricsReporter add the shards up when they are read.
+namespace mutils {
+namespace detail {
+// One thread's share of every counter and distribution. Each thread has its
+// own cache-line-aligned block, so shards of different threads never share
+// a line.
+struct alignas(64) ThreadMetrics {
+  static constexpr uint32_t max_counters = 256;
+  static constexpr uint32_t max_distributions = 64;
+
+  std::array<std::atomic<uint64_t>, max_counters> counters{};
+  std::array<std::atomic<Histogram *>, max_distributions> distributions{};
+
+  ~ThreadMetrics() {
+    for (auto &d : distributions)
+      delete d.load(std::memory_order_relaxed);
+  }
+};
+} // namespace detail
+
+// Monotonic count, e.g. requests served. Copyable handle; a default
+// constructed one, or one past the registry's capacity, counts nothing.
+class Counter {
+public:
+  Counter() = default;
+
+  void add(uint64_t n = 1) noexcept;
+
+  uint32_t id() const { return id_; }
+
+private:
+  friend class Metrics;
+  explicit Counter(uint32_t id) : id_(id) {}
+
+  uint32_t id_ = detail::ThreadMetrics::max_counters;
+};
+
+// Current value of something, e.g. queue depth. Last write wins; not
+// sharded, since a gauge has a single value rather than a sum.
+class Gauge {
+public:
+  Gauge() = default;
+
+  void set(double value) noexcept;
+  void add(double delta) noexcept;
+
+  uint32_t id() const { return id_; }
+
+private:
+  friend class Metrics;
+  explicit Gauge(uint32_t id) : id_(id) {}
+
+  uint32_t id_ = UINT32_MAX;
+};
+
+// Distribution of integer samples (latencies in ns, sizes in bytes...),
+// kept in the profiler's log-linear Histogram buckets.
+class Distribution {
+public:
+  Distribution() = default;
+
+  void record(uint64_t value) noexcept;
+
+  uint32_t id() const { return id_; }
+
+private:
+  friend class Metrics;
+  explicit Distribution(uint32_t id) : id_(id) {}
+
+  uint32_t id_ = detail::ThreadMetrics::max_distributions;
+};
+
+struct CounterValue {
+  std::string_view name;
+  uint64_t value;
+};
+
+struct GaugeValue {
+  std::string_view name;
+  double value;
+};
+
+struct DistributionStats {
+  std::string_view name;
+  uint64_t count;
+  uint64_t total;
+  uint64_t min;
+  uint64_t p50;
+  uint64_t p99;
+  uint64_t p999;
+  uint64_t max;
+};
+
+struct MetricsSnapshot {
+  std::vector<CounterValue> counters;
+  std::vector<GaugeValue> gauges;
+  std::vector<DistributionStats> distributions;
+};
+
+// Registry of named metrics and of every thread's shards. Registering takes
+// a lock, so keep the handles (e.g. in a static) rather than looking them
+// up per update. Names are kept as given; use ones valid for the export
+// format, such as Prometheus' [a-zA-Z_:][a-zA-Z0-9_:]*.
+class Metrics {
+public:
+  static constexpr uint32_t max_counters = detail::ThreadMetrics::max_counters;
+  static constexpr uint32_t max_gauges = 256;
+  static constexpr uint32_t max_distributions =
+      detail::ThreadMetrics::max_distributions;
+
+  // Returns the metric registered under `name`, registering it first if
+  // needed; once the registry is full, a handle that records nothing.
+  static Counter counter(std::string_view name) {
+    auto &m = get();
+    return Counter(m.register_(m.counters_, m.counter_count_, name, "counter"));
+  }
+
+  static Gauge gauge(std::string_view name) {
+    auto &m = get();
+    return Gauge(m.register_(m.gauges_, m.gauge_count_, name, "gauge"));
+  }
+
+  static Distribution distribution(std::string_view name) {
+    auto &m = get();
+    return Distribution(m.register_(m.distributions_, m.distribution_count_,
+                                    name, "distribution"));
+  }
+
+  static void add(Counter c, uint64_t n) noexcept {
+    if (c.id_ >= max_counters)
+      return;
+    auto *t = current_;
+    if (!t && !(t = attach()))
+      return;
+    auto &shard = t->counters[c.id_];
+    // this thread is the only writer
+    shard.store(shard.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+  }
+
+  static void set(Gauge g, double value) noexcept {
+    if (g.id_ < max_gauges)
+      get().gauge_values_[g.id_].value.store(value,
+                                             std::memory_order_relaxed);
+  }
+
+  static void add(Gauge g, double delta) noexcept {
+    if (g.id_ < max_gauges)
+      get().gauge_values_[g.id_].value.fetch_add(delta,
+                                                 std::memory_order_relaxed);
+  }
+
+  static void record(Distribution d, uint64_t value) noexcept {
+    if (d.id_ >= max_distributions)
+      return;
+    auto *t = current_;
+    if (!t && !(t = attach()))
+      return;
+    auto *h = t->distributions[d.id_].load(std::memory_order_relaxed);
+    if (!h) {
+      h = new (std::nothrow) Histogram();
+      if (!h)
+        return;
+      t->distributions[d.id_].store(h, std::memory_order_release);
+    }
+    h->record(value);
+  }
+
+  // Sums every thread's shards, including those of threads that have
+  // exited. Distributions without samples are left out.
+  static MetricsSnapshot snapshot() {
+    auto &m = get();
+    std::lock_guard lock(m.mtx_);
+    MetricsSnapshot out;
+    uint32_t n = m.counter_count_.load(std::memory_order_acquire);
+    for (uint32_t id = 0; id < n; ++id) {
+      uint64_t total = m.retired_counters_[id];
+      for (const auto *t : m.threads_)
+        total += t->counters[id].load(std::memory_order_relaxed);
+      out.counters.push_back({m.counters_[id], total});
+    }
+    n = m.gauge_count_.load(std::memory_order_acquire);
+    for (uint32_t id = 0; id < n; ++id)
+      out.gauges.push_back(
+          {m.gauges_[id],
+           m.gauge_values_[id].value.load(std::memory_order_relaxed)});
+    n = m.distribution_count_.load(std::memory_order_acquire);
+    for (uint32_t id = 0; id < n; ++id) {
+      auto merged = std::make_unique<Histogram>();
+      if (m.retired_distributions_[id])
+        merged->merge(*m.retired_distributions_[id]);
+      for (const auto *t : m.threads_) {
+        if (auto *h = t->distributions[id].load(std::memory_order_acquire))
+          merged->merge(*h);
+      }
+      if (merged->count() == 0)
+        continue;
+      out.distributions.push_back(
+          {m.distributions_[id], merged->count(), merged->total(),
+           merged->min(), merged->percentile(0.5), merged->percentile(0.99),
+           merged->percentile(0.999), merged->max()});
+    }
+    return out;
+  }
+
+  // Prometheus text exposition format. Distributions become summaries,
+  // since their quantiles are what is kept.
+  static std::string prometheus(const MetricsSnapshot &s) {
+    std::string out;
+    auto it = std::back_inserter(out);
+    for (const auto &c : s.counters)
+      std::format_to(it, "# TYPE {0} counter\n{0} {1}\n", c.name, c.value);
+    for (const auto &g : s.gauges)
+      std::format_to(it, "# TYPE {0} gauge\n{0} {1}\n", g.name, g.value);
+    for (const auto &d : s.distributions)
+      std::format_to(it,
+                     "# TYPE {0} summary\n"
+                     "{0}{{quantile=\"0.5\"}} {1}\n"
+                     "{0}{{quantile=\"0.99\"}} {2}\n"
+                     "{0}{{quantile=\"0.999\"}} {3}\n"
+                     "{0}_sum {4}\n{0}_count {5}\n",
+                     d.name, d.p50, d.p99, d.p999, d.total, d.count);
+    return out;
+  }
+
+  // StatsD lines, one metric each. Counters are sent as the increase since
+  // `previous` (pass an empty snapshot the first time), distributions as
+  // gauges of their count, percentiles and max.
+  static std::vector<std::string> statsd(const MetricsSnapshot &s,
+                                         const MetricsSnapshot &previous) {
+    std::vector<std::string> out;
+    for (const auto &c : s.counters) {
+      uint64_t before = 0;
+      for (const auto &p : previous.counters)
+        if (p.name == c.name)
+          before = p.value;
+      if (c.value > before)
+        out.push_back(std::format("{}:{}|c", c.name, c.value - before));
+    }
+    for (const auto &g : s.gauges)
+      out.push_back(std::format("{}:{}|g", g.name, g.value));
+    for (const auto &d : s.distributions) {
+      out.push_back(std::format("{}.count:{}|g", d.name, d.count));
+      out.push_back(std::format("{}.p50:{}|g", d.name, d.p50));
+      out.push_back(std::format("{}.p99:{}|g", d.name, d.p99));
+      out.push_back(std::format("{}.max:{}|g", d.name, d.max));
+    }
+    return out;
+  }
+
+  // Logs one line per metric.
+  static void report() { report(snapshot()); }
+
+  static void report(const MetricsSnapshot &s) {
+    for (const auto &c : s.counters)
+      LOG("metric {:<32} {}", c.name, c.value);
+    for (const auto &g : s.gauges)
+      LOG("metric {:<32} {}", g.name, g.value);
+    for (const auto &d : s.distributions)
+      LOG("metric {:<32} count {} min {} p50 {} p99 {} p999 {} max {}", d.name,
+          d.count, d.min, d.p50, d.p99, d.p999, d.max);
+  }
+
+private:
+  struct alignas(64) PaddedGauge {
+    std::atomic<double> value{0};
+  };
+
+  // Moves the thread's shards into the retired totals when it exits.
+  struct ThreadHandle {
+    std::unique_ptr<detail::ThreadMetrics> shards;
+
+    ~ThreadHandle() {
+      if (shards)
+        get().retire(*shards);
+      current_ = nullptr;
+      exited_ = true;
+    }
+  };
+
+  Metrics() = default;
+
+  static Metrics &get() {
+    static Metrics instance;
+    return instance;
+  }
+
+  template <size_t N>
+  uint32_t register_(std::array<std::string, N> &names,
+                     std::atomic<uint32_t> &count, std::string_view name,
+                     const char *kind) {
+    std::lock_guard lock(mtx_);
+    uint32_t n = count.load(std::memory_order_relaxed);
+    for (uint32_t id = 0; id < n; ++id)
+      if (names[id] == name)
+        return id;
+    if (n == N) {
+      LOG_WARN("Metrics: too many of kind {}, not recording \"{}\"", kind,
+               name);
+      return static_cast<uint32_t>(N);
+    }
+    names[n] = name;
+    count.store(n + 1, std::memory_order_release);
+    return n;
+  }
+
+  static detail::ThreadMetrics *attach() noexcept {
+    // samples from later thread_local destructors have nowhere to go
+    if (exited_)
+      return nullptr;
+    thread_local ThreadHandle handle;
+    try {
+      handle.shards = std::make_unique<detail::ThreadMetrics>();
+      auto &m = get();
+      std::lock_guard lock(m.mtx_);
+      m.threads_.push_back(handle.shards.get());
+    } catch (...) {
+      handle.shards.reset();
+      return nullptr;
+    }
+    current_ = handle.shards.get();
+    return current_;
+  }
+
+  void retire(detail::ThreadMetrics &t) {
+    std::lock_guard lock(mtx_);
+    std::erase(threads_, &t);
+    for (uint32_t id = 0; id < max_counters; ++id)
+      retired_counters_[id] += t.counters[id].load(std::memory_order_relaxed);
+    for (uint32_t id = 0; id < max_distributions; ++id) {
+      if (auto *h = t.distributions[id].load(std::memory_order_relaxed)) {
+        if (!retired_distributions_[id])
+          retired_distributions_[id] = std::make_unique<Histogram>();
+        retired_distributions_[id]->merge(*h);
+      }
+    }
+  }
+
+  // a plain pointer, so the update path needs no TLS init guard
+  inline static thread_local detail::ThreadMetrics *current_ = nullptr;
+  inline static thread_local bool exited_ = false; // handle destroyed
+
+  std::mutex mtx_;
+  std::array<std::string, max_counters> counters_;
+  std::array<std::string, max_gauges> gauges_;
+  std::array<std::string, max_distributions> distributions_;
+  std::atomic<uint32_t> counter_count_{0};
+  std::atomic<uint32_t> gauge_count_{0};
+  std::atomic<uint32_t> distribution_count_{0};
+  std::array<PaddedGauge, max_gauges> gauge_values_{};
+  std::vector<detail::ThreadMetrics *> threads_;
+  std::array<uint64_t, max_counters> retired_counters_{};
+  std::array<std::unique_ptr<Histogram>, max_distributions>
+      retired_distributions_{};
+};
+
+inline void Counter::add(uint64_t n) noexcept { Metrics::add(*this, n); }
+inline void Gauge::set(double value) noexcept { Metrics::set(*this, value); }
+inline void Gauge::add(double delta) noexcept { Metrics::add(*this, delta); }
+inline void Distribution::record(uint64_t value) noexcept {
+  Metrics::record(*this, value);
+}
+
+struct MetricsReporterOptions {
+  std::chrono::milliseconds interval{10000};
+  // One LOG line per metric.
+  bool log = true;
+  // Rewritten (through a rename, so readers never see half a file) in the
+  // Prometheus text format, e.g. for node_exporter's textfile collector.
+  std::filesystem::path prometheus_file{};
+  // Receives StatsD lines, several per datagram; typically
+  // SocketSink::udp(host, "8125").
+  std::shared_ptr<Sink> statsd{};
+};
+
+// Exports Metrics::snapshot() every interval from a thread of its own, and
+// once more when destroyed.
+class MetricsReporter {
+public:
+  explicit MetricsReporter(const MetricsReporterOptions &opts = {})
+      : opts_(opts), worker_([this] { run(); }) {}
+
+  MetricsReporter(const MetricsReporter &) = delete;
+  MetricsReporter &operator=(const MetricsReporter &) = delete;
+
+  ~MetricsReporter() {
+    {
+      std::lock_guard lock(mtx_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    worker_.join();
+  }
+
+  // Exports now instead of at the next interval; returns once done.
+  void report_now() {
+    std::lock_guard lock(report_mtx_);
+    export_(Metrics::snapshot());
+  }
+
+private:
+  // StatsD servers commonly accept datagrams up to this size.
+  static constexpr size_t max_datagram = 1432;
+
+  void run() {
+    std::unique_lock lock(mtx_);
+    for (;;) {
+      bool stopping =
+          cv_.wait_for(lock, opts_.interval, [this] { return stop_; });
+      lock.unlock();
+      report_now();
+      if (stopping)
+        return;
+      lock.lock();
+    }
+  }
+
+  void export_(MetricsSnapshot s) {
+    if (opts_.log)
+      Metrics::report(s);
+    if (!opts_.prometheus_file.empty())
+      write_prometheus_(Metrics::prometheus(s));
+    if (opts_.statsd) {
+      std::string packet;
+      for (const auto &line : Metrics::statsd(s, previous_)) {
+        if (!packet.empty() && packet.size() + 1 + line.size() > max_datagram) {
+          opts_.statsd->write(LogLevel::INFO, packet);
+          packet.clear();
+        }
+        if (!packet.empty())
+          packet += '\n';
+        packet += line;
+      }
+      if (!packet.empty())
+        opts_.statsd->write(LogLevel::INFO, packet);
+    }
+    previous_ = std::move(s);
+  }
+
+  void write_prometheus_(std::string_view text) {
+    auto tmp = opts_.prometheus_file;
+    tmp += ".tmp";
+    int fd = detail::open_log_file(tmp, false);
+    bool ok = fd >= 0 && detail::write_all(fd, text.data(), text.size());
+    if (fd >= 0)
+      detail::close_fd(fd);
+    std::error_code ec;
+    if (ok)
+      std::filesystem::rename(tmp, opts_.prometheus_file, ec);
+    if (!ok || ec)
+      LOG_ERR("Failed to write metrics to {}",
+              opts_.prometheus_file.string());
+  }
+
+  MetricsReporterOptions opts_;
+  std::mutex report_mtx_; // serializes exports and guards previous_
+  MetricsSnapshot previous_;
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  bool stop_ = false;
+  std::thread worker_; // last, so it starts after the members it uses
+};
+} // namespace mutils
@@ -3,5 +3,12 @@
 #include "common.hpp"
 #include "io.hpp"
 #include "logger.hpp"
+#include "memory.hpp"
+#include "metrics.hpp"
+#include "profiler.hpp"
+#include "ring.hpp"
+#include "simd.hpp"
+#include "sinks.hpp"
 #include "strings.hpp"
+#include "threadpool.hpp"
 #include "time.hpp"
@@ -0,0 +1,575 @@
+#pragma once
+
+#include "common.hpp"
+#include "logger.hpp"
+#include "strings.hpp"
+#include "time.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <source_location>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#endif
+
+// Usage: PROFILE_SCOPE("parse row");
+// Records the time until the end of the enclosing scope into the calling
+// thread's histogram for that zone; see Profiler::report().
+#ifndef MUTILS_NO_PROFILING
+#define PROFILE_SCOPE(name)                                                    \
+  static const uint32_t DEFER_CONCAT(_zone_, __LINE__) =                       \
+      mutils::Profiler::zone(name);                                            \
+  mutils::ProfileScope DEFER_CONCAT(_profile_, __LINE__)(                      \
+      DEFER_CONCAT(_zone_, __LINE__))
+#else
+#define PROFILE_SCOPE(name) static_assert(true)
+#endif
+
+namespace mutils {
+// Log-linear histogram of nanosecond durations in the style of HdrHistogram:
+// exact below 64 ns, then 32 buckets per power of two, so every reported
+// value is within ~3% of the recorded one. Durations above ~18 minutes are
+// clamped. Each histogram has a single writer; other threads may read it
+// concurrently.
+class Histogram {
+public:
+  static constexpr unsigned sub_bits = 5;
+  static constexpr unsigned max_bits = 40;
+  static constexpr size_t bucket_count = (max_bits - sub_bits + 1)
+                                         << sub_bits;
+
+  void record(uint64_t ns) noexcept {
+    ns = std::min(ns, (uint64_t{1} << max_bits) - 1);
+    bump(buckets_[bucket_of(ns)], 1);
+    bump(count_, 1);
+    bump(total_, ns);
+    if (ns < min_.load(std::memory_order_relaxed))
+      min_.store(ns, std::memory_order_relaxed);
+    if (ns > max_.load(std::memory_order_relaxed))
+      max_.store(ns, std::memory_order_relaxed);
+  }
+
+  // Adds the samples of `other`; only the owner of *this may call it.
+  void merge(const Histogram &other) noexcept {
+    if (other.count() == 0)
+      return;
+    for (size_t i = 0; i < bucket_count; ++i)
+      bump(buckets_[i], other.buckets_[i].load(std::memory_order_relaxed));
+    bump(count_, other.count());
+    bump(total_, other.total());
+    if (other.min() < min())
+      min_.store(other.min(), std::memory_order_relaxed);
+    if (other.max() > max())
+      max_.store(other.max(), std::memory_order_relaxed);
+  }
+
+  uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+  uint64_t total() const { return total_.load(std::memory_order_relaxed); }
+  uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+  uint64_t min() const {
+    return count() ? min_.load(std::memory_order_relaxed) : 0;
+  }
+
+  // Smallest recorded value v such that a fraction `q` of the samples are
+  // less than or equal to v, reported as the top of its bucket.
+  uint64_t percentile(double q) const {
+    uint64_t n = count();
+    if (n == 0)
+      return 0;
+    auto rank = static_cast<uint64_t>(std::ceil(q * static_cast<double>(n)));
+    rank = std::clamp<uint64_t>(rank, 1, n);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < bucket_count; ++i) {
+      seen += buckets_[i].load(std::memory_order_relaxed);
+      if (seen >= rank)
+        return std::clamp(highest_in(i), min(), max());
+    }
+    return max();
+  }
+
+  static size_t bucket_of(uint64_t ns) noexcept {
+    if (ns < (uint64_t{1} << sub_bits))
+      return ns;
+    unsigned shift = std::bit_width(ns) - 1 - sub_bits;
+    return ((shift + 1) << sub_bits) +
+           ((ns >> shift) - (uint64_t{1} << sub_bits));
+  }
+
+  static uint64_t highest_in(size_t bucket) noexcept {
+    if (bucket < (size_t{1} << sub_bits))
+      return bucket;
+    unsigned shift = (bucket >> sub_bits) - 1;
+    uint64_t sub = bucket & ((size_t{1} << sub_bits) - 1);
+    return (((uint64_t{1} << sub_bits) + sub + 1) << shift) - 1;
+  }
+
+private:
+  // single writer, so a plain load and store is enough (and lock-free)
+  static void bump(std::atomic<uint64_t> &a, uint64_t n) noexcept {
+    a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> total_{0};
+  std::atomic<uint64_t> min_{UINT64_MAX};
+  std::atomic<uint64_t> max_{0};
+  std::array<std::atomic<uint64_t>, bucket_count> buckets_{};
+};
+
+struct ZoneStats {
+  const char *name;
+  std::source_location loc;
+  uint64_t count;
+  uint64_t total_ns;
+  uint64_t min_ns;
+  uint64_t p50_ns;
+  uint64_t p99_ns;
+  uint64_t p999_ns;
+  uint64_t max_ns;
+};
+
+namespace detail {
+// Per-thread histograms, indexed by zone id and allocated on first use.
+struct ThreadProfile {
+  static constexpr uint32_t max_zones = 256;
+
+  std::array<std::atomic<Histogram *>, max_zones> zones{};
+
+  ~ThreadProfile() {
+    for (auto &z : zones)
+      delete z.load(std::memory_order_relaxed);
+  }
+};
+} // namespace detail
+
+// Registry of profiling zones and of every thread's histograms. Recording
+// never locks: each thread writes only its own histograms, and report()
+// merges them on demand.
+class Profiler {
+public:
+  static constexpr uint32_t max_zones = detail::ThreadProfile::max_zones;
+
+  // Registers a zone and returns its id. PROFILE_SCOPE calls this once per
+  // call site. Returns max_zones, which records nothing, once full.
+  static uint32_t zone(const char *name, std::source_location loc =
+                                             std::source_location::current()) {
+    auto &p = get();
+    std::lock_guard lock(p.mtx_);
+    uint32_t id = p.zone_count_.load(std::memory_order_relaxed);
+    if (id == max_zones) {
+      LOG_WARN("Profiler: too many zones, not recording \"{}\"", name);
+      return max_zones;
+    }
+    p.zones_[id] = {name, loc};
+    p.zone_count_.store(id + 1, std::memory_order_release);
+    return id;
+  }
+
+  // Name of a zone returned by zone(); safe to call from any thread.
+  static const char *zone_name(uint32_t id) {
+    auto &p = get();
+    if (id >= p.zone_count_.load(std::memory_order_acquire))
+      return "?";
+    return p.zones_[id].name;
+  }
+
+  static void record(uint32_t zone, uint64_t ns) noexcept {
+    if (zone >= max_zones)
+      return;
+    auto *t = current_;
+    if (!t && !(t = attach()))
+      return;
+    auto *h = t->zones[zone].load(std::memory_order_relaxed);
+    if (!h) {
+      h = new (std::nothrow) Histogram();
+      if (!h)
+        return;
+      t->zones[zone].store(h, std::memory_order_release);
+    }
+    h->record(ns);
+  }
+
+  // Merges every thread's histograms, including those of threads that have
+  // exited, and returns one entry per zone that recorded anything.
+  static std::vector<ZoneStats> snapshot() {
+    auto &p = get();
+    std::lock_guard lock(p.mtx_);
+    uint32_t n = p.zone_count_.load(std::memory_order_acquire);
+    std::vector<ZoneStats> out;
+    for (uint32_t id = 0; id < n; ++id) {
+      auto merged = std::make_unique<Histogram>();
+      if (p.retired_[id])
+        merged->merge(*p.retired_[id]);
+      for (const auto &t : p.threads_) {
+        if (auto *h = t->zones[id].load(std::memory_order_acquire))
+          merged->merge(*h);
+      }
+      if (merged->count() == 0)
+        continue;
+      out.push_back({p.zones_[id].name, p.zones_[id].loc, merged->count(),
+                     merged->total(), merged->min(), merged->percentile(0.5),
+                     merged->percentile(0.99), merged->percentile(0.999),
+                     merged->max()});
+    }
+    return out;
+  }
+
+  // Logs one line per zone: count, min, p50, p99, p999 and max.
+  static void report() {
+    for (const auto &z : snapshot()) {
+      LOG("profile {:<24} count {:>9} min {:>9} p50 {:>9} p99 {:>9} "
+          "p999 {:>9} max {:>9}",
+          z.name, z.count, format_ns(z.min_ns), format_ns(z.p50_ns),
+          format_ns(z.p99_ns), format_ns(z.p999_ns), format_ns(z.max_ns));
+    }
+  }
+
+  static std::string format_ns(uint64_t ns) {
+    auto v = static_cast<double>(ns);
+    if (ns < 1000)
+      return std::format("{}ns", ns);
+    if (ns < 1000000)
+      return std::format("{:.2f}us", v / 1e3);
+    if (ns < 1000000000)
+      return std::format("{:.2f}ms", v / 1e6);
+    return std::format("{:.2f}s", v / 1e9);
+  }
+
+private:
+  struct ZoneInfo {
+    const char *name = nullptr;
+    std::source_location loc;
+  };
+
+  // Moves the thread's samples into retired_ when the thread exits.
+  struct ThreadHandle {
+    std::unique_ptr<detail::ThreadProfile> profile;
+
+    ~ThreadHandle() {
+      if (profile)
+        get().retire(*profile);
+      current_ = nullptr;
+      exited_ = true;
+    }
+  };
+
+  Profiler() = default;
+
+  static Profiler &get() {
+    static Profiler instance;
+    return instance;
+  }
+
+  static detail::ThreadProfile *attach() noexcept {
+    // zones closed by later thread_local destructors have nowhere to go
+    if (exited_)
+      return nullptr;
+    thread_local ThreadHandle handle;
+    try {
+      handle.profile = std::make_unique<detail::ThreadProfile>();
+      auto &p = get();
+      std::lock_guard lock(p.mtx_);
+      p.threads_.push_back(handle.profile.get());
+    } catch (...) {
+      handle.profile.reset();
+      return nullptr;
+    }
+    current_ = handle.profile.get();
+    return current_;
+  }
+
+  void retire(detail::ThreadProfile &t) {
+    std::lock_guard lock(mtx_);
+    std::erase(threads_, &t);
+    for (uint32_t id = 0; id < max_zones; ++id) {
+      if (auto *h = t.zones[id].load(std::memory_order_relaxed)) {
+        if (!retired_[id])
+          retired_[id] = std::make_unique<Histogram>();
+        retired_[id]->merge(*h);
+      }
+    }
+  }
+
+  // a plain pointer, so the recording path needs no TLS init guard
+  inline static thread_local detail::ThreadProfile *current_ = nullptr;
+  inline static thread_local bool exited_ = false; // handle destroyed
+
+  std::mutex mtx_;
+  std::array<ZoneInfo, max_zones> zones_{};
+  std::atomic<uint32_t> zone_count_{0};
+  std::vector<detail::ThreadProfile *> threads_;
+  std::array<std::unique_ptr<Histogram>, max_zones> retired_{};
+};
+
+struct TraceOptions {
+  size_t ring_bytes = 1 << 20; // per thread; events are dropped when full
+  std::chrono::milliseconds flush_interval{10};
+};
+
+namespace detail {
+struct TraceEvent {
+  int64_t timestamp_ns;
+  uint32_t zone;
+  char phase; // 'B'egin or 'E'nd, as in the Chrome trace format
+};
+
+struct TraceRing {
+  TraceRing(size_t bytes, uint64_t tid, std::string_view thread_name)
+      : ring(bytes), tid(tid), thread_name(thread_name) {}
+
+  SpscRing ring;
+  uint64_t tid;
+  std::string thread_name;
+  bool named = false; // thread_name event written; backend only
+  std::atomic<bool> retired{false};
+};
+} // namespace detail
+
+// Optional trace mode for PROFILE_SCOPE: every zone entry and exit goes into
+// a bounded per-thread ring, and a background thread streams them to a
+// Chrome JSON trace that ui.perfetto.dev and chrome://tracing can open.
+// While no trace is running a zone pays one extra branch.
+class Tracer {
+public:
+  Tracer(const Tracer &) = delete;
+  Tracer &operator=(const Tracer &) = delete;
+
+  static bool active() { return active_.load(std::memory_order_relaxed); }
+
+  static bool start(const std::filesystem::path &path,
+                    const TraceOptions &opts = {}) {
+    return get().start_(path, opts);
+  }
+
+  // Writes out what is queued and closes the file. Events recorded by
+  // threads racing with stop() are discarded.
+  static void stop() { get().stop_(); }
+
+  // Events lost because a thread's ring was full.
+  static uint64_t dropped() {
+    return get().dropped_.load(std::memory_order_relaxed);
+  }
+
+  static void record(uint32_t zone, char phase,
+                     FastClock::time_point ts) noexcept {
+    if (zone >= Profiler::max_zones)
+      return;
+    auto *r = current_;
+    if (!r && !(r = attach()))
+      return;
+    detail::TraceEvent ev{ts.time_since_epoch().count(), zone, phase};
+    if (!r->ring.try_push(&ev, sizeof(ev), 0))
+      get().dropped_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+private:
+  struct ThreadHandle {
+    std::shared_ptr<detail::TraceRing> ring;
+
+    ~ThreadHandle() {
+      if (ring)
+        ring->retired.store(true, std::memory_order_release);
+      current_ = nullptr;
+      exited_ = true;
+    }
+  };
+
+  // construct the zone registry first, so it outlives the worker
+  Tracer() { Profiler::zone_name(0); }
+  ~Tracer() { stop_(); }
+
+  static Tracer &get() {
+    static Tracer instance;
+    return instance;
+  }
+
+  static detail::TraceRing *attach() noexcept {
+    // events from later thread_local destructors have nowhere to go
+    if (exited_)
+      return nullptr;
+    thread_local ThreadHandle handle;
+    try {
+      // same id as the logger's "[THREAD ...]" prefix
+      std::string_view id = Logger::get().thread_id();
+      uint64_t tid = 0;
+      auto [end, ec] = std::from_chars(id.data(), id.data() + id.size(), tid);
+      if (ec != std::errc() || end != id.data() + id.size())
+        tid = std::hash<std::string_view>{}(id) & ((uint64_t{1} << 53) - 1);
+
+      auto &t = get();
+      std::lock_guard lock(t.mtx_);
+      handle.ring = std::make_shared<detail::TraceRing>(
+          t.options_.ring_bytes, tid, std::format("THREAD {}", id));
+      t.rings_.push_back(handle.ring);
+    } catch (...) {
+      return nullptr;
+    }
+    current_ = handle.ring.get();
+    return current_;
+  }
+
+  bool start_(const std::filesystem::path &path, const TraceOptions &opts) {
+    std::lock_guard lock(mtx_);
+    if (worker_.joinable())
+      return false;
+    fd_ = detail::open_log_file(path, false);
+    if (fd_ < 0)
+      return false;
+    options_ = opts;
+    stop_requested_ = false;
+    first_event_ = true;
+    for (auto &r : rings_) {
+      // leftovers from threads that raced with the last stop()
+      r->ring.drain([](const SpscRing::Record &, const std::byte *) {});
+      r->named = false;
+    }
+    out_ = "{\"traceEvents\":[\n";
+    worker_ = std::thread([this] { run(); });
+    active_.store(true, std::memory_order_relaxed);
+    return true;
+  }
+
+  void stop_() {
+    {
+      std::lock_guard lock(mtx_);
+      if (!worker_.joinable())
+        return;
+      active_.store(false, std::memory_order_relaxed);
+      stop_requested_ = true;
+    }
+    wake_.notify_all();
+    worker_.join();
+    out_ += "\n]}\n";
+    detail::write_all(fd_, out_.data(), out_.size());
+    detail::close_fd(fd_);
+    fd_ = -1;
+    out_.clear();
+  }
+
+  void run() {
+    std::vector<std::shared_ptr<detail::TraceRing>> rings;
+    for (;;) {
+      bool stopping;
+      {
+        std::lock_guard lock(mtx_);
+        stopping = stop_requested_;
+        std::erase_if(rings_, [](const auto &r) {
+          return r->retired.load(std::memory_order_acquire) && r->ring.empty();
+        });
+        rings = rings_;
+      }
+
+      for (auto &r : rings) {
+        r->ring.drain(
+            [&](const SpscRing::Record &, const std::byte *payload) {
+              detail::TraceEvent ev;
+              std::memcpy(&ev, payload, sizeof(ev));
+              append_event(*r, ev);
+            });
+        if (out_.size() >= (64 << 10)) {
+          detail::write_all(fd_, out_.data(), out_.size());
+          out_.clear();
+        }
+      }
+      if (stopping)
+        return; // stop_() writes the rest
+      detail::write_all(fd_, out_.data(), out_.size());
+      out_.clear();
+
+      std::unique_lock lock(mtx_);
+      wake_.wait_for(lock, options_.flush_interval,
+                     [&] { return stop_requested_; });
+    }
+  }
+
+  void append_event(detail::TraceRing &r, const detail::TraceEvent &ev) {
+    if (!r.named) {
+      separate();
+      std::format_to(std::back_inserter(out_),
+                     "{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":{},"
+                     "\"tid\":{},\"args\":{{\"name\":",
+                     pid(), r.tid);
+      append_json_string(out_, r.thread_name);
+      out_ += "}}";
+      r.named = true;
+    }
+    separate();
+    out_ += "{\"name\":";
+    append_json_string(out_, Profiler::zone_name(ev.zone));
+    // ts is in microseconds
+    std::format_to(std::back_inserter(out_),
+                   ",\"ph\":\"{}\",\"ts\":{}.{:03},\"pid\":{},\"tid\":{}}}",
+                   ev.phase, ev.timestamp_ns / 1000, ev.timestamp_ns % 1000,
+                   pid(), r.tid);
+  }
+
+  void separate() {
+    if (!first_event_)
+      out_ += ",\n";
+    first_event_ = false;
+  }
+
+  static int pid() {
+#ifdef _WIN32
+    return _getpid();
+#else
+    return getpid();
+#endif
+  }
+
+  inline static std::atomic<bool> active_{false};
+  inline static thread_local detail::TraceRing *current_ = nullptr;
+  inline static thread_local bool exited_ = false; // handle destroyed
+
+  TraceOptions options_;
+  std::mutex mtx_;
+  std::condition_variable wake_;
+  std::thread worker_;
+  bool stop_requested_ = false;
+  int fd_ = -1;
+  bool first_event_ = true;
+  std::string out_; // worker only while a trace is running
+  std::vector<std::shared_ptr<detail::TraceRing>> rings_;
+  std::atomic<uint64_t> dropped_{0};
+};
+
+// RAII guard behind PROFILE_SCOPE.
+class ProfileScope {
+public:
+  explicit ProfileScope(uint32_t zone) noexcept
+      : zone_(zone), tracing_(Tracer::active()), start_(FastClock::now()) {
+    if (tracing_)
+      Tracer::record(zone_, 'B', start_);
+  }
+  ~ProfileScope() {
+    auto end = FastClock::now();
+    Profiler::record(zone_, static_cast<uint64_t>((end - start_).count()));
+    if (tracing_)
+      Tracer::record(zone_, 'E', end);
+  }
+  ProfileScope(const ProfileScope &) = delete;
+  ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+  uint32_t zone_;
+  bool tracing_;
+  FastClock::time_point start_;
+};
+} // namespace mutils
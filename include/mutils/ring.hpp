@@ -0,0 +1,143 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+namespace mutils {
+// std::hardware_destructive_interference_size is not ABI stable across
+// compiler flags, so use the value that is right for every target we ship on.
+inline constexpr size_t cache_line_size = 64;
+
+// Bounded single-producer / single-consumer ring of variable sized records.
+// Every record is stored contiguously (the producer pads to the end of the
+// buffer instead of wrapping), so the consumer can hand out views straight
+// into the ring without copying.
+class SpscRing {
+public:
+  struct Record {
+    uint32_t size; // payload bytes, excluding the header
+    uint16_t kind;
+    uint16_t flags;
+  };
+
+  static constexpr uint16_t pad_kind = 0xffff;
+  static constexpr size_t alignment = alignof(std::max_align_t);
+
+  // capacity is rounded up to a power of two
+  explicit SpscRing(size_t capacity) {
+    size_t cap = 4096;
+    while (cap < capacity)
+      cap <<= 1;
+    capacity_ = cap;
+    data_ = std::make_unique<std::byte[]>(capacity_ + alignment);
+    base_ = align(data_.get());
+  }
+
+  SpscRing(const SpscRing &) = delete;
+  SpscRing &operator=(const SpscRing &) = delete;
+
+  size_t capacity() const { return capacity_; }
+
+  // Largest payload that can ever be pushed.
+  size_t max_payload() const { return capacity_ / 2 - sizeof(Record); }
+
+  // Producer side. Reserves room for a payload of `size` bytes and returns a
+  // pointer to it, or nullptr if the ring is full. The record only becomes
+  // visible to the consumer after commit().
+  std::byte *reserve(size_t size) {
+    if (size > max_payload())
+      return nullptr;
+
+    size_t need = round_up(sizeof(Record) + size);
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t pos = tail & (capacity_ - 1);
+    size_t contiguous = capacity_ - pos;
+    size_t total = need > contiguous ? contiguous + need : need;
+
+    if (capacity_ - (tail - cached_head_) < total) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (capacity_ - (tail - cached_head_) < total)
+        return nullptr;
+    }
+
+    if (need > contiguous) {
+      Record pad{static_cast<uint32_t>(contiguous - sizeof(Record)), pad_kind,
+                 0};
+      std::memcpy(base_ + pos, &pad, sizeof(pad));
+      pos = 0;
+    }
+
+    pending_ = total;
+    pending_pos_ = pos;
+    return base_ + pos + sizeof(Record);
+  }
+
+  void commit(size_t size, uint16_t kind, uint16_t flags = 0) {
+    Record rec{static_cast<uint32_t>(size), kind, flags};
+    std::memcpy(base_ + pending_pos_, &rec, sizeof(rec));
+    tail_.store(tail_.load(std::memory_order_relaxed) + pending_,
+                std::memory_order_release);
+  }
+
+  bool try_push(const void *data, size_t size, uint16_t kind,
+                uint16_t flags = 0) {
+    std::byte *dst = reserve(size);
+    if (!dst)
+      return false;
+    std::memcpy(dst, data, size);
+    commit(size, kind, flags);
+    return true;
+  }
+
+  // Consumer side. Calls fn(const Record &, const std::byte *payload) for
+  // every committed record and returns how many were consumed.
+  template <typename F> size_t drain(F &&fn) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t tail = tail_.load(std::memory_order_acquire);
+    size_t count = 0;
+
+    while (head != tail) {
+      const std::byte *at = base_ + (head & (capacity_ - 1));
+      Record rec;
+      std::memcpy(&rec, at, sizeof(rec));
+      if (rec.kind != pad_kind) {
+        fn(rec, at + sizeof(Record));
+        ++count;
+      }
+      head += round_up(sizeof(Record) + rec.size);
+      // release each record as soon as it is consumed so a blocked producer
+      // can make progress while we are still writing
+      head_.store(head, std::memory_order_release);
+    }
+    return count;
+  }
+
+  bool empty() const {
+    return head_.load(std::memory_order_acquire) ==
+           tail_.load(std::memory_order_acquire);
+  }
+
+private:
+  static constexpr size_t round_up(size_t n) {
+    return (n + alignment - 1) & ~(alignment - 1);
+  }
+
+  static std::byte *align(std::byte *p) {
+    auto addr = reinterpret_cast<uintptr_t>(p);
+    return p + (round_up(addr) - addr);
+  }
+
+  alignas(cache_line_size) std::atomic<size_t> head_{0};
+  alignas(cache_line_size) std::atomic<size_t> tail_{0};
+  // producer-only state
+  size_t cached_head_ = 0;
+  size_t pending_ = 0;
+  size_t pending_pos_ = 0;
+  size_t capacity_ = 0;
+  std::byte *base_ = nullptr;
+  std::unique_ptr<std::byte[]> data_;
+};
+} // namespace mutils
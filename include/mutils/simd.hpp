@@ -0,0 +1,499 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) ||           \
+    defined(_M_IX86)
+#define MUTILS_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#define MUTILS_SSE2 1
+#endif
+#if defined(__AVX2__)
+#define MUTILS_AVX2 1
+#endif
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define MUTILS_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Lets a single function use instructions the rest of the TU was not
+// compiled for; only ever called after a runtime CPU check.
+#if defined(__GNUC__) || defined(__clang__)
+#define MUTILS_TARGET(isa) __attribute__((target(isa)))
+#else
+#define MUTILS_TARGET(isa)
+#endif
+
+// Byte scanning kernels shared by the string and I/O helpers. Each kernel
+// works on [first, last) and has a scalar tail, so any length is fine.
+namespace mutils::simd {
+
+// Returns a pointer to the first `c` in [first, last), or `last`. Called once
+// per line/token, so it is picked at compile time and stays inlinable rather
+// than going through the runtime dispatch below.
+inline const char *find_byte(const char *first, const char *last, char c) {
+#if MUTILS_AVX2
+  const __m256i needle32 = _mm256_set1_epi8(c);
+  for (; last - first >= 32; first += 32) {
+    __m256i chunk =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(first));
+    auto mask = static_cast<uint32_t>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle32)));
+    if (mask)
+      return first + std::countr_zero(mask);
+  }
+#endif
+#if MUTILS_SSE2
+  const __m128i needle = _mm_set1_epi8(c);
+  for (; last - first >= 16; first += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(first));
+    auto mask = static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle)));
+    if (mask)
+      return first + std::countr_zero(mask);
+  }
+#elif MUTILS_NEON
+  const uint8x16_t needle = vdupq_n_u8(static_cast<uint8_t>(c));
+  for (; last - first >= 16; first += 16) {
+    uint8x16_t eq =
+        vceqq_u8(vld1q_u8(reinterpret_cast<const uint8_t *>(first)), needle);
+    // narrow every byte to a nibble so the mask fits in 64 bits
+    uint64_t mask = vget_lane_u64(
+        vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+    if (mask)
+      return first + (std::countr_zero(mask) >> 2);
+  }
+#endif
+  auto hit = static_cast<const char *>(
+      std::memchr(first, c, static_cast<size_t>(last - first)));
+  return hit ? hit : last;
+}
+
+// Set of byte values, for find_any. Small sets also keep their members in a
+// list so the vector kernels can compare against each of them directly.
+class ByteSet {
+public:
+  static constexpr size_t max_listed = 16;
+
+  constexpr ByteSet() = default;
+  constexpr explicit ByteSet(std::string_view chars) {
+    for (char c : chars)
+      insert(c);
+  }
+
+  constexpr void insert(char c) {
+    if (contains(c))
+      return;
+    auto b = static_cast<unsigned char>(c);
+    bits_[b >> 6] |= uint64_t{1} << (b & 63);
+    if (count_ < max_listed)
+      listed_[count_] = c;
+    ++count_;
+  }
+
+  constexpr bool contains(char c) const {
+    auto b = static_cast<unsigned char>(c);
+    return (bits_[b >> 6] >> (b & 63)) & 1;
+  }
+
+  constexpr size_t size() const { return count_; }
+  constexpr bool listed() const { return count_ <= max_listed; }
+  constexpr char operator[](size_t i) const { return listed_[i]; }
+
+private:
+  uint64_t bits_[4] = {};
+  char listed_[max_listed] = {};
+  size_t count_ = 0;
+};
+
+namespace scalar {
+constexpr char fold_lower(char c) {
+  return c >= 'A' && c <= 'Z' ? static_cast<char>(c + 0x20) : c;
+}
+
+constexpr char fold_upper(char c) {
+  return c >= 'a' && c <= 'z' ? static_cast<char>(c - 0x20) : c;
+}
+
+inline const char *find_any(const char *first, const char *last,
+                            const ByteSet &set) {
+  for (; first != last; ++first)
+    if (set.contains(*first))
+      return first;
+  return last;
+}
+
+inline size_t count_byte(const char *first, const char *last, char c) {
+  size_t count = 0;
+  for (; first != last; ++first)
+    count += *first == c;
+  return count;
+}
+
+inline bool iequals(const char *a, const char *b, size_t size) {
+  for (size_t i = 0; i < size; ++i)
+    if (fold_lower(a[i]) != fold_lower(b[i]))
+      return false;
+  return true;
+}
+
+inline void to_lower(char *data, size_t size) {
+  for (size_t i = 0; i < size; ++i)
+    data[i] = fold_lower(data[i]);
+}
+
+inline void to_upper(char *data, size_t size) {
+  for (size_t i = 0; i < size; ++i)
+    data[i] = fold_upper(data[i]);
+}
+} // namespace scalar
+
+#if MUTILS_X86
+namespace sse2 {
+// 0xff in every lane whose byte lies in [lo, lo + 25], using a signed
+// compare after shifting `lo` down to -128.
+MUTILS_TARGET("sse2")
+inline __m128i in_alpha_range(__m128i v, char lo) {
+  __m128i shifted =
+      _mm_add_epi8(v, _mm_set1_epi8(static_cast<char>(0x80 - lo)));
+  return _mm_cmpgt_epi8(_mm_set1_epi8(-128 + 26), shifted);
+}
+
+MUTILS_TARGET("sse2")
+inline __m128i fold_lower(__m128i v) {
+  return _mm_xor_si128(
+      v, _mm_and_si128(in_alpha_range(v, 'A'), _mm_set1_epi8(0x20)));
+}
+
+MUTILS_TARGET("sse2")
+inline const char *find_any(const char *first, const char *last,
+                            const ByteSet &set) {
+  if (!set.listed())
+    return scalar::find_any(first, last, set);
+  for (; last - first >= 16; first += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(first));
+    __m128i hits = _mm_setzero_si128();
+    for (size_t i = 0; i < set.size(); ++i)
+      hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(set[i])));
+    auto mask = static_cast<uint32_t>(_mm_movemask_epi8(hits));
+    if (mask)
+      return first + std::countr_zero(mask);
+  }
+  return scalar::find_any(first, last, set);
+}
+
+MUTILS_TARGET("sse2")
+inline size_t count_byte(const char *first, const char *last, char c) {
+  const __m128i needle = _mm_set1_epi8(c);
+  size_t count = 0;
+  while (last - first >= 16) {
+    // per-lane byte counters, widened before they can overflow
+    size_t blocks = std::min<size_t>((last - first) / 16, 255);
+    __m128i acc = _mm_setzero_si128();
+    for (size_t i = 0; i < blocks; ++i, first += 16) {
+      __m128i chunk =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(first));
+      acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(chunk, needle));
+    }
+    __m128i sums = _mm_sad_epu8(acc, _mm_setzero_si128());
+    count += static_cast<size_t>(_mm_cvtsi128_si32(sums)) +
+             static_cast<size_t>(_mm_extract_epi16(sums, 4));
+  }
+  return count + scalar::count_byte(first, last, c);
+}
+
+MUTILS_TARGET("sse2")
+inline bool iequals(const char *a, const char *b, size_t size) {
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+    __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(fold_lower(va), fold_lower(vb))) !=
+        0xffff)
+      return false;
+  }
+  return scalar::iequals(a + i, b + i, size - i);
+}
+
+MUTILS_TARGET("sse2")
+inline void flip_case(char *data, size_t size, char lo) {
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    auto *p = reinterpret_cast<__m128i *>(data + i);
+    __m128i v = _mm_loadu_si128(p);
+    v = _mm_xor_si128(
+        v, _mm_and_si128(in_alpha_range(v, lo), _mm_set1_epi8(0x20)));
+    _mm_storeu_si128(p, v);
+  }
+  lo == 'A' ? scalar::to_lower(data + i, size - i)
+            : scalar::to_upper(data + i, size - i);
+}
+
+inline void to_lower(char *data, size_t size) { flip_case(data, size, 'A'); }
+inline void to_upper(char *data, size_t size) { flip_case(data, size, 'a'); }
+} // namespace sse2
+
+namespace avx2 {
+MUTILS_TARGET("avx2")
+inline __m256i in_alpha_range(__m256i v, char lo) {
+  __m256i shifted =
+      _mm256_add_epi8(v, _mm256_set1_epi8(static_cast<char>(0x80 - lo)));
+  return _mm256_cmpgt_epi8(_mm256_set1_epi8(-128 + 26), shifted);
+}
+
+MUTILS_TARGET("avx2")
+inline __m256i fold_lower(__m256i v) {
+  return _mm256_xor_si256(
+      v, _mm256_and_si256(in_alpha_range(v, 'A'), _mm256_set1_epi8(0x20)));
+}
+
+MUTILS_TARGET("avx2")
+inline const char *find_any(const char *first, const char *last,
+                            const ByteSet &set) {
+  if (!set.listed())
+    return scalar::find_any(first, last, set);
+  for (; last - first >= 32; first += 32) {
+    __m256i chunk =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(first));
+    __m256i hits = _mm256_setzero_si256();
+    for (size_t i = 0; i < set.size(); ++i)
+      hits = _mm256_or_si256(
+          hits, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(set[i])));
+    auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(hits));
+    if (mask)
+      return first + std::countr_zero(mask);
+  }
+  return sse2::find_any(first, last, set);
+}
+
+MUTILS_TARGET("avx2")
+inline size_t count_byte(const char *first, const char *last, char c) {
+  const __m256i needle = _mm256_set1_epi8(c);
+  size_t count = 0;
+  while (last - first >= 32) {
+    size_t blocks = std::min<size_t>((last - first) / 32, 255);
+    __m256i acc = _mm256_setzero_si256();
+    for (size_t i = 0; i < blocks; ++i, first += 32) {
+      __m256i chunk =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(first));
+      acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(chunk, needle));
+    }
+    __m256i sums = _mm256_sad_epu8(acc, _mm256_setzero_si256());
+    __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sums),
+                                 _mm256_extracti128_si256(sums, 1));
+    count += static_cast<size_t>(_mm_cvtsi128_si32(half)) +
+             static_cast<size_t>(_mm_extract_epi16(half, 4));
+  }
+  return count + sse2::count_byte(first, last, c);
+}
+
+MUTILS_TARGET("avx2")
+inline bool iequals(const char *a, const char *b, size_t size) {
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+    __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+    if (static_cast<uint32_t>(_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(fold_lower(va), fold_lower(vb)))) != 0xffffffff)
+      return false;
+  }
+  return sse2::iequals(a + i, b + i, size - i);
+}
+
+MUTILS_TARGET("avx2")
+inline void flip_case(char *data, size_t size, char lo) {
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    auto *p = reinterpret_cast<__m256i *>(data + i);
+    __m256i v = _mm256_loadu_si256(p);
+    v = _mm256_xor_si256(
+        v, _mm256_and_si256(in_alpha_range(v, lo), _mm256_set1_epi8(0x20)));
+    _mm256_storeu_si256(p, v);
+  }
+  sse2::flip_case(data + i, size - i, lo);
+}
+
+inline void to_lower(char *data, size_t size) { flip_case(data, size, 'A'); }
+inline void to_upper(char *data, size_t size) { flip_case(data, size, 'a'); }
+} // namespace avx2
+#endif // MUTILS_X86
+
+#if MUTILS_NEON
+namespace neon {
+inline uint8x16_t in_alpha_range(uint8x16_t v, char lo) {
+  return vcleq_u8(vsubq_u8(v, vdupq_n_u8(static_cast<uint8_t>(lo))),
+                  vdupq_n_u8(25));
+}
+
+inline uint8x16_t flip(uint8x16_t v, char lo) {
+  return veorq_u8(v, vandq_u8(in_alpha_range(v, lo), vdupq_n_u8(0x20)));
+}
+
+inline const uint8_t *bytes(const char *p) {
+  return reinterpret_cast<const uint8_t *>(p);
+}
+
+inline const char *find_any(const char *first, const char *last,
+                            const ByteSet &set) {
+  if (!set.listed())
+    return scalar::find_any(first, last, set);
+  for (; last - first >= 16; first += 16) {
+    uint8x16_t chunk = vld1q_u8(bytes(first));
+    uint8x16_t hits = vdupq_n_u8(0);
+    for (size_t i = 0; i < set.size(); ++i)
+      hits = vorrq_u8(
+          hits, vceqq_u8(chunk, vdupq_n_u8(static_cast<uint8_t>(set[i]))));
+    uint64_t mask = vget_lane_u64(
+        vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hits), 4)), 0);
+    if (mask)
+      return first + (std::countr_zero(mask) >> 2);
+  }
+  return scalar::find_any(first, last, set);
+}
+
+inline size_t count_byte(const char *first, const char *last, char c) {
+  const uint8x16_t needle = vdupq_n_u8(static_cast<uint8_t>(c));
+  size_t count = 0;
+  while (last - first >= 16) {
+    size_t blocks = std::min<size_t>((last - first) / 16, 255);
+    uint8x16_t acc = vdupq_n_u8(0);
+    for (size_t i = 0; i < blocks; ++i, first += 16)
+      acc = vsubq_u8(acc, vceqq_u8(vld1q_u8(bytes(first)), needle));
+    count += vaddlvq_u8(acc);
+  }
+  return count + scalar::count_byte(first, last, c);
+}
+
+inline bool iequals(const char *a, const char *b, size_t size) {
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    uint8x16_t eq = vceqq_u8(flip(vld1q_u8(bytes(a + i)), 'A'),
+                             flip(vld1q_u8(bytes(b + i)), 'A'));
+    if (vminvq_u8(eq) != 0xff)
+      return false;
+  }
+  return scalar::iequals(a + i, b + i, size - i);
+}
+
+inline void flip_case(char *data, size_t size, char lo) {
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    auto *p = reinterpret_cast<uint8_t *>(data + i);
+    vst1q_u8(p, flip(vld1q_u8(p), lo));
+  }
+  lo == 'A' ? scalar::to_lower(data + i, size - i)
+            : scalar::to_upper(data + i, size - i);
+}
+
+inline void to_lower(char *data, size_t size) { flip_case(data, size, 'A'); }
+inline void to_upper(char *data, size_t size) { flip_case(data, size, 'a'); }
+} // namespace neon
+#endif // MUTILS_NEON
+
+enum class Isa { SCALAR, SSE2, AVX2, NEON };
+
+inline constexpr std::string_view isa_name(Isa isa) {
+  switch (isa) {
+  case Isa::SSE2:
+    return "sse2";
+  case Isa::AVX2:
+    return "avx2";
+  case Isa::NEON:
+    return "neon";
+  default:
+    return "scalar";
+  }
+}
+
+// Best instruction set the running CPU supports.
+inline Isa detect_isa() {
+#if MUTILS_X86
+#if defined(__GNUC__) || defined(__clang__)
+  if (__builtin_cpu_supports("avx2"))
+    return Isa::AVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return Isa::SSE2;
+#elif defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  int max_leaf = info[0];
+  __cpuid(info, 1);
+  bool sse2 = info[3] & (1 << 26);
+  bool os_avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) &&
+                (_xgetbv(0) & 6) == 6;
+  if (os_avx && max_leaf >= 7) {
+    __cpuidex(info, 7, 0);
+    if (info[1] & (1 << 5))
+      return Isa::AVX2;
+  }
+  if (sse2)
+    return Isa::SSE2;
+#endif
+  return Isa::SCALAR;
+#elif MUTILS_NEON
+  return Isa::NEON;
+#else
+  return Isa::SCALAR;
+#endif
+}
+
+struct Kernels {
+  Isa isa;
+  const char *(*find_any)(const char *, const char *, const ByteSet &);
+  size_t (*count_byte)(const char *, const char *, char);
+  bool (*iequals)(const char *, const char *, size_t);
+  void (*to_lower)(char *, size_t);
+  void (*to_upper)(char *, size_t);
+};
+
+// Kernel table for `isa`, falling back to scalar for instruction sets this
+// build has no kernels for. Mostly useful to benchmark one against another.
+inline Kernels kernels_for(Isa isa) {
+  switch (isa) {
+#if MUTILS_X86
+  case Isa::AVX2:
+    return {isa,          &avx2::find_any, &avx2::count_byte,
+            &avx2::iequals, &avx2::to_lower, &avx2::to_upper};
+  case Isa::SSE2:
+    return {isa,          &sse2::find_any, &sse2::count_byte,
+            &sse2::iequals, &sse2::to_lower, &sse2::to_upper};
+#endif
+#if MUTILS_NEON
+  case Isa::NEON:
+    return {isa,          &neon::find_any, &neon::count_byte,
+            &neon::iequals, &neon::to_lower, &neon::to_upper};
+#endif
+  default:
+    return {Isa::SCALAR,    &scalar::find_any, &scalar::count_byte,
+            &scalar::iequals, &scalar::to_lower, &scalar::to_upper};
+  }
+}
+
+// Kernels for the running CPU, selected on first use.
+inline const Kernels &kernels() {
+  static const Kernels selected = kernels_for(detect_isa());
+  return selected;
+}
+
+// Returns a pointer to the first byte of [first, last) that is in `set`, or
+// `last`.
+inline const char *find_any(const char *first, const char *last,
+                            const ByteSet &set) {
+  return kernels().find_any(first, last, set);
+}
+
+inline size_t count_byte(const char *first, const char *last, char c) {
+  return kernels().count_byte(first, last, c);
+}
+
+} // namespace mutils::simd
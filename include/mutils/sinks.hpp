@@ -0,0 +1,387 @@
+#pragma once
+
+#include "logger.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+// Ready-made Sink implementations for Logger::add_sink. None of them log
+// from write(): that would recurse into the sinks.
+namespace mutils {
+// Keeps the last `capacity` lines in memory, e.g. to attach to a crash
+// report. Slots are reused, so a warmed-up sink does not allocate.
+class MemorySink : public Sink {
+public:
+  explicit MemorySink(size_t capacity)
+      : lines_(std::max<size_t>(capacity, 1)) {}
+
+  void write(LogLevel, std::string_view line) override {
+    std::lock_guard lock(mtx_);
+    lines_[next_ % lines_.size()].assign(line);
+    ++next_;
+  }
+
+  // Oldest first.
+  std::vector<std::string> lines() const {
+    std::lock_guard lock(mtx_);
+    std::vector<std::string> out;
+    size_t count = std::min<uint64_t>(next_, lines_.size());
+    out.reserve(count);
+    for (uint64_t i = next_ - count; i < next_; ++i)
+      out.push_back(lines_[i % lines_.size()]);
+    return out;
+  }
+
+private:
+  mutable std::mutex mtx_;
+  std::vector<std::string> lines_;
+  uint64_t next_ = 0;
+};
+
+// Moves another sink off the logging threads: write() only queues a copy of
+// the line, and a thread of its own feeds the target. When `max_queued`
+// lines are waiting, new ones are dropped and counted instead of blocking.
+class AsyncSink : public Sink {
+public:
+  explicit AsyncSink(std::shared_ptr<Sink> target, size_t max_queued = 8192)
+      : target_(std::move(target)), max_queued_(max_queued),
+        worker_([this] { run(); }) {}
+
+  AsyncSink(const AsyncSink &) = delete;
+  AsyncSink &operator=(const AsyncSink &) = delete;
+
+  // Delivers what is still queued before returning.
+  ~AsyncSink() override {
+    {
+      std::lock_guard lock(mtx_);
+      stop_ = true;
+    }
+    wake_.notify_one();
+    worker_.join();
+  }
+
+  void write(LogLevel level, std::string_view line) override {
+    {
+      std::lock_guard lock(mtx_);
+      if (queue_.size() >= max_queued_) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      queue_.emplace_back(level, std::string(line));
+    }
+    wake_.notify_one();
+  }
+
+  // Waits for the queue to drain, then flushes the target.
+  void flush() override {
+    std::unique_lock lock(mtx_);
+    uint64_t ticket = queued_total_ + queue_.size();
+    flush_requested_ = true;
+    wake_.notify_one();
+    idle_.wait(lock, [&] { return written_total_ >= ticket; });
+  }
+
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+  void run() {
+    std::deque<std::pair<LogLevel, std::string>> batch;
+    std::unique_lock lock(mtx_);
+    for (;;) {
+      wake_.wait(lock,
+                 [&] { return stop_ || flush_requested_ || !queue_.empty(); });
+      batch.swap(queue_);
+      bool flush = std::exchange(flush_requested_, false);
+      bool stopping = stop_;
+      queued_total_ += batch.size();
+      lock.unlock();
+
+      for (auto &[level, line] : batch)
+        target_->write(level, line);
+      if (flush || stopping)
+        target_->flush();
+
+      lock.lock();
+      written_total_ += batch.size();
+      batch.clear();
+      idle_.notify_all();
+      if (stopping && queue_.empty())
+        return;
+    }
+  }
+
+  std::shared_ptr<Sink> target_;
+  size_t max_queued_;
+  std::mutex mtx_;
+  std::condition_variable wake_;
+  std::condition_variable idle_;
+  std::deque<std::pair<LogLevel, std::string>> queue_;
+  uint64_t queued_total_ = 0;  // lines taken off queue_ by the worker
+  uint64_t written_total_ = 0; // of those, lines handed to the target
+  bool flush_requested_ = false;
+  bool stop_ = false;
+  std::atomic<uint64_t> dropped_{0};
+  std::thread worker_; // last, so it starts after the members it uses
+};
+
+#ifndef _WIN32
+// RFC 5424 severity; <syslog.h> is not included because its LOG_ERR and
+// LOG_DEBUG macros collide with ours.
+inline int syslog_severity(LogLevel level) {
+  switch (level) {
+  case LogLevel::DEBUG:
+    return 7;
+  case LogLevel::WARN:
+    return 4;
+  case LogLevel::ERR:
+    return 3;
+  default:
+    return 6;
+  }
+}
+
+// Sends every line as one datagram, over UDP or a Unix datagram socket.
+// Sending never blocks; lines the socket cannot take are counted as
+// dropped. Use the factories; they return null (and log why) on failure.
+class SocketSink : public Sink {
+public:
+  enum class Protocol {
+    PLAIN,    // the line as is
+    SYSLOG,   // "<priority>tag: line", understood by syslog daemons
+    JOURNALD, // systemd-journald's native protocol
+  };
+
+  static std::shared_ptr<SocketSink> udp(const std::string &host,
+                                         const std::string &port,
+                                         Protocol protocol = Protocol::PLAIN);
+
+  static std::shared_ptr<SocketSink>
+  unix_datagram(const std::string &path, Protocol protocol = Protocol::PLAIN);
+
+  static std::shared_ptr<SocketSink> journald() {
+    return unix_datagram("/run/systemd/journal/socket", Protocol::JOURNALD);
+  }
+
+  // The local syslog daemon (or journald, which also listens there), with
+  // lines tagged "ident[pid]" and the user facility.
+  static std::shared_ptr<SocketSink> syslog(std::string_view ident);
+
+  MUTILS_INLINE ~SocketSink() override;
+
+  MUTILS_INLINE void write(LogLevel level, std::string_view line) override;
+
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+  SocketSink(int fd, Protocol protocol) : fd_(fd), protocol_(protocol) {}
+
+  static std::shared_ptr<SocketSink> connect_(int family, const sockaddr *addr,
+                                              socklen_t size,
+                                              Protocol protocol);
+
+  void encode_(LogLevel level, std::string_view line);
+
+  static constexpr int user_facility = 1 << 3;
+
+  int fd_;
+  Protocol protocol_;
+  std::string tag_;
+  std::mutex mtx_;
+  std::string packet_;
+  std::atomic<uint64_t> dropped_{0};
+};
+
+struct FlightRecorderOptions {
+  size_t lines_per_thread = 256;
+  // Longer lines are cut off.
+  size_t max_line = 248;
+  // Threads beyond this many share rings with earlier ones.
+  size_t max_threads = 64;
+  // Maps this file instead of anonymous memory, so the lines outlive even a
+  // SIGKILL or a power-cycled container and can be read back with read().
+  std::filesystem::path file{};
+};
+
+// Keeps the last lines of each thread in a fixed block of memory, so that a
+// crash leaves some context behind without every line being flushed to the
+// file. write() takes no lock: a thread appends to its own ring and only
+// publishes a slot once it is complete. After install_crash_handlers(),
+// SIGSEGV, SIGBUS, SIGILL, SIGFPE and SIGABRT print the rings to stderr
+// with plain write() calls before the signal goes on to whatever handled it
+// before (the default action, a sanitizer, another crash reporter).
+//
+// Lines reach sinks on the thread that logged them, except in async mode,
+// where they all arrive from the backend and share one ring; lines still
+// queued for the backend when the process dies are not in the recorder.
+class FlightRecorder : public Sink {
+public:
+  // Returns null (and logs why) if the memory or file cannot be mapped.
+  static std::shared_ptr<FlightRecorder>
+  create(const FlightRecorderOptions &opts = {});
+
+  MUTILS_INLINE ~FlightRecorder() override;
+
+  FlightRecorder(const FlightRecorder &) = delete;
+  FlightRecorder &operator=(const FlightRecorder &) = delete;
+
+  void write(LogLevel, std::string_view line) override {
+    const Layout &layout = header_()->layout;
+    Ring *ring = this_thread_ring_();
+    uint64_t n = ring->next.fetch_add(1, std::memory_order_relaxed);
+    char *slot = layout.slot(ring, n % layout.slots);
+    auto *size = reinterpret_cast<std::atomic<uint32_t> *>(slot);
+    size_t len = std::min<size_t>(line.size(), layout.max_line);
+    // 0 while the text is being replaced, else the length plus one. A dump
+    // from another thread may still catch a slot mid-rewrite: it is a
+    // best effort, taken while the process is going down.
+    size->store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(slot + sizeof(uint32_t), line.data(), len);
+    size->store(static_cast<uint32_t>(len + 1), std::memory_order_release);
+  }
+
+  // The recorded lines, oldest first within each thread's ring.
+  std::vector<std::string> lines() const {
+    std::vector<std::string> out;
+    collect_(base_, [&](std::string_view line) { out.emplace_back(line); });
+    return out;
+  }
+
+  // Writes the recorded lines to `fd`. Async-signal-safe.
+  void dump(int fd) const noexcept {
+    detail::write_line(fd, "--- flight recorder: last logged lines ---");
+    collect_(base_, [&](std::string_view line) {
+      detail::write_line(fd, line);
+    });
+    detail::write_line(fd, "--- end of flight recorder ---");
+  }
+
+  // Dumps this recorder to stderr on a crash, then restores the handler
+  // found here and re-raises the signal for it. The handlers stay installed
+  // for the life of the process and do nothing once it is destroyed; they
+  // run on the alternate signal stack if the crashing thread has one.
+  void install_crash_handlers();
+
+  // Reads back the file of a recorder created with `file` set, typically
+  // after the process that wrote it died.
+  static std::optional<std::vector<std::string>>
+  read(const std::filesystem::path &path);
+
+private:
+  static constexpr char magic[8] = {'M', 'U', 'F', 'L', 'I', 'G', 'H', 'T'};
+
+  // A ring is a cache line holding the write count, then `slots` slots of
+  // slot_size() bytes: a std::atomic<uint32_t> length, then the text.
+  struct Layout {
+    uint32_t rings;
+    uint32_t slots;
+    uint32_t max_line;
+
+    size_t slot_size() const {
+      return (max_line + sizeof(uint32_t) + 7) / 8 * 8;
+    }
+    size_t ring_bytes() const {
+      return (sizeof(Ring) + slots * slot_size() + 63) / 64 * 64;
+    }
+    size_t total_bytes() const { return sizeof(Header) + rings * ring_bytes(); }
+
+    char *ring(char *base, uint32_t i) const {
+      return base + sizeof(Header) + i * ring_bytes();
+    }
+    const char *ring(const char *base, uint32_t i) const {
+      return base + sizeof(Header) + i * ring_bytes();
+    }
+    char *slot(void *ring, uint64_t i) const {
+      return static_cast<char *>(ring) + sizeof(Ring) + i * slot_size();
+    }
+    const char *slot(const void *ring, uint64_t i) const {
+      return static_cast<const char *>(ring) + sizeof(Ring) + i * slot_size();
+    }
+    bool valid() const { return rings > 0 && slots > 0; }
+  };
+
+  struct alignas(64) Header {
+    char magic[8];
+    Layout layout;
+  };
+
+  struct alignas(64) Ring {
+    std::atomic<uint64_t> next{0}; // lines ever written
+  };
+
+  static_assert(std::atomic<uint64_t>::is_always_lock_free &&
+                std::atomic<uint32_t>::is_always_lock_free);
+
+  FlightRecorder(char *base, size_t size)
+      : base_(base), size_(size),
+        id_(next_id_.fetch_add(1, std::memory_order_relaxed)) {}
+
+  const Header *header_() const { return reinterpret_cast<Header *>(base_); }
+
+  // Threads are dealt rings in the order they first log.
+  Ring *this_thread_ring_() {
+    thread_local uint64_t owner = 0;
+    thread_local uint32_t index = 0;
+    const Layout &layout = header_()->layout;
+    if (owner != id_) {
+      owner = id_;
+      index = next_ring_.fetch_add(1, std::memory_order_relaxed) %
+              layout.rings;
+    }
+    return reinterpret_cast<Ring *>(layout.ring(base_, index));
+  }
+
+  template <typename Fn> static void collect_(const char *base, Fn &&fn) {
+    const Layout layout = reinterpret_cast<const Header *>(base)->layout;
+    for (uint32_t r = 0; r < layout.rings; ++r) {
+      auto *ring = reinterpret_cast<const Ring *>(layout.ring(base, r));
+      uint64_t end = ring->next.load(std::memory_order_acquire);
+      uint64_t begin = end > layout.slots ? end - layout.slots : 0;
+      for (uint64_t i = begin; i < end; ++i) {
+        const char *slot = layout.slot(ring, i % layout.slots);
+        uint32_t size =
+            reinterpret_cast<const std::atomic<uint32_t> *>(slot)->load(
+                std::memory_order_acquire);
+        // skips a slot being rewritten, or never written if a writer
+        // claimed it and died
+        if (size > 0 && size - 1 <= layout.max_line)
+          fn(std::string_view(slot + sizeof(uint32_t), size - 1));
+      }
+    }
+  }
+
+  static void on_crash_(int sig);
+
+  static inline std::atomic<FlightRecorder *> crash_recorder_{nullptr};
+  static inline std::atomic<uint64_t> next_id_{1};
+
+  char *base_;
+  size_t size_;
+  uint64_t id_;
+  std::atomic<uint32_t> next_ring_{0};
+};
+#endif
+} // namespace mutils
+
+#ifndef MUTILS_COMPILED_LIB
+#include "sinks_impl.hpp"
+#endif
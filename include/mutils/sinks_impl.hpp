@@ -0,0 +1,228 @@
+#pragma once
+
+// Out-of-line parts of sinks.hpp: included at its end, or compiled once
+// into the library by src/mutils.cpp when MUTILS_COMPILED_LIB is defined.
+#include "sinks.hpp"
+
+#ifndef _WIN32
+#include <csignal>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+namespace mutils {
+namespace detail {
+inline constexpr int crash_signals[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE,
+                                        SIGABRT};
+// What FlightRecorder::install_crash_handlers() replaced, per signal.
+MUTILS_INLINE struct sigaction previous_crash_actions[std::size(crash_signals)];
+} // namespace detail
+
+MUTILS_INLINE std::shared_ptr<SocketSink>
+SocketSink::udp(const std::string &host, const std::string &port,
+                Protocol protocol) {
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  addrinfo *found = nullptr;
+  if (int rc = getaddrinfo(host.c_str(), port.c_str(), &hints, &found)) {
+    LOG_ERR("Failed to resolve {}:{} - {}", host, port, gai_strerror(rc));
+    return nullptr;
+  }
+  std::shared_ptr<SocketSink> sink;
+  for (auto *ai = found; ai && !sink; ai = ai->ai_next)
+    sink = connect_(ai->ai_family, ai->ai_addr, ai->ai_addrlen, protocol);
+  freeaddrinfo(found);
+  if (!sink)
+    LOG_ERR("Failed to connect to {}:{} - {}", host, port,
+            std::system_category().message(errno));
+  return sink;
+}
+
+MUTILS_INLINE std::shared_ptr<SocketSink>
+SocketSink::unix_datagram(const std::string &path, Protocol protocol) {
+  sockaddr_un addr{};
+  if (path.size() >= sizeof(addr.sun_path)) {
+    LOG_ERR("Socket path too long: {}", path);
+    return nullptr;
+  }
+  addr.sun_family = AF_UNIX;
+  std::memcpy(addr.sun_path, path.data(), path.size());
+  auto sink = connect_(AF_UNIX, reinterpret_cast<sockaddr *>(&addr),
+                       sizeof(addr), protocol);
+  if (!sink)
+    LOG_ERR("Failed to connect to {} - {}", path,
+            std::system_category().message(errno));
+  return sink;
+}
+
+MUTILS_INLINE std::shared_ptr<SocketSink>
+SocketSink::syslog(std::string_view ident) {
+  auto sink = unix_datagram("/dev/log", Protocol::SYSLOG);
+  if (sink)
+    sink->tag_ = std::format("{}[{}]: ", ident, ::getpid());
+  return sink;
+}
+
+MUTILS_INLINE SocketSink::~SocketSink() { ::close(fd_); }
+
+MUTILS_INLINE void SocketSink::write(LogLevel level, std::string_view line) {
+  std::lock_guard lock(mtx_);
+  encode_(level, line);
+  if (::send(fd_, packet_.data(), packet_.size(),
+             MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+}
+
+MUTILS_INLINE std::shared_ptr<SocketSink>
+SocketSink::connect_(int family, const sockaddr *addr, socklen_t size,
+                     Protocol protocol) {
+  int fd = ::socket(family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return nullptr;
+  if (::connect(fd, addr, size) < 0) {
+    int err = errno;
+    ::close(fd);
+    errno = err;
+    return nullptr;
+  }
+  return std::shared_ptr<SocketSink>(new SocketSink(fd, protocol));
+}
+
+MUTILS_INLINE void SocketSink::encode_(LogLevel level, std::string_view line) {
+  packet_.clear();
+  switch (protocol_) {
+  case Protocol::PLAIN:
+    packet_ += line;
+    break;
+  case Protocol::SYSLOG:
+    packet_ += std::format("<{}>", user_facility | syslog_severity(level));
+    packet_ += tag_;
+    packet_ += line;
+    break;
+  case Protocol::JOURNALD: {
+    packet_ += std::format("PRIORITY={}\n", syslog_severity(level));
+    // MESSAGE may span lines, so use the length-prefixed form
+    uint64_t size = line.size();
+    packet_ += "MESSAGE\n";
+    for (int i = 0; i < 8; ++i)
+      packet_ += static_cast<char>((size >> (i * 8)) & 0xff);
+    packet_ += line;
+    packet_ += '\n';
+    break;
+  }
+  }
+}
+
+MUTILS_INLINE std::shared_ptr<FlightRecorder>
+FlightRecorder::create(const FlightRecorderOptions &opts) {
+  Layout layout{
+      static_cast<uint32_t>(std::clamp<size_t>(opts.max_threads, 1, 4096)),
+      static_cast<uint32_t>(
+          std::clamp<size_t>(opts.lines_per_thread, 1, 1 << 20)),
+      static_cast<uint32_t>(std::min<size_t>(opts.max_line, 1 << 16))};
+  size_t size = layout.total_bytes();
+
+  int fd = -1;
+  if (!opts.file.empty()) {
+    fd = ::open(opts.file.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0644);
+    if (fd < 0 || ::ftruncate(fd, static_cast<off_t>(size)) < 0) {
+      LOG_ERR("Failed to create flight recorder file {} - {}",
+              opts.file.string(), std::system_category().message(errno));
+      if (fd >= 0)
+        ::close(fd);
+      return nullptr;
+    }
+  }
+  void *base = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      fd >= 0 ? MAP_SHARED : MAP_PRIVATE | MAP_ANONYMOUS,
+                      fd, 0);
+  int map_errno = errno;
+  if (fd >= 0)
+    ::close(fd); // the mapping keeps the file
+  if (base == MAP_FAILED) {
+    LOG_ERR("Failed to map {} bytes for the flight recorder - {}", size,
+            std::system_category().message(map_errno));
+    return nullptr;
+  }
+
+  auto *header = new (base) Header{};
+  std::memcpy(header->magic, magic, sizeof(magic));
+  header->layout = layout;
+  for (uint32_t i = 0; i < layout.rings; ++i)
+    new (layout.ring(static_cast<char *>(base), i)) Ring{};
+  return std::shared_ptr<FlightRecorder>(
+      new FlightRecorder(static_cast<char *>(base), size));
+}
+
+MUTILS_INLINE FlightRecorder::~FlightRecorder() {
+  FlightRecorder *self = this;
+  crash_recorder_.compare_exchange_strong(self, nullptr);
+  ::munmap(base_, size_);
+}
+
+MUTILS_INLINE void FlightRecorder::install_crash_handlers() {
+  crash_recorder_.store(this, std::memory_order_release);
+  struct sigaction action{};
+  action.sa_handler = on_crash_;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESETHAND | SA_ONSTACK;
+  for (size_t i = 0; i < std::size(detail::crash_signals); ++i) {
+    struct sigaction previous{};
+    ::sigaction(detail::crash_signals[i], &action, &previous);
+    // a second call must not chain to ourselves
+    if ((previous.sa_flags & SA_SIGINFO) || previous.sa_handler != on_crash_)
+      detail::previous_crash_actions[i] = previous;
+  }
+}
+
+MUTILS_INLINE std::optional<std::vector<std::string>>
+FlightRecorder::read(const std::filesystem::path &path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st{};
+  if (fd < 0 || ::fstat(fd, &st) < 0) {
+    LOG_ERR("Failed to open flight recorder file {} - {}", path.string(),
+            std::system_category().message(errno));
+    if (fd >= 0)
+      ::close(fd);
+    return std::nullopt;
+  }
+  auto size = static_cast<size_t>(st.st_size);
+  void *base = size >= sizeof(Header)
+                   ? ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0)
+                   : MAP_FAILED;
+  ::close(fd);
+  if (base == MAP_FAILED) {
+    LOG_ERR("Failed to map flight recorder file {}", path.string());
+    return std::nullopt;
+  }
+  const auto *header = static_cast<const Header *>(base);
+  if (std::memcmp(header->magic, magic, sizeof(magic)) != 0 ||
+      !header->layout.valid() || header->layout.total_bytes() != size) {
+    ::munmap(base, size);
+    LOG_ERR("{} is not a flight recorder file", path.string());
+    return std::nullopt;
+  }
+  std::vector<std::string> out;
+  collect_(static_cast<const char *>(base),
+           [&](std::string_view line) { out.emplace_back(line); });
+  ::munmap(base, size);
+  return out;
+}
+
+MUTILS_INLINE void FlightRecorder::on_crash_(int sig) {
+  int saved = errno;
+  if (auto *recorder = crash_recorder_.load(std::memory_order_acquire))
+    recorder->dump(STDERR_FILENO);
+  for (size_t i = 0; i < std::size(detail::crash_signals); ++i)
+    if (detail::crash_signals[i] == sig)
+      ::sigaction(sig, &detail::previous_crash_actions[i], nullptr);
+  errno = saved;
+  // delivered to the previous handler once we return
+  ::raise(sig);
+}
+} // namespace mutils
+#endif
@@ -1,35 +1,438 @@
 #pragma once
 
-#include <sstream>
+#include "simd.hpp"
+#include <array>
+#include <bit>
+#include <charconv>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <memory_resource>
+#include <optional>
+#include <ranges>
+#include <span>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace mutils {
-// Trim leading and trailing whitespace from a string
-inline std::string trim(const std::string &s) {
+// Trim leading and trailing whitespace from a string without copying it
+inline std::string_view trim_view(std::string_view s) {
   size_t start = s.find_first_not_of(" \t\r\n");
+  if (start == std::string_view::npos)
+    return {};
   size_t end = s.find_last_not_of(" \t\r\n");
-  return start == std::string::npos ? "" : s.substr(start, end - start + 1);
+  return s.substr(start, end - start + 1);
+}
+
+// Trim leading and trailing whitespace from a string
+inline std::string trim(const std::string &s) {
+  return std::string(trim_view(s));
+}
+
+namespace detail {
+// Delimiter policies for SplitRange. find() returns the first delimiter in
+// [first, last) and its length, or {last, 0}.
+struct CharDelim {
+  char c;
+
+  std::pair<const char *, size_t> find(const char *first,
+                                       const char *last) const {
+    return {simd::find_byte(first, last, c), 1};
+  }
+};
+
+struct SequenceDelim {
+  std::string_view seq;
+
+  std::pair<const char *, size_t> find(const char *first,
+                                       const char *last) const {
+    if (seq.empty())
+      return {last, 0};
+    while (static_cast<size_t>(last - first) >= seq.size()) {
+      first = simd::find_byte(first, last - seq.size() + 1, seq.front());
+      if (first == last - seq.size() + 1)
+        break;
+      if (std::memcmp(first + 1, seq.data() + 1, seq.size() - 1) == 0)
+        return {first, seq.size()};
+      ++first;
+    }
+    return {last, 0};
+  }
+};
+
+struct AnyOfDelim {
+  simd::ByteSet set;
+
+  std::pair<const char *, size_t> find(const char *first,
+                                       const char *last) const {
+    return {simd::find_any(first, last, set), 1};
+  }
+};
+} // namespace detail
+
+// Lazy range of the tokens between delimiters, as views into the input.
+// Follows split(): a trailing empty token is not produced, so "a,b," yields
+// "a" and "b", while ",a" yields "" and "a".
+template <typename Delim>
+class SplitRange : public std::ranges::view_interface<SplitRange<Delim>> {
+public:
+  SplitRange() = default;
+  SplitRange(std::string_view str, Delim delim)
+      : str_(str), delim_(std::move(delim)) {}
+
+  class Iterator {
+  public:
+    using value_type = std::string_view;
+    using difference_type = std::ptrdiff_t;
+    using iterator_concept = std::forward_iterator_tag;
+    using iterator_category = std::input_iterator_tag;
+
+    Iterator() = default;
+    Iterator(const char *first, const char *last, const Delim &delim)
+        : last_(last), delim_(delim) {
+      if (first != last)
+        advance(first);
+    }
+
+    std::string_view operator*() const { return token_; }
+
+    Iterator &operator++() {
+      if (next_ == last_)
+        token_ = {};
+      else
+        advance(next_);
+      return *this;
+    }
+
+    Iterator operator++(int) {
+      auto tmp = *this;
+      ++*this;
+      return tmp;
+    }
+
+    // the end iterator is the only one with a null token
+    bool operator==(const Iterator &other) const {
+      return token_.data() == other.token_.data();
+    }
+
+  private:
+    void advance(const char *first) {
+      auto [at, len] = delim_.find(first, last_);
+      token_ = {first, static_cast<size_t>(at - first)};
+      next_ = at == last_ ? last_ : at + len;
+    }
+
+    std::string_view token_;
+    const char *next_ = nullptr;
+    const char *last_ = nullptr;
+    // held by value so iterators stay valid after the range is gone
+    Delim delim_{};
+  };
+
+  Iterator begin() const {
+    return Iterator(str_.data(), str_.data() + str_.size(), delim_);
+  }
+  Iterator end() const { return Iterator(); }
+
+private:
+  std::string_view str_;
+  Delim delim_;
+};
+
+// Split on a single character, without allocating
+inline SplitRange<detail::CharDelim> split_view(std::string_view s,
+                                                char delim) {
+  return {s, detail::CharDelim{delim}};
+}
+
+// Split on a multi-character delimiter, without allocating
+inline SplitRange<detail::SequenceDelim> split_view(std::string_view s,
+                                                    std::string_view delim) {
+  return {s, detail::SequenceDelim{delim}};
+}
+
+// Split on any of the characters in `delims`, without allocating
+inline SplitRange<detail::AnyOfDelim> split_any_view(std::string_view s,
+                                                     std::string_view delims) {
+  return {s, detail::AnyOfDelim{simd::ByteSet(delims)}};
 }
 
-// Split a string by a delimiter and return a vector of trimmed tokens
+// Writes up to out.size() tokens into `out` and returns the total number of
+// tokens in `s`, so a result larger than out.size() means it was truncated.
+template <typename Delim>
+size_t split_into(std::string_view s, Delim delim,
+                  std::span<std::string_view> out) {
+  size_t count = 0;
+  for (auto token : split_view(s, delim)) {
+    if (count < out.size())
+      out[count] = token;
+    ++count;
+  }
+  return count;
+}
+
+// Replaces the contents of `out` with the tokens of `s`, reusing its
+// capacity across calls. Works with std::pmr::vector too.
+template <typename Delim, typename Alloc>
+void split_into(std::string_view s, Delim delim,
+                std::vector<std::string_view, Alloc> &out) {
+  out.clear();
+  for (auto token : split_view(s, delim))
+    out.push_back(token);
+}
+
+// Split a string by a delimiter and return a vector of tokens
 inline std::vector<std::string> split(const std::string &s, char delim) {
   std::vector<std::string> result;
-  std::stringstream ss(s);
-  std::string token;
-  while (std::getline(ss, token, delim))
-    result.push_back(token);
+  for (auto token : split_view(s, delim))
+    result.emplace_back(token);
+  return result;
+}
+
+// Like split(), with the vector and the strings allocated from `resource`,
+// e.g. a request's Arena.
+inline std::pmr::vector<std::pmr::string>
+split(std::string_view s, char delim, std::pmr::memory_resource *resource) {
+  std::pmr::vector<std::pmr::string> result(resource);
+  for (auto token : split_view(s, delim))
+    result.emplace_back(token);
   return result;
 }
 
 // Check if a string starts with a given prefix
-inline bool startsWith(const std::string &s, const std::string &prefix) {
-  return s.size() >= prefix.size() && s.compare(0, prefix.size(), prefix) == 0;
+inline bool startsWith(std::string_view s, std::string_view prefix) {
+  return s.starts_with(prefix);
 }
 
 // Check if a string ends with a given suffix
-inline bool endsWith(const std::string &s, const std::string &suffix) {
-  return s.size() >= suffix.size() &&
-         s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+inline bool endsWith(std::string_view s, std::string_view suffix) {
+  return s.ends_with(suffix);
+}
+
+// The helpers below run vectorized kernels picked at runtime for the CPU
+// (see simd::kernels()); they only treat ASCII letters as having a case.
+
+// Position of the first character of `s` that is in `set`, or npos
+inline size_t find_any_of(std::string_view s, const simd::ByteSet &set) {
+  const char *last = s.data() + s.size();
+  const char *hit = simd::find_any(s.data(), last, set);
+  return hit == last ? std::string_view::npos
+                     : static_cast<size_t>(hit - s.data());
+}
+
+// Position of the first character of `s` that is in `chars`, or npos
+inline size_t find_any_of(std::string_view s, std::string_view chars) {
+  return find_any_of(s, simd::ByteSet(chars));
+}
+
+// Number of occurrences of `c` in `s`, e.g. to count lines before reserving
+inline size_t count_byte(std::string_view s, char c) {
+  return simd::count_byte(s.data(), s.data() + s.size(), c);
+}
+
+// ASCII case-insensitive equality
+inline bool iequals(std::string_view a, std::string_view b) {
+  return a.size() == b.size() &&
+         simd::kernels().iequals(a.data(), b.data(), a.size());
+}
+
+// ASCII lowercase in place
+inline void to_lower_ascii(std::span<char> s) {
+  simd::kernels().to_lower(s.data(), s.size());
+}
+
+// ASCII uppercase in place
+inline void to_upper_ascii(std::span<char> s) {
+  simd::kernels().to_upper(s.data(), s.size());
+}
+
+// Appends `s` to `out` as a quoted JSON string
+inline void append_json_string(std::string &out, std::string_view s) {
+  out += '"';
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      static constexpr char hex[] = "0123456789abcdef";
+      out += "\\u00";
+      out += hex[(c >> 4) & 0xf];
+      out += hex[c & 0xf];
+    } else {
+      out += c;
+    }
+  }
+  out += '"';
+}
+
+// Numbers. parse() and friends take the whole field: no whitespace (see
+// trim_view), no locale, no exceptions, and no std::string to build first.
+
+namespace detail {
+// True if the 8 bytes of `v` are all ASCII digits.
+inline bool all_digits8(uint64_t v) {
+  return ((v & 0xF0F0F0F0F0F0F0F0) |
+          (((v + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) ==
+         0x3333333333333333;
+}
+
+// Value of the 8 digits of `v`, loaded from memory on a little-endian
+// machine: pairs, then quads, then both halves are combined in place.
+inline uint32_t digits8_value(uint64_t v) {
+  v -= 0x3030303030303030;
+  v = (v * 10 + (v >> 8)) & 0x00FF00FF00FF00FF;
+  v = (v * 100 + (v >> 16)) & 0x0000FFFF0000FFFF;
+  v = (v * 10000 + (v >> 32)) & 0x00000000FFFFFFFF;
+  return static_cast<uint32_t>(v);
+}
+
+// Digits only, at most 19 of them, so the value cannot overflow.
+inline bool parse_digits(std::string_view s, uint64_t &out) {
+  const char *p = s.data();
+  size_t n = s.size();
+  uint64_t value = 0;
+  if constexpr (std::endian::native == std::endian::little) {
+    for (; n >= 8; p += 8, n -= 8) {
+      uint64_t chunk;
+      std::memcpy(&chunk, p, 8);
+      if (!all_digits8(chunk))
+        return false;
+      value = value * 100000000 + digits8_value(chunk);
+    }
+  }
+  for (; n > 0; ++p, --n) {
+    auto digit = static_cast<unsigned>(*p - '0');
+    if (digit > 9)
+      return false;
+    value = value * 10 + digit;
+  }
+  out = value;
+  return true;
+}
+
+template <typename T>
+concept Parsable = std::is_arithmetic_v<T> && !std::is_same_v<T, bool>;
+
+template <Parsable T> bool parse_number(std::string_view s, T &out) {
+  // accept what printf-style writers produce, which from_chars does not
+  if (s.size() > 1 && s.front() == '+' && s[1] != '-')
+    s.remove_prefix(1);
+  if constexpr (std::is_integral_v<T>) {
+    bool negative = std::is_signed_v<T> && !s.empty() && s.front() == '-';
+    std::string_view digits = s.substr(negative);
+    // anything shorter than digits10 fits; longer input takes the slow,
+    // overflow-checking path below
+    if (!digits.empty() &&
+        digits.size() <= size_t{std::numeric_limits<T>::digits10}) {
+      uint64_t value;
+      if (!parse_digits(digits, value))
+        return false;
+      out = negative ? static_cast<T>(0 - static_cast<T>(value))
+                     : static_cast<T>(value);
+      return true;
+    }
+  }
+  const char *last = s.data() + s.size();
+  auto [end, ec] = std::from_chars(s.data(), last, out);
+  return ec == std::errc() && end == last;
+}
+} // namespace detail
+
+// The number spelled by all of `s`, or nullopt if it is not one or does not
+// fit in T. Integers are decimal; a leading '+' is accepted.
+template <detail::Parsable T> std::optional<T> parse(std::string_view s) {
+  T value;
+  if (!detail::parse_number(s, value))
+    return std::nullopt;
+  return value;
+}
+
+// Parses a column of fields, e.g. gathered with split_into(), into `out`.
+// Stops at the first field that is not a T and returns how many were
+// converted, so fields.size() means all of them.
+template <detail::Parsable T>
+size_t parse_into(std::span<const std::string_view> fields, std::span<T> out) {
+  size_t n = std::min(fields.size(), out.size());
+  for (size_t i = 0; i < n; ++i)
+    if (!detail::parse_number(fields[i], out[i]))
+      return i;
+  return n;
+}
+
+// Same, replacing the contents of `out`, which ends up with one value per
+// field converted.
+template <detail::Parsable T, typename Alloc>
+size_t parse_into(std::span<const std::string_view> fields,
+                  std::vector<T, Alloc> &out) {
+  out.resize(fields.size());
+  size_t n = parse_into(fields, std::span<T>(out));
+  out.resize(n);
+  return n;
+}
+
+// Writes `value` as exactly `width` decimal digits, two at a time.
+template <std::unsigned_integral U>
+void write_digits(char *out, U value, int width) {
+  static constexpr auto pairs = [] {
+    std::array<char, 200> table{};
+    for (int i = 0; i < 100; ++i) {
+      table[i * 2] = static_cast<char>('0' + i / 10);
+      table[i * 2 + 1] = static_cast<char>('0' + i % 10);
+    }
+    return table;
+  }();
+  char *p = out + width;
+  while (p - out >= 2) {
+    p -= 2;
+    std::memcpy(p, pairs.data() + (value % 100) * 2, 2);
+    value /= 100;
+  }
+  if (p != out)
+    *--p = static_cast<char>('0' + value % 10);
+}
+
+// Room write_int() may need.
+inline constexpr size_t max_int_chars = 20;
+
+// Writes `value` in decimal at `out` and returns the end.
+template <std::integral T> char *write_int(char *out, T value) {
+  using U = std::make_unsigned_t<T>;
+  auto magnitude = static_cast<U>(value);
+  if constexpr (std::is_signed_v<T>) {
+    if (value < 0) {
+      *out++ = '-';
+      magnitude = static_cast<U>(0 - magnitude);
+    }
+  }
+  int width = 1;
+  for (U limit = 10; width < std::numeric_limits<U>::digits10 + 1 &&
+                     magnitude >= limit;
+       limit *= 10)
+    ++width;
+  write_digits(out, magnitude, width);
+  return out + width;
+}
+
+// Appends `value` to `out`: integers in decimal, floating point in the
+// shortest form that parses back to the same value.
+template <detail::Parsable T> void append_number(std::string &out, T value) {
+  char buf[64];
+  char *end;
+  if constexpr (std::is_integral_v<T>)
+    end = write_int(buf, value);
+  else
+    end = std::to_chars(buf, buf + sizeof(buf), value).ptr;
+  out.append(buf, end);
 }
 } // namespace mutils
+
+template <typename Delim>
+inline constexpr bool
+    std::ranges::enable_borrowed_range<mutils::SplitRange<Delim>> = true;
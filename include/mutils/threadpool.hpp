@@ -0,0 +1,536 @@
+#pragma once
+
+#include "logger.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <format>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace mutils {
+class ThreadPool;
+
+namespace detail {
+// Anything the pool runs. run() owns the task and frees it.
+struct PoolTask {
+  void (*run)(PoolTask *);
+};
+
+// Chase-Lev work-stealing deque, after Le et al., "Correct and Efficient
+// Work-Stealing for Weak Memory Models": the owning worker pushes and pops
+// at the bottom without contention, other threads steal from the top. The
+// buffer doubles when full; old ones are kept until the deque goes away,
+// since a thief may still be reading from one.
+class WorkDeque {
+public:
+  explicit WorkDeque(size_t capacity = 256) {
+    buffers_.push_back(std::make_unique<Buffer>(std::bit_ceil(capacity)));
+    buffer_.store(buffers_.back().get(), std::memory_order_relaxed);
+  }
+
+  // Owner only.
+  void push(PoolTask *task) {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_acquire);
+    Buffer *buf = buffer_.load(std::memory_order_relaxed);
+    if (b - t >= static_cast<int64_t>(buf->capacity))
+      buf = grow(buf, t, b);
+    buf->put(b, task);
+    bottom_.store(b + 1, std::memory_order_release);
+  }
+
+  // Owner only; newest first.
+  PoolTask *pop() {
+    int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    Buffer *buf = buffer_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_seq_cst);
+    int64_t t = top_.load(std::memory_order_seq_cst);
+    if (t > b) {
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    PoolTask *task = buf->get(b);
+    if (t == b) {
+      // the last task: race the thieves for it
+      if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                        std::memory_order_relaxed))
+        task = nullptr;
+      bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return task;
+  }
+
+  // Any thread; oldest first. May fail spuriously when racing other thieves.
+  PoolTask *steal() {
+    int64_t t = top_.load(std::memory_order_seq_cst);
+    int64_t b = bottom_.load(std::memory_order_seq_cst);
+    if (t >= b)
+      return nullptr;
+    PoolTask *task = buffer_.load(std::memory_order_acquire)->get(t);
+    if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed))
+      return nullptr;
+    return task;
+  }
+
+  bool empty() const {
+    return bottom_.load(std::memory_order_relaxed) <=
+           top_.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Buffer {
+    explicit Buffer(size_t size)
+        : capacity(size), slots(new std::atomic<PoolTask *>[size]) {}
+
+    PoolTask *get(int64_t i) const {
+      return slots[static_cast<size_t>(i) & (capacity - 1)].load(
+          std::memory_order_relaxed);
+    }
+    void put(int64_t i, PoolTask *task) {
+      slots[static_cast<size_t>(i) & (capacity - 1)].store(
+          task, std::memory_order_relaxed);
+    }
+
+    size_t capacity;
+    std::unique_ptr<std::atomic<PoolTask *>[]> slots;
+  };
+
+  Buffer *grow(Buffer *old, int64_t t, int64_t b) {
+    buffers_.push_back(std::make_unique<Buffer>(old->capacity * 2));
+    Buffer *bigger = buffers_.back().get();
+    for (int64_t i = t; i < b; ++i)
+      bigger->put(i, old->get(i));
+    buffer_.store(bigger, std::memory_order_release);
+    return bigger;
+  }
+
+  alignas(64) std::atomic<int64_t> top_{0};
+  alignas(64) std::atomic<int64_t> bottom_{0};
+  std::atomic<Buffer *> buffer_;
+  std::vector<std::unique_ptr<Buffer>> buffers_; // owner only
+};
+
+// Result slot shared by a submitted task and its Future, which release it
+// in either order.
+template <typename R> struct TaskState : PoolTask {
+  virtual ~TaskState() = default;
+
+  void release() {
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      delete this;
+  }
+
+  void publish() {
+    ready.store(true, std::memory_order_release);
+    ready.notify_all();
+  }
+
+  std::atomic<uint32_t> refs{2};
+  std::atomic<bool> ready{false};
+  std::exception_ptr error;
+  std::conditional_t<std::is_void_v<R>, bool, std::optional<R>> value{};
+};
+
+template <typename R, typename F> struct Job final : TaskState<R> {
+  explicit Job(F &&f) : fn(std::move(f)) { this->run = &Job::execute; }
+  explicit Job(const F &f) : fn(f) { this->run = &Job::execute; }
+
+  static void execute(PoolTask *task) {
+    auto *self = static_cast<Job *>(task);
+    try {
+      if constexpr (std::is_void_v<R>)
+        self->fn();
+      else
+        self->value.emplace(self->fn());
+    } catch (...) {
+      self->error = std::current_exception();
+    }
+    self->publish();
+    self->release();
+  }
+
+  F fn;
+};
+} // namespace detail
+
+// Handle to the result of ThreadPool::submit(). Move-only. Waiting on a
+// pool worker runs other tasks meanwhile, so tasks may wait on each other.
+template <typename R> class Future {
+public:
+  Future() = default;
+  Future(Future &&other) noexcept
+      : state_(std::exchange(other.state_, nullptr)), pool_(other.pool_) {}
+  Future &operator=(Future &&other) noexcept {
+    if (this != &other) {
+      reset();
+      state_ = std::exchange(other.state_, nullptr);
+      pool_ = other.pool_;
+    }
+    return *this;
+  }
+  Future(const Future &) = delete;
+  Future &operator=(const Future &) = delete;
+  ~Future() { reset(); }
+
+  bool valid() const { return state_ != nullptr; }
+
+  bool ready() const {
+    return state_ && state_->ready.load(std::memory_order_acquire);
+  }
+
+  void wait() const;
+
+  // Waits, then returns the result or rethrows what the task threw. Leaves
+  // the future empty.
+  R get() {
+    wait();
+    auto *state = std::exchange(state_, nullptr);
+    // release the state however we leave
+    std::unique_ptr<detail::TaskState<R>, void (*)(detail::TaskState<R> *)>
+        guard(state, [](detail::TaskState<R> *s) { s->release(); });
+    if (state->error)
+      std::rethrow_exception(state->error);
+    if constexpr (!std::is_void_v<R>)
+      return std::move(*state->value);
+  }
+
+private:
+  friend class ThreadPool;
+  Future(detail::TaskState<R> *state, ThreadPool *pool)
+      : state_(state), pool_(pool) {}
+
+  void reset() {
+    if (state_)
+      std::exchange(state_, nullptr)->release();
+  }
+
+  detail::TaskState<R> *state_ = nullptr;
+  ThreadPool *pool_ = nullptr;
+};
+
+struct ThreadPoolOptions {
+  unsigned threads = 0; // 0 = one per core
+  // Pin worker i to CPU i (modulo the core count); Linux and Windows only.
+  bool pin_threads = false;
+  // Workers log as "[THREAD <name>-<index>]".
+  std::string name = "worker";
+};
+
+// Fixed set of workers, each with its own work-stealing deque. Tasks
+// submitted by a worker go to its deque (no locking) and are stolen by idle
+// workers; tasks from other threads go through a shared queue.
+class ThreadPool {
+public:
+  explicit ThreadPool(const ThreadPoolOptions &opts = {}) {
+    unsigned count = opts.threads;
+    if (count == 0)
+      count = std::max(1u, std::thread::hardware_concurrency());
+    workers_.reserve(count);
+    for (unsigned i = 0; i < count; ++i)
+      workers_.push_back(std::make_unique<Worker>());
+    for (unsigned i = 0; i < count; ++i)
+      workers_[i]->thread = std::thread(
+          [this, i, opts] { worker_main(i, opts.name, opts.pin_threads); });
+  }
+
+  explicit ThreadPool(unsigned threads)
+      : ThreadPool(ThreadPoolOptions{.threads = threads}) {}
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // Runs whatever is still queued, then joins the workers.
+  ~ThreadPool() {
+    stop_.store(true, std::memory_order_seq_cst);
+    epoch_.fetch_add(1, std::memory_order_release);
+    epoch_.notify_all();
+    for (auto &w : workers_)
+      w->thread.join();
+  }
+
+  // Shared pool with one worker per core, started on first use.
+  static ThreadPool &global() {
+    static ThreadPool pool;
+    return pool;
+  }
+
+  unsigned size() const { return static_cast<unsigned>(workers_.size()); }
+
+  // Index of the calling thread among this pool's workers, or -1.
+  int worker_index() const {
+    return current_pool_ == this ? static_cast<int>(current_index_) : -1;
+  }
+
+  template <typename F>
+  auto submit(F &&fn) -> Future<std::invoke_result_t<std::decay_t<F> &>> {
+    using R = std::invoke_result_t<std::decay_t<F> &>;
+    auto *job = new detail::Job<R, std::decay_t<F>>(std::forward<F>(fn));
+    spawn(job);
+    return Future<R>(job, this);
+  }
+
+  // Calls fn(i) for every i in [first, last). The range is split in halves
+  // down to `grain` indices (0 picks about 8 pieces per worker), and idle
+  // workers steal the halves, so uneven iterations balance out. The caller
+  // works on the range too. The first exception is rethrown once every
+  // piece has finished; pieces not started by then are skipped.
+  template <typename F>
+  void parallel_for(size_t first, size_t last, F &&fn, size_t grain = 0) {
+    if (first >= last)
+      return;
+    if (grain == 0)
+      grain = std::max<size_t>(1, (last - first) / (size() * 8));
+    RangeGroup<std::remove_reference_t<F>> group(fn, grain);
+    run_range(group, first, last);
+    help_until(group.pending);
+    if (group.error)
+      std::rethrow_exception(group.error);
+  }
+
+  // Folds [first, last) into acc = reduce(acc, map(i)) in pieces of `grain`
+  // indices, each starting from `init`, then combines the pieces in index
+  // order. `init` should be the identity of `reduce`.
+  template <typename T, typename Map, typename Reduce>
+  T parallel_reduce(size_t first, size_t last, T init, Map &&map,
+                    Reduce &&reduce, size_t grain = 0) {
+    if (first >= last)
+      return init;
+    if (grain == 0)
+      grain = std::max<size_t>(1, (last - first) / (size() * 8));
+    size_t pieces = (last - first + grain - 1) / grain;
+    std::vector<std::optional<T>> partial(pieces);
+    parallel_for(
+        0, pieces,
+        [&](size_t p) {
+          T acc = init;
+          size_t end = std::min(last, first + (p + 1) * grain);
+          for (size_t i = first + p * grain; i < end; ++i)
+            acc = reduce(std::move(acc), map(i));
+          partial[p].emplace(std::move(acc));
+        },
+        1);
+    T result = std::move(init);
+    for (auto &p : partial)
+      result = reduce(std::move(result), std::move(*p));
+    return result;
+  }
+
+private:
+  template <typename R> friend class Future;
+
+  struct alignas(64) Worker {
+    detail::WorkDeque deque;
+    std::thread thread;
+  };
+
+  template <typename F> struct RangeGroup {
+    RangeGroup(F &f, size_t g) : fn(f), grain(g) {}
+
+    F &fn;
+    size_t grain;
+    std::atomic<size_t> pending{1}; // pieces not finished yet
+    std::atomic<bool> failed{false};
+    std::exception_ptr error; // written by whoever set `failed`
+  };
+
+  template <typename Group> struct RangeTask : detail::PoolTask {
+    RangeTask(ThreadPool *p, Group *g, size_t f, size_t l)
+        : pool(p), group(g), first(f), last(l) {
+      run = &RangeTask::execute;
+    }
+
+    static void execute(detail::PoolTask *task) {
+      auto *self = static_cast<RangeTask *>(task);
+      auto [pool, group, first, last] =
+          std::tuple(self->pool, self->group, self->first, self->last);
+      delete self;
+      pool->run_range(*group, first, last);
+    }
+
+    ThreadPool *pool;
+    Group *group;
+    size_t first;
+    size_t last;
+  };
+
+  // Hands the upper halves to the pool until a piece is small enough, then
+  // runs it.
+  template <typename Group>
+  void run_range(Group &group, size_t first, size_t last) {
+    while (last - first > group.grain) {
+      size_t mid = first + (last - first) / 2;
+      group.pending.fetch_add(1, std::memory_order_relaxed);
+      spawn(new RangeTask<Group>(this, &group, mid, last));
+      last = mid;
+    }
+    if (!group.failed.load(std::memory_order_relaxed)) {
+      try {
+        for (size_t i = first; i < last; ++i)
+          group.fn(i);
+      } catch (...) {
+        if (!group.failed.exchange(true, std::memory_order_relaxed))
+          group.error = std::current_exception();
+      }
+    }
+    if (group.pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      group.pending.notify_all();
+  }
+
+  void spawn(detail::PoolTask *task) {
+    if (current_pool_ == this) {
+      workers_[current_index_]->deque.push(task);
+    } else {
+      std::lock_guard lock(injected_mtx_);
+      injected_.push_back(task);
+      injected_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+    // pairs with the sleeper count increment in worker_main
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers_.load(std::memory_order_relaxed) > 0) {
+      epoch_.fetch_add(1, std::memory_order_release);
+      epoch_.notify_one();
+    }
+  }
+
+  detail::PoolTask *find_task() {
+    if (current_pool_ == this)
+      if (auto *task = workers_[current_index_]->deque.pop())
+        return task;
+    if (injected_count_.load(std::memory_order_relaxed) > 0) {
+      std::lock_guard lock(injected_mtx_);
+      if (!injected_.empty()) {
+        auto *task = injected_.front();
+        injected_.pop_front();
+        injected_count_.fetch_sub(1, std::memory_order_relaxed);
+        return task;
+      }
+    }
+    // start at a different victim on every thread
+    thread_local size_t victim = std::hash<std::thread::id>{}(
+        std::this_thread::get_id());
+    for (size_t n = 0; n < workers_.size(); ++n) {
+      auto &w = workers_[victim++ % workers_.size()];
+      if (auto *task = w->deque.steal())
+        return task;
+    }
+    return nullptr;
+  }
+
+  // Runs tasks until `pending` drops to 0, then sleeps on it once nothing
+  // is left to steal.
+  void help_until(std::atomic<size_t> &pending) {
+    for (;;) {
+      size_t left = pending.load(std::memory_order_acquire);
+      if (left == 0)
+        return;
+      if (auto *task = find_task())
+        task->run(task);
+      else
+        pending.wait(left, std::memory_order_acquire);
+    }
+  }
+
+  void help_until(const std::atomic<bool> &ready) {
+    bool on_worker = current_pool_ == this;
+    while (!ready.load(std::memory_order_acquire)) {
+      auto *task = on_worker ? find_task() : nullptr;
+      if (task)
+        task->run(task);
+      else
+        ready.wait(false, std::memory_order_acquire);
+    }
+  }
+
+  void worker_main(unsigned index, const std::string &name, bool pin) {
+    current_pool_ = this;
+    current_index_ = index;
+    Logger::set_thread_name(std::format("{}-{}", name, index), index);
+    if (pin)
+      pin_to_cpu(index);
+
+    for (;;) {
+      if (auto *task = find_task()) {
+        task->run(task);
+        continue;
+      }
+      uint32_t epoch = epoch_.load(std::memory_order_acquire);
+      sleepers_.fetch_add(1, std::memory_order_seq_cst);
+      // pairs with the fence in spawn(): either it sees this sleeper or the
+      // re-check below sees its task. The RMW alone does not order the
+      // relaxed loads in find_task() after it.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      // re-check: a task may have been spawned before we were counted
+      if (auto *task = find_task()) {
+        sleepers_.fetch_sub(1, std::memory_order_relaxed);
+        task->run(task);
+        continue;
+      }
+      if (stop_.load(std::memory_order_seq_cst)) {
+        sleepers_.fetch_sub(1, std::memory_order_relaxed);
+        return;
+      }
+      epoch_.wait(epoch, std::memory_order_acquire);
+      sleepers_.fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+
+  static void pin_to_cpu(unsigned index) {
+    unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+#ifdef _WIN32
+    SetThreadAffinityMask(GetCurrentThread(),
+                          DWORD_PTR{1} << (index % cpus % 64));
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(index % cpus, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)index;
+    (void)cpus;
+#endif
+  }
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::mutex injected_mtx_;
+  std::deque<detail::PoolTask *> injected_;
+  std::atomic<size_t> injected_count_{0};
+  std::atomic<uint32_t> epoch_{0};
+  std::atomic<uint32_t> sleepers_{0};
+  std::atomic<bool> stop_{false};
+  inline static thread_local ThreadPool *current_pool_ = nullptr;
+  inline static thread_local unsigned current_index_ = 0;
+};
+
+template <typename R> void Future<R>::wait() const {
+  if (!state_ || state_->ready.load(std::memory_order_acquire))
+    return;
+  pool_->help_until(state_->ready);
+}
+} // namespace mutils
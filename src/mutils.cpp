@@ -0,0 +1,3 @@
+// The out-of-line parts of the headers, built once for MUTILS_COMPILED.
+#include "mutils/logger_impl.hpp"
+#include "mutils/sinks_impl.hpp"
@@ -1,5 +1,68 @@
 #include "mutils/mutils.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <ranges>
+#include <sstream>
+#include <stdexcept>
+#include <string>
 #include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <csignal>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace mutils_test::a_namespace_long_enough_to_matter {
+// At the default context level the tag is this whole signature, which is
+// well past 128 bytes once the template arguments are spelled out.
+template <typename T>
+bool context_tag_is_whole(
+    const std::vector<std::pair<std::string, std::vector<T>>> &) {
+  constexpr std::string_view tag = mutils::extract_context(
+      std::source_location::current().function_name(),
+      MUTILS_LOG_CONTEXT_LEVEL);
+  constexpr std::string_view prefix =
+      mutils::detail::LinePrefix<mutils::LogLevel::WARN,
+                                 MUTILS_CONTEXT_NAME_()>::plain.view();
+  return prefix.size() == tag.size() + 11 &&
+         prefix.substr(1, tag.size()) == tag &&
+         (MUTILS_LOG_CONTEXT_LEVEL < 4 || tag.size() > 128);
+}
+} // namespace mutils_test::a_namespace_long_enough_to_matter
+
+namespace mutils_test {
+// Deferred, so it is formatted on the async backend thread, which then logs
+// far more than its own ring holds.
+struct Chatty {
+  int lines;
+};
+} // namespace mutils_test
+
+namespace mutils_test {
+// Constructed before its thread's metrics handle, so destroyed after it,
+// like a pooled object reporting on its way out.
+struct LateReporter {
+  mutils::Counter counter;
+  ~LateReporter() { counter.add(); }
+};
+} // namespace mutils_test
+
+template <> struct std::formatter<mutils_test::Chatty> {
+  constexpr auto parse(std::format_parse_context &ctx) { return ctx.begin(); }
+  auto format(const mutils_test::Chatty &c, std::format_context &ctx) const {
+    for (int i = 0; i < c.lines; ++i)
+      LOG("logged while formatting a deferred argument, line {}", i);
+    return std::format_to(ctx.out(), "chatty");
+  }
+};
 
 int main() {
   if (!mutils::Logger::init_file("test_log.txt")) {
@@ -8,9 +71,27 @@ int main() {
   };
 
   LOG_WCTX("This is a log message with context, value: {}", 123);
+  // compilers spell function names differently, so the expected tag comes
+  // from the same function_name()
+  constexpr std::string_view main_tag = mutils::extract_context(
+      std::source_location::current().function_name(),
+      MUTILS_LOG_CONTEXT_LEVEL);
+  constexpr std::string_view main_prefix =
+      mutils::detail::LinePrefix<mutils::LogLevel::WARN,
+                                 MUTILS_CONTEXT_NAME_()>::plain.view();
+  static_assert(main_prefix.ends_with("[WARN]: ") &&
+                main_prefix.size() ==
+                    (main_tag.empty() ? 8 : main_tag.size() + 11) &&
+                main_prefix.substr(1, main_tag.size()) == main_tag);
+  if (!mutils_test::a_namespace_long_enough_to_matter::context_tag_is_whole<
+          std::string>({})) {
+    LOG_ERR("LOG_WCTX cut a long context tag short");
+    return -1;
+  }
   DEFER(mutils::Logger::close_file());
   mutils::Logger::print_build_info();
   auto timer = mutils::Timer{};
+  auto cycle_timer = mutils::CycleTimer{};
   DEFER(timer.printElapsed("Total execution time"));
   DEFER(LOG("Exiting main function"));
   LOG("This is a log message with value: {}", 42);
@@ -24,11 +105,579 @@ int main() {
   }
 
   LOG("File read successfully, size: {} bytes", file2->size());
+
+  std::ostringstream main_id;
+  main_id << std::this_thread::get_id();
+  if (mutils::Logger::get().thread_id() != main_id.str()) {
+    LOG_ERR("Logger thread id {} differs from {}",
+            mutils::Logger::get().thread_id(), main_id.str());
+    return -1;
+  }
+#ifdef __linux__
+  // reports a size of 0, so it is read until EOF
+  auto status = mutils::readFileToString("/proc/self/status");
+  if (!status || status->find("Pid:") == std::string::npos) {
+    LOG_ERR("Failed to read /proc/self/status");
+    return -1;
+  }
+#endif
+
+  auto mapped =
+      mutils::mapFile("CMakeLists.txt", mutils::MapAdvice::SEQUENTIAL);
+  if (!mapped.has_value() || mapped->view() != *file2) {
+    LOG_ERR("Mapped file does not match readFileToString");
+    return -1;
+  }
   LOG("This is a debug message with file2:\n {}", *file2);
 
+  // tiny blocks, so most lines straddle two of them
+  static_assert(std::ranges::input_range<mutils::ChunkedReader>);
+  for (bool read_ahead : {false, true}) {
+    auto reader = mutils::ChunkedReader::open("CMakeLists.txt", 7, read_ahead);
+    if (!reader || !std::ranges::equal(mutils::lines(*reader),
+                                       mutils::lines(*file2))) {
+      LOG_ERR("ChunkedReader lines differ from LineRange");
+      return -1;
+    }
+  }
+
+  std::vector<std::filesystem::path> batch = {"CMakeLists.txt",
+                                              "non_existent_file.txt"};
+  for (bool io_uring : {true, false}) {
+    auto batch_read = mutils::readFiles(batch, {.io_uring = io_uring});
+    if (!batch_read[0] || batch_read[1] ||
+        std::string_view(batch_read[0]->data(), batch_read[0]->size()) !=
+            *file2) {
+      LOG_ERR("readFiles (io_uring={}) does not match readFileToString",
+              io_uring);
+      return -1;
+    }
+  }
+#if MUTILS_IO_URING && defined(MUTILS_TESTING)
+  // Enough files to cycle the ring's slots, so closes are queued when a
+  // submit fails; every file must still arrive and no descriptor leak.
+  std::vector<std::filesystem::path> many;
+  for (const auto &entry :
+       std::filesystem::directory_iterator("include/mutils"))
+    many.push_back(entry.path());
+  for (size_t i = many.size(); many.size() < 300; ++i)
+    many.push_back(many[i % many.size()]);
+  many.push_back("non_existent_file.txt");
+  auto open_fds = [] {
+    return std::ranges::distance(
+        std::filesystem::directory_iterator("/proc/self/fd"));
+  };
+  for (int fail_after : {1, 2, 3, 5, 8}) {
+    auto fds_before = open_fds();
+    mutils::detail::io_uring_fail_submit_after = fail_after;
+    auto many_read = mutils::readFiles(many);
+    mutils::detail::io_uring_fail_submit_after = -1;
+    for (size_t i = 0; i < many.size(); ++i) {
+      auto expected = mutils::readFileToString(many[i]);
+      if (many_read[i].has_value() != expected.has_value() ||
+          (expected && std::string_view(many_read[i]->data(),
+                                        many_read[i]->size()) != *expected)) {
+        LOG_ERR("readFiles differs after io_uring failure ({}): {}",
+                fail_after, many[i].string());
+        return -1;
+      }
+    }
+    if (open_fds() != fds_before) {
+      LOG_ERR("readFiles leaked descriptors after io_uring failure ({})",
+              fail_after);
+      return -1;
+    }
+  }
+#endif
+
   for (const auto &line : mutils::lines(*file2)) {
     LOG_DBG("Line: {}", line);
   }
 
+  static_assert(std::ranges::forward_range<mutils::LineRange>);
+  std::string crlf = "first\r\n\r\nthird\nlast, no newline";
+  auto non_empty = mutils::lines(crlf) |
+                   std::views::filter([](auto l) { return !l.empty(); });
+  if (std::ranges::distance(mutils::lines(crlf)) != 4 ||
+      std::ranges::distance(non_empty) != 3 ||
+      *mutils::lines(crlf).begin() != "first") {
+    LOG_ERR("LineRange split \"{}\" incorrectly", crlf);
+    return -1;
+  }
+
+  std::string many_lines;
+  for (int i = 1; i <= 100000; ++i)
+    many_lines += std::to_string(i) + '\n';
+  auto sum = mutils::parallel_lines(
+      many_lines, 0LL,
+      [](long long &acc, std::string_view line) {
+        acc += std::stoll(std::string(line));
+      },
+      std::plus<>{}, 4);
+  if (sum != 100000LL * 100001 / 2) {
+    LOG_ERR("parallel_lines sum mismatch: {}", sum);
+    return -1;
+  }
+
+  std::string_view row = " id, name ,, value ";
+  std::array<std::string_view, 3> fields;
+  size_t field_count = mutils::split_into(row, ',', fields);
+  auto tokens = mutils::split(std::string(row), ',');
+  if (field_count != 4 || tokens.size() != 4 ||
+      mutils::trim_view(fields[1]) != "name" || !fields[2].empty() ||
+      std::ranges::distance(mutils::split_view("a::b::", "::")) != 2 ||
+      std::ranges::distance(mutils::split_any_view("a;b,c", ",;")) != 3) {
+    LOG_ERR("split_view/trim_view mismatch on \"{}\"", row);
+    return -1;
+  }
+
+  // request-scoped parsing out of a stack buffer, with no upstream to fall
+  // back on
+  alignas(std::max_align_t) std::array<char, 4096> stack_buffer;
+  mutils::Arena arena(stack_buffer.data(), stack_buffer.size(), 4096,
+                      std::pmr::null_memory_resource());
+  {
+    mutils::ArenaScope scope(arena);
+    auto arena_tokens = mutils::split(row, ',', &arena);
+    auto arena_lines = mutils::lines(crlf, &arena);
+    if (arena_tokens.size() != 4 || arena_tokens[1] != " name " ||
+        arena_lines.size() != 4 || arena.used() == 0) {
+      LOG_ERR("arena split/lines mismatch");
+      return -1;
+    }
+  }
+  std::pmr::vector<int> pooled_values(&mutils::ObjectPool<64>::local());
+  pooled_values.push_back(1);
+  if (arena.used() != 0 || pooled_values.front() != 1) {
+    LOG_ERR("arena kept {} bytes after its scope", arena.used());
+    return -1;
+  }
+
+  std::string mixed = "Hello, World; 123";
+  mutils::to_upper_ascii(mixed);
+  auto line_count = std::ranges::distance(mutils::lines(*file2));
+  if (mixed != "HELLO, WORLD; 123" ||
+      !mutils::iequals(mixed, "hello, world; 123") ||
+      mutils::count_byte(*file2, '\n') != static_cast<size_t>(line_count) ||
+      mutils::find_any_of(mixed, ";,") != 5 ||
+      !mutils::startsWith(mixed, "HELLO")) {
+    LOG_ERR("string kernels mismatch ({})",
+            mutils::simd::isa_name(mutils::simd::detect_isa()));
+    return -1;
+  }
+
+  std::vector<std::string_view> column;
+  mutils::split_into("17,-4,+250,1234567890123456,x9", ',', column);
+  std::vector<int64_t> parsed;
+  std::string formatted;
+  mutils::append_number(formatted, INT64_MIN);
+  formatted += ' ';
+  mutils::append_number(formatted, 0.1);
+  if (mutils::parse<int>("-123") != -123 || mutils::parse<int>("+42") != 42 ||
+      mutils::parse<uint64_t>("18446744073709551615") != UINT64_MAX ||
+      mutils::parse<uint64_t>("18446744073709551616") ||
+      mutils::parse<int>("12345678901") || mutils::parse<unsigned>("-1") ||
+      mutils::parse<int>("4x2") || mutils::parse<int>("") ||
+      mutils::parse<int>("+-1") || mutils::parse<double>("2.5") != 2.5 ||
+      mutils::parse_into(column, parsed) != 4 ||
+      parsed.back() != 1234567890123456 ||
+      formatted != "-9223372036854775808 0.1") {
+    LOG_ERR("number parsing mismatch, formatted '{}'", formatted);
+    return -1;
+  }
+
+  // both clocks measured the same interval so far
+  double cycle_ms = cycle_timer.elapsedMs();
+  double steady_ms = timer.elapsedMs();
+  if (cycle_ms <= 0 || cycle_ms > steady_ms * 1.05 + 1) {
+    LOG_ERR("CycleTimer {} ms vs Timer {} ms (counter: {}, {:.0f} Hz)",
+            cycle_ms, steady_ms, mutils::FastClock::uses_counter(),
+            mutils::FastClock::frequency());
+    return -1;
+  }
+
+  int cleanups = 0;
+  {
+    auto guard = mutils::ScopeGuard([&] { cleanups += 100; });
+    guard.dismiss();
+    DEFER_SUCCESS(cleanups += 1);
+    DEFER_FAIL(cleanups += 100);
+  }
+  try {
+    DEFER_FAIL(cleanups += 10);
+    DEFER_SUCCESS(cleanups += 100);
+    throw std::runtime_error("unwind");
+  } catch (const std::runtime_error &) {
+  }
+  if (cleanups != 11) {
+    LOG_ERR("scope guards ran the wrong cleanups: {}", cleanups);
+    return -1;
+  }
+
+  // arguments are only evaluated for the calls that get through
+  int every_n = 0, first_n = 0, every_ms = 0;
+  for (int i = 0; i < 25; ++i) {
+    // expressions, like LOG, at any MUTILS_MIN_LOG_LEVEL
+    (void)(LOG_EVERY_N(10, "every 10th: {}", ++every_n),
+           LOG_FIRST_N(2, "first 2: {}", ++first_n));
+    LOG_EVERY_MS(60000, "once a minute: {}", ++every_ms);
+  }
+  if (every_n != 3 || first_n != 2 || every_ms != 1) {
+    LOG_ERR("rate-limited logs evaluated {}/{}/{} times", every_n, first_n,
+            every_ms);
+    return -1;
+  }
+
+  mutils::detail::TimestampCache stamps;
+  char stamp[mutils::detail::TimestampCache::max_size];
+  std::string first_stamp(stamp, stamps.write(stamp, 1714564799'987654321, 3));
+  std::string next_stamp(stamp, stamps.write(stamp, 1714564800'000012345, 6));
+  if (first_stamp != "2024-05-01T11:59:59.987Z " ||
+      next_stamp != "2024-05-01T12:00:00.000012Z ") {
+    LOG_ERR("timestamps formatted as '{}' and '{}'", first_stamp, next_stamp);
+    return -1;
+  }
+  mutils::Logger::set_timestamps(mutils::Timestamps::MICROS);
+  LOG("this line is timestamped");
+  mutils::Logger::set_timestamps(mutils::Timestamps::OFF);
+
+  auto memory = std::make_shared<mutils::MemorySink>(2);
+  auto queued = std::make_shared<mutils::MemorySink>(8);
+  auto async_sink = std::make_shared<mutils::AsyncSink>(queued);
+  memory->set_level(mutils::LogLevel::WARN);
+  mutils::Logger::add_sink(memory);
+  mutils::Logger::add_sink(async_sink);
+  for (int i = 0; i < 3; ++i) {
+    LOG("sink info {}", i);
+    LOG_WARN("sink warning {}", i);
+  }
+  mutils::Logger::flush_all();
+  mutils::Logger::remove_sink(memory.get());
+  mutils::Logger::remove_sink(async_sink.get());
+  auto kept = memory->lines();
+  if (kept.size() != 2 || !kept[0].ends_with("[WARN]: sink warning 1") ||
+      !kept[1].ends_with("[WARN]: sink warning 2") ||
+      queued->lines().size() != 6) {
+    LOG_ERR("sinks kept {} and {} lines", kept.size(),
+            queued->lines().size());
+    return -1;
+  }
+
+#ifndef _WIN32
+  {
+    auto recorder = mutils::FlightRecorder::create(
+        {.lines_per_thread = 4, .max_line = 16, .file = "test_flight.bin"});
+    if (!recorder) {
+      LOG_ERR("Failed to create the flight recorder");
+      return -1;
+    }
+    mutils::Logger::add_sink(recorder);
+    for (int i = 0; i < 6; ++i)
+      LOG("recorded {}", i);
+    std::thread([] { LOG("recorded elsewhere"); }).join();
+    mutils::Logger::flush_all();
+    mutils::Logger::remove_sink(recorder.get());
+    auto recorded = recorder->lines();
+    recorder.reset();
+    auto reread = mutils::FlightRecorder::read("test_flight.bin");
+    std::filesystem::remove("test_flight.bin");
+    // 4 lines of the first thread then 1 of the second, cut to 16 bytes
+    if (recorded.size() != 5 || !reread || *reread != recorded ||
+        recorded[0].size() != 16 || recorded[4].size() != 16) {
+      LOG_ERR("flight recorder kept {} lines", recorded.size());
+      return -1;
+    }
+  }
+  {
+    // the crash handler passes the signal on to the one it replaced
+    auto recorder = mutils::FlightRecorder::create({.lines_per_thread = 1});
+    pid_t child = recorder ? ::fork() : -1;
+    if (child == 0) {
+      int null = ::open("/dev/null", O_WRONLY);
+      ::dup2(null, STDERR_FILENO);
+      struct sigaction previous{};
+      previous.sa_handler = [](int) { ::_exit(42); };
+      ::sigaction(SIGFPE, &previous, nullptr);
+      recorder->install_crash_handlers();
+      ::raise(SIGFPE);
+      ::_exit(1);
+    }
+    int status = 0;
+    if (child < 0 || ::waitpid(child, &status, 0) != child ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != 42) {
+      LOG_ERR("the crash handler did not chain to the previous one");
+      return -1;
+    }
+  }
+#endif
+
+  {
+    mutils::ThreadPool pool(3);
+    auto worker_lines = std::make_shared<mutils::MemorySink>(1);
+    mutils::Logger::add_sink(worker_lines);
+    auto index = pool.submit([&] {
+      LOG("hello from the pool");
+      return pool.worker_index();
+    });
+    int worker = index.get();
+    mutils::Logger::flush_all();
+    mutils::Logger::remove_sink(worker_lines.get());
+
+    std::vector<int> squares(1000);
+    pool.parallel_for(0, squares.size(), [&](size_t i) {
+      squares[i] = static_cast<int>(i * i);
+    });
+    auto sum = pool.parallel_reduce(
+        0, squares.size(), int64_t{0}, [&](size_t i) { return squares[i]; },
+        std::plus<>{});
+    auto failing = pool.submit([]() -> int { throw std::runtime_error("x"); });
+    bool rethrown = false;
+    try {
+      failing.get();
+    } catch (const std::runtime_error &) {
+      rethrown = true;
+    }
+    auto logged = worker_lines->lines();
+    if (worker < 0 || logged.size() != 1 ||
+        logged[0].find(std::format("worker-{}", worker)) ==
+            std::string::npos ||
+        sum != 332833500 || !rethrown) {
+      LOG_ERR("thread pool: worker {}, sum {}", worker, sum);
+      return -1;
+    }
+  }
+
+  std::atomic<int> profiled{0};
+  if (!mutils::Tracer::start("test_trace.json")) {
+    LOG_ERR("Failed to start trace");
+    return -1;
+  }
+  {
+    std::vector<std::jthread> workers;
+    for (int t = 0; t < 2; ++t) {
+      workers.emplace_back([&profiled] {
+        for (int i = 0; i < 1000; ++i) {
+          PROFILE_SCOPE("test zone");
+          profiled += i;
+        }
+      });
+    }
+  }
+  mutils::Tracer::stop();
+  auto trace = mutils::readFileToString("test_trace.json");
+  std::string_view begin_event = "\"ph\":\"B\"";
+  size_t begins = 0;
+  for (size_t at = trace ? trace->find(begin_event) : std::string::npos;
+       at != std::string::npos; at = trace->find(begin_event, at + 1))
+    ++begins;
+  if (!trace || begins != 2000 ||
+      !trace->ends_with("]}\n")) {
+    LOG_ERR("trace is missing zone events");
+    return -1;
+  }
+  auto zones = mutils::Profiler::snapshot();
+  if (zones.size() != 1 || zones[0].count != 2000 ||
+      zones[0].min_ns > zones[0].p50_ns || zones[0].p50_ns > zones[0].max_ns) {
+    LOG_ERR("profiler recorded {} zones", zones.size());
+    return -1;
+  }
+  mutils::Profiler::report();
+
+  {
+    auto served = mutils::Metrics::counter("test_requests_total");
+    auto depth = mutils::Metrics::gauge("test_queue_depth");
+    auto sizes = mutils::Metrics::distribution("test_request_bytes");
+    {
+      std::vector<std::jthread> workers;
+      for (int t = 0; t < 4; ++t)
+        workers.emplace_back([&] {
+          // its add() is dropped rather than re-attaching the thread
+          thread_local mutils_test::LateReporter late{served};
+          for (int i = 0; i < 1000; ++i) {
+            served.add();
+            sizes.record(static_cast<uint64_t>(i));
+          }
+        });
+    }
+    depth.set(3);
+    depth.add(0.5);
+    {
+      mutils::MetricsReporter reporter(
+          {.log = false, .prometheus_file = "test_metrics.prom"});
+    }
+    auto prom = mutils::readFileToString("test_metrics.prom");
+    std::filesystem::remove("test_metrics.prom");
+    auto snap = mutils::Metrics::snapshot();
+    auto statsd = mutils::Metrics::statsd(snap, {});
+    if (mutils::Metrics::counter("test_requests_total").id() != served.id() ||
+        snap.counters.size() != 1 || snap.counters[0].value != 4000 ||
+        snap.gauges.size() != 1 || snap.gauges[0].value != 3.5 ||
+        snap.distributions.size() != 1 ||
+        snap.distributions[0].count != 4000 ||
+        snap.distributions[0].max != 999 || !prom ||
+        prom->find("test_requests_total 4000\n") == std::string::npos ||
+        prom->find("test_request_bytes_count 4000\n") == std::string::npos ||
+        statsd.empty() || statsd[0] != "test_requests_total:4000|c") {
+      LOG_ERR("metrics snapshot has {} counters", snap.counters.size());
+      return -1;
+    }
+  }
+
+  mutils::Logger::start_async({.ring_bytes = 1 << 16});
+  {
+    std::vector<std::jthread> workers;
+    for (int t = 0; t < 4; ++t) {
+      workers.emplace_back([t] {
+        for (int i = 0; i < 1000; ++i)
+          LOG("async message {} from worker {}", i, t);
+      });
+    }
+  }
+  mutils::Logger::flush_all();
+  mutils::Logger::stop_async();
+
+  mutils::Logger::start_async({.defer_formatting = true});
+  for (int i = 0; i < 100; ++i) {
+    LOG("deferred message {} {:.2f}", i, i * 0.5);
+    LOG_WCTX("deferred message with context {}", i);
+  }
+  LOG("not deferred, has a string argument: {}", "text");
+  mutils::Logger::stop_async();
+
+  // the backend cannot block on its own full ring; it writes synchronously
+  mutils::Logger::start_async({.ring_bytes = 1 << 12,
+                               .overflow = mutils::OverflowPolicy::BLOCK,
+                               .defer_formatting = true});
+  LOG("deferred argument that logs: {}", mutils_test::Chatty{200});
+  mutils::Logger::flush_all();
+  mutils::Logger::stop_async();
+
+  int evaluated = 0;
+  auto count = [&evaluated] { return ++evaluated; };
+  mutils::Logger::set_level(mutils::LogLevel::WARN);
+  LOG("filtered at runtime: {}", count());
+  LOG_DBG("filtered at runtime: {}", count());
+  LOG_WARN("passes the runtime threshold: {}", count());
+  mutils::Logger::set_level(mutils::LogLevel::DEBUG);
+  if (evaluated != (mutils::compiled_in(mutils::LogLevel::WARN) ? 1 : 0)) {
+    LOG_ERR("filtered log arguments were evaluated {} times", evaluated);
+    return -1;
+  }
+
+  mutils::Logger::set_console(false);
+  if (!mutils::Logger::init_file("test_rotate.log") ||
+      !mutils::Logger::set_rotation({.max_bytes = 4096, .keep = 100})) {
+    LOG_ERR("Failed to set up log rotation");
+    return -1;
+  }
+  for (int i = 0; i < 1000; ++i) {
+    LOG("rotated line {}", i);
+    if (i % 100 == 0) // give the rotator a chance to run
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  mutils::Logger::close_file();
+  mutils::Logger::set_rotation({});
+  mutils::Logger::set_console(true);
+  size_t rotated_files = 0, rotated_lines = 0;
+  for (unsigned i = 0; i <= 100; ++i) {
+    auto path = i == 0 ? std::string("test_rotate.log")
+                       : "test_rotate.log." + std::to_string(i);
+    if (!std::filesystem::exists(path))
+      continue;
+    if (auto text = mutils::readFileToString(path)) {
+      rotated_lines += mutils::count_byte(*text, '\n');
+      rotated_files += i > 0;
+      std::filesystem::remove(path);
+    }
+  }
+  if (rotated_files == 0 || rotated_lines != 1000) {
+    LOG_ERR("rotation kept {} lines in {} rolled files", rotated_lines,
+            rotated_files);
+    return -1;
+  }
+
+  // Once a file has been rotated its rotation thread keeps running, so
+  // both times a quiet log reaches the file without another write.
+  auto &log_sink = mutils::LogSink::get();
+  log_sink.flush_interval = std::chrono::milliseconds(10);
+  for (bool async : {false, true}) {
+    mutils::Logger::init_file("test_idle.log");
+    if (async)
+      mutils::Logger::start_async({});
+    LOG("the last line before going quiet");
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    auto idle_log = mutils::readFileToString("test_idle.log");
+    if (async)
+      mutils::Logger::stop_async();
+    mutils::Logger::close_file();
+    std::filesystem::remove("test_idle.log");
+    if (!idle_log || idle_log->find("going quiet") == std::string::npos) {
+      LOG_ERR("idle log line still buffered (async={})", async);
+      return -1;
+    }
+  }
+  log_sink.flush_interval = std::chrono::milliseconds(1000);
+
+  // the second run appends after a partial block, which direct I/O has to
+  // rewrite
+  mutils::Logger::set_console(false);
+  for (bool append : {false, true}) {
+    mutils::Logger::init_file("test_direct.log",
+                              {.append = append, .direct = true});
+    for (int i = 0; i < 300; ++i)
+      LOG("direct line {}", i);
+    mutils::Logger::close_file();
+  }
+  mutils::Logger::set_console(true);
+  auto direct_log = mutils::readFileToString("test_direct.log");
+  std::filesystem::remove("test_direct.log");
+  if (!direct_log || mutils::count_byte(*direct_log, '\n') != 600 ||
+      !direct_log->ends_with("direct line 299\n")) {
+    LOG_ERR("direct I/O log has {} bytes",
+            direct_log ? direct_log->size() : 0);
+    return -1;
+  }
+
+  if (!mutils::Logger::init_file("test_log.bin", false,
+                                 mutils::FileFormat::BINARY)) {
+    LOG_ERR("Failed to open binary log");
+    return -1;
+  }
+  LOG("binary {} {:.2f} {:>5}|{}", 42, 1.5, "text", std::string("owned"));
+  LOG_WARN("binary {} {}", -7, std::vector<int>{}.size());
+  // dynamic width and precision take their values from nested fields
+  LOG("[{:>{}}] [{:.{}f}]", "ab", 6, 3.14159, 2);
+  LOG("char {} {:?<3} bool {} {}", 'x', 'y', true, false);
+  // short-lived threads hand their index on; the file must follow the
+  // renames
+  size_t thread_names = mutils::detail::ThreadNames::get().size();
+  for (int i = 0; i < 50; ++i) {
+    std::thread([i] {
+      mutils::Logger::set_thread_name(std::format("short-lived {}", i));
+      LOG("short-lived thread {}", i);
+    }).join();
+  }
+  thread_names = mutils::detail::ThreadNames::get().size() - thread_names;
+  mutils::Logger::close_file();
+
+  auto binary_log = mutils::mapFile("test_log.bin");
+  std::vector<std::string> decoded, decoded_threads;
+  if (binary_log) {
+    mutils::binlog::Reader reader(binary_log->view());
+    mutils::binlog::Entry entry;
+    while (reader.next(entry)) {
+      decoded.emplace_back();
+      mutils::binlog::format_message(decoded.back(), entry);
+      decoded_threads.emplace_back(entry.thread);
+    }
+  }
+  if (decoded.size() != 54 || decoded[0] != "binary 42 1.50  text|owned" ||
+      decoded[1] != "binary -7 0" || decoded[2] != "[    ab] [3.14]" ||
+      decoded[3] != "char x y?? bool true false" || thread_names > 2 ||
+      decoded_threads[53] != "short-lived 49") {
+    LOG_ERR("binary log decoded to {} messages", decoded.size());
+    return -1;
+  }
+
   return 0;
 }
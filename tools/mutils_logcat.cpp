@@ -0,0 +1,178 @@
+// Decodes binary log files (FileFormat::BINARY) back to the text lines the
+// console shows, or to one JSON object per line.
+#include "mutils/binlog.hpp"
+#include "mutils/io.hpp"
+#include "mutils/logger.hpp"
+#include "mutils/strings.hpp"
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+struct Filter {
+  int min_level = 0;
+  std::optional<std::string_view> thread;
+  int64_t since = std::numeric_limits<int64_t>::min();
+  int64_t until = std::numeric_limits<int64_t>::max();
+
+  bool accepts(const mutils::binlog::Entry &e) const {
+    return e.level >= min_level && e.timestamp_ns >= since &&
+           e.timestamp_ns <= until && (!thread || e.thread == *thread);
+  }
+};
+
+std::optional<int> parse_level(std::string_view s) {
+  std::string lower(s);
+  mutils::to_lower_ascii(lower);
+  if (lower == "debug")
+    return static_cast<int>(mutils::LogLevel::DEBUG);
+  if (lower == "info" || lower == "log")
+    return static_cast<int>(mutils::LogLevel::INFO);
+  if (lower == "warn")
+    return static_cast<int>(mutils::LogLevel::WARN);
+  if (lower == "err" || lower == "error")
+    return static_cast<int>(mutils::LogLevel::ERR);
+  return std::nullopt;
+}
+
+std::optional<int64_t> parse_int(std::string_view s) {
+  int64_t v;
+  auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), v);
+  if (ec != std::errc() || end != s.data() + s.size())
+    return std::nullopt;
+  return v;
+}
+
+std::string_view level_name(uint8_t level) {
+  static constexpr std::string_view names[] = {"DEBUG", "INFO", "WARN",
+                                               "ERROR"};
+  return level < 4 ? names[level] : "?";
+}
+
+// Same layout as the text log: "[THREAD id] [context] [LOG]: message".
+void append_text(std::string &out, const mutils::binlog::Entry &e,
+                 bool with_time) {
+  if (with_time) {
+    mutils::binlog::format_timestamp(out, e.timestamp_ns);
+    out += ' ';
+  }
+  if (e.tag == mutils::binlog::TAG_LOG) {
+    out += "[THREAD ";
+    out += e.thread;
+    out += "] ";
+    if (!e.context.empty()) {
+      out += '[';
+      out += e.context;
+      out += "] ";
+    }
+    out += mutils::detail::level_label(static_cast<mutils::LogLevel>(e.level));
+  }
+  mutils::binlog::format_message(out, e);
+  out += '\n';
+}
+
+void append_json(std::string &out, const mutils::binlog::Entry &e,
+                 std::string &message) {
+  out += "{\"time\":\"";
+  mutils::binlog::format_timestamp(out, e.timestamp_ns);
+  out += "\",\"ts_ns\":";
+  out += std::to_string(e.timestamp_ns);
+  if (e.tag == mutils::binlog::TAG_LOG) {
+    out += ",\"level\":\"";
+    out += level_name(e.level);
+    out += '"';
+  }
+  out += ",\"thread\":";
+  mutils::append_json_string(out, e.thread);
+  if (!e.context.empty()) {
+    out += ",\"context\":";
+    mutils::append_json_string(out, e.context);
+  }
+  message.clear();
+  mutils::binlog::format_message(message, e);
+  out += ",\"message\":";
+  mutils::append_json_string(out, message);
+  out += "}\n";
+}
+
+int usage(const char *argv0) {
+  std::fprintf(stderr,
+               "usage: %s [--json] [--time] [--level <debug|info|warn|err>] "
+               "[--thread <id>] [--since <ns>] [--until <ns>] <file>...\n",
+               argv0);
+  return 1;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  Filter filter;
+  bool json = false;
+  bool with_time = false;
+  std::vector<std::string_view> files;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--json") {
+      json = true;
+    } else if (arg == "--time") {
+      with_time = true;
+    } else if (arg == "--level" && has_value) {
+      auto level = parse_level(argv[++i]);
+      if (!level)
+        return usage(argv[0]);
+      filter.min_level = *level;
+    } else if (arg == "--thread" && has_value) {
+      filter.thread = argv[++i];
+    } else if ((arg == "--since" || arg == "--until") && has_value) {
+      auto ns = parse_int(argv[++i]);
+      if (!ns)
+        return usage(argv[0]);
+      (arg == "--since" ? filter.since : filter.until) = *ns;
+    } else if (!arg.starts_with("--")) {
+      files.push_back(arg);
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  if (files.empty())
+    return usage(argv[0]);
+
+  int status = 0;
+  std::string out;
+  std::string message;
+  for (auto file : files) {
+    auto mapped = mutils::mapFile(std::string(file));
+    if (!mapped) {
+      std::fprintf(stderr, "%.*s: cannot open\n",
+                   static_cast<int>(file.size()), file.data());
+      status = 1;
+      continue;
+    }
+
+    mutils::binlog::Reader reader(mapped->view());
+    mutils::binlog::Entry e;
+    while (reader.next(e)) {
+      if (!filter.accepts(e))
+        continue;
+      json ? append_json(out, e, message) : append_text(out, e, with_time);
+      if (out.size() >= (64 << 10)) {
+        std::fwrite(out.data(), 1, out.size(), stdout);
+        out.clear();
+      }
+    }
+    if (!reader.error().empty()) {
+      std::fprintf(stderr, "%.*s: %.*s\n", static_cast<int>(file.size()),
+                   file.data(), static_cast<int>(reader.error().size()),
+                   reader.error().data());
+      status = 1;
+    }
+  }
+  std::fwrite(out.data(), 1, out.size(), stdout);
+  return status;
+}